@@ -18,603 +18,8408 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include "sqlite3.h"
 #include "clips.h"
+#include "regexp.h"
 
 /*
-** CREATE VIRTUAL TABLE name USING CLIPS("templateName");
+** CREATE VIRTUAL TABLE name USING CLIPS("templateName"[, AGGREGATE=slotName]...[, UNIQUE=slotName[,slotName]...][, RESULTS=n][, TTL=slotName:seconds][, CACHE=COLUMNS][, BUDGET=bytes][, AUTOINDEX=facts][, SYMBOLS=IDS]);
 **
 ** Columns are CLIPS templates' "single" slots that allow SYMBOL, INTEGER, FLOAT and / or STRING types
+** Multislots are HIDDEN INTEGER columns of their length, INSERT and UPDATE them with CLIPS text
 ** Column ROWID (fact index) can't be set on INSERT nor changed on UPDATE
+** UPDATE puts only the slots whose interned value changes in the CLIPS modify, and skips it when none does
+** HIDDEN column "fact" (unless a slot has that name) is the Fact as a "CLIPSFact" pointer, for sql-query and clips_multifield
 ** Fact duplicates are controlled by CLIPS' setting "set-fact-duplication"
 ** Otherwise use EXISTS
+** LIKE, GLOB and REGEXP on SYMBOL and / or STRING columns are evaluated in the cursor, a literal prefix compared first,
+** LIKE without case, checked again by SQLite for PRAGMA case_sensitive_like
+** REGEXP only while regexp() is the one registered here, left to SQLite when the application has its own
+** AGGREGATE maintains COUNT, SUM, MIN and MAX of an INTEGER and / or FLOAT slot on CLIPS assert and retract,
+** COUNT(*) without constraints reads the maintained count of facts
+** TTL=slot:seconds indexes facts by slot + seconds, SELECT clips_expire(now); retracts those expired, oldest first,
+** and returns their count
+** RESULTS=n caches the facts of the n last used constrained filters until the template changes
+** UNIQUE=slot[,slot]... indexes a key for INSERT OR IGNORE / REPLACE (a modify) / ABORT and UPDATE,
+** SQLite splits arguments at commas so the arguments without = after UNIQUE are its slots
+** CACHE=COLUMNS reads scans without constraints from column arrays, appended on assert, rebuilt after a retract
+** GROUP BY or DISTINCT of one column of one CLIPS type is grouped in the cursor, not sorted by SQLite,
+** when every constraint is omitted (not LIKE), -0.0 and 0.0 in one group
+** BUDGET=bytes streams filters whose fact array could exceed it, comparing = and <> in the cursor
+** SYMBOLS=IDS makes SYMBOL only slots INTEGER columns of clips_symbols ids (nil NULL), in results, constraints and values
+** AUTOINDEX=facts indexes a slot once = filters on it visited that many facts, maintained on assert and retract,
+** dropped after 256 filters of the table without use
+**
+** (sql-query "SELECT ..." ?arg ...) in CLIPS
+**
+** multifield of the rows' columns, each row the statement's column count fields, nil for NULL, BLOB as SYMBOL,
+** "fact" columns as fact addresses, FALSE on error (binding included), arguments are bound alike (SYMBOL as BLOB,
+** nil as NULL, fact addresses as "CLIPSFact" pointers), statements are cached, with several connections on one
+** Environment it runs on the first opened that is still open
+**
+** (regexp-match "pattern" "string") and (regexp-matchi "pattern" "string") in CLIPS
+**
+** TRUE when string matches pattern (see regexp.c), case insensitive for regexp-matchi, patterns are cached per
+** Environment
+**
+** SELECT * FROM clips_statements;
+**
+** "sql", "uses" of each statement cached by sql-query
+**
+** SELECT * FROM clips_tables;
+**
+** "table", "template", "facts", "hits", "misses" (RESULTS), "memory" (bytes of the table), "cursor_memory",
+** "cursor_peak" (bytes of open cursors), "fact_memory" (estimate), "clips_memory" (MemUsed), "budget",
+** "modifies", "unchanged" (UPDATEs not modifying), "slots_unchanged" (not put in a modify) of each CLIPS table
+**
+** SELECT clips_timeout(ms);
+**
+** limits the facts scan of each following filter of CLIPS tables, 0 none, returns the previous limit
+** every filter stops on sqlite3_interrupt (SQLite 3.41) or past its limit, checked each 1024 facts, in its facts query
+** by (sql-continue), which is otherwise TRUE
+**
+** SELECT * FROM clips_symbols;
+**
+** "id", "symbol" of each symbol given an id by a SYMBOLS=IDS table, "id =" is used
+**
+** SELECT * FROM clips_indexes;
+**
+** "table", "slot", "filters" (=), "visited" (facts without an index), "entries", "memory", "uses" (AUTOINDEX),
+** "decision" (last built or dropped) of each slot of the CLIPS tables filtered by =
+**
+** SELECT * FROM clips_aggregates;
+**
+** "table", "slot" (NULL for COUNT(*)), "count", "sum", "min", "max" of each CLIPS table
+**
+** SELECT * FROM clips_matches("ruleName");
+**
+** "activation", "ce", "fact" (fact index) of each CE of the partial match of each activation on the agenda of every
+** module (the rule's module when named), read by the filter, only complete matches (activations, gone once fired),
+** the partial matches of the joins' beta memories and a column per variable are not provided, CLIPS compiles the
+** rule's variables into join tests so their names are not kept, read them from the facts
+**
+** SELECT * FROM clips_rules;
+**
+** "rule", "module", "fires", "seconds" (RHS), "alpha", "partial", "activations" (current matches),
+** "compares", "adds", "deletes" (join activity) of each rule of the current module
+**
+** SELECT * FROM clips_agenda;
+**
+** "rule", "salience", "facts", "module" of each activation on the agenda of every module, read by the filter
+**
+** SELECT clips_query_register("name", "LHS", "?variable ...");
+** SELECT clips_query_drop("name");
+**
+** builds (deftemplate SQLiteCLIPS-query-name (slot variable)...) and a rule (salience 10000) of that name asserting
+** it with logical support of LHS, hidden from clips_rules and clips_agenda, undefined on drop or close, name and
+** variables are symbols, LHS balanced CEs, CLIPS matches LHS as facts change, a result is retracted as soon as its
+** match is gone and asserted when the rule fires, which clips_query does for activations leading the agenda of the
+** focus (or MAIN), otherwise on (run)
+** SELECT * FROM clips_query("name"[, since]);
+** CREATE VIRTUAL TABLE "table" USING clips_query("name");
+**
+** "seq", "op" ('+' or '-'), "fact" (fact index of the result), then a column per variable of a CREATE VIRTUAL TABLE,
+** snapshot of the results at seq or changes after since ("since =" of the table) with the values they had
+**
+** SELECT * FROM name, clips_multifield(name.rowid, 'slot');
+**
+** "position" (from 1), "value" of each field of a multislot, read in place, "position =" and "value =" are used,
+** name.fact in place of name.rowid skips the fact index lookup
+**
+** SELECT * FROM clips_join('template', 'slot', 'template', 'slot'[, 'template', 'slot'][, 'template', 'slot']);
+**
+** "key", "fact1" ... "fact4" (fact indexes) of each combination of facts whose slots are eq (nil joins nil), a hash join
+**
+** SELECT * FROM clips_aggregate('template', 'function'[, 'slot'][, 'group_slot'][, threads]);
+**
+** "group", "facts", "value" of count, sum, avg, min or max of slot by group_slot, in the order of the groups' first fact,
+** a snapshot of the facts split over threads (default the processors, at most 8) of at least 16384 facts each,
+** merged in partition order, threads 1 runs in the caller,
+** count of a slot counts its values not nil, sum, avg, min and max need an INTEGER and / or FLOAT slot
+**
+** SELECT * FROM clips_explain('sql');
+**
+** "table", "plan" (idxStr), "pushed", "unpushed" (constraints), "estimated" (rows), "cost", "filters", "rows",
+** "filter" (how the facts were read and the CLIPS expression) of each plan of CLIPS tables considered preparing sql,
+** which is run when read only for filters, rows and filter, the plans chosen have filters, the facts read from
+** the maintained count, the CACHE=COLUMNS arrays, an AUTOINDEX, RESULTS, the cursor or an Eval
+**
+** SELECT * FROM clips_all_facts;
+**
+** "fact" (fact index), "relation", "arity" (fields of an ordered fact, slots of a template fact),
+** "fields" (CLIPS text, "(slot value)..." of template facts) of every fact, ordered facts included,
+** "relation =" reads the facts of its (implied) deftemplate, "fact =" (or rowid =) one fact
+**
+** SELECT clips_snapshot_save('path');
+** SELECT clips_snapshot_load('path');
+**
+** write the facts of the templates of the CLIPS tables to a binary file in columns, returning the templates written,
+** assert them again (new fact indexes) from the mapped file, returning the facts asserted,
+** a load that fails retracts the facts it asserted,
+** a multislot holding an address or an instance name fails the save
 */
 
+#define CLP_QRY "SQLiteCLIPS-query-" /* prefix of the rule and template of a standing query */
+
+struct clpQry {   /* standing query */
+  struct clpQry *l; /* next */
+  Environment *e;
+  Deftemplate *t;
+  char *m;        /* name, the rule and template are CLP_QRY name */
+  char *h;        /* CLIPS assert and retract function name */
+  struct clpLog { /* changes */
+    sqlite3_int64 f; /* fact index */
+    char o;       /* '+' or '-' */
+  } *g;
+  TypeHeader **v; /* values of the variables of g, k each, retained */
+  sqlite3_int64 s; /* sequence of the last g */
+  sqlite3_int64 c; /* facts */
+  unsigned long n; /* number of g */
+  unsigned long a; /* allocated g */
+  unsigned int k; /* variables, the slots of t */
+};
+
+/* release the values of the first n changes */
+static void
+clpQrl(
+  struct clpQry *q
+ ,unsigned long n
+){
+  unsigned long i;
+
+  for (i = 0; i < n * q->k; ++i)
+    Release(q->e, *(q->v + i));
+}
+
+static void
+clpQfr(
+  struct clpQry *q
+){
+  if (q->h) {
+    RemoveAssertFunction(q->e, q->h);
+    RemoveRetractFunction(q->e, q->h);
+    sqlite3_free(q->h);
+  }
+  clpQrl(q, q->n);
+  sqlite3_free(q->m);
+  sqlite3_free(q->g);
+  sqlite3_free(q->v);
+  sqlite3_free(q);
+}
+
+/* undefine the rule, removing the logical support of its facts, and the template of a standing query */
+static void
+clpQud(
+  struct clpQry *q
+){
+  CLIPSValue v;
+  char *s;
+
+  if ((s = sqlite3_mprintf("(progn(undefrule " CLP_QRY "%s)(undeftemplate " CLP_QRY "%s))", q->m, q->m))) {
+    Eval(q->e, s, &v);
+    sqlite3_free(s);
+  }
+}
+
+#define CLP_STM 16      /* sql-query prepared statements */
+#define CLP_RXC 32      /* regexp-match compiled patterns */
+#define CLP_CHK 1024    /* facts a scan visits between interrupt checks */
+#define CLP_FPT "CLIPSFact" /* sqlite3_result_pointer type of a retained Fact */
+#define CLP_ENV USER_ENVIRONMENT_DATA /* position of struct clpEnv */
+
+struct clpCtx {   /* per connection */
+  sqlite3 *d;
+  Environment *e;
+  struct clpVtb *v; /* CLIPS tables */
+  char *h;        /* CLIPS rule firing and clear function name */
+  struct clpRul { /* rule firing telemetry, hashed by rule */
+    Defrule *r;
+    sqlite3_int64 f; /* fires */
+    sqlite3_int64 t; /* RHS nanoseconds */
+  } *r;
+  struct clpRul *c; /* firing */
+  struct timespec s; /* firing start */
+  struct clpQry *q; /* standing queries */
+  struct clpStm { /* sql-query statement cache */
+    sqlite3_stmt *s;
+    sqlite3_int64 n; /* uses */
+    sqlite3_uint64 t; /* last used */
+  } p[CLP_STM];
+  struct clpCtx *l; /* next connection of the Environment */
+  struct clpSym { /* SYMBOLS=IDS dictionary, an id is the index in w + 1 */
+    CLIPSLexeme **w; /* interned symbols, retained */
+    unsigned int *x; /* hash of w by address, id */
+    unsigned int n; /* used w */
+    unsigned int k; /* size of x, a power of 2, w holds k / 2 */
+  } y;
+  struct clpPln { /* clips_explain plan of a CLIPS table */
+    struct clpVtb *t;
+    char *m;      /* table name */
+    char *s;      /* idxStr, 0 none */
+    char *p;      /* constraints pushed to the filter */
+    char *u;      /* usable constraints left to SQLite */
+    char *e;      /* how the last filter read the facts and its CLIPS expression */
+    double c;     /* estimatedCost */
+    sqlite3_int64 r; /* estimatedRows */
+    sqlite3_int64 f; /* filters */
+    sqlite3_int64 a; /* rows */
+  } *k;
+  sqlite3_uint64 w; /* clock of p */
+  sqlite3_int64 m; /* clips_timeout milliseconds of a filter, 0 none */
+  unsigned int n; /* size of r, a power of 2 */
+  unsigned int u; /* used r */
+  unsigned int i; /* used k */
+  unsigned int j; /* allocated k */
+  char o;         /* clips_explain is preparing and running a statement, recording k */
+  char f;         /* regexp() is clpRgx, REGEXP is evaluated in the cursor */
+};
+
+struct clpEnv {   /* per Environment, the context of its CLIPS functions */
+  struct clpCtx *x; /* connections in the order opened, the functions are added with the first */
+  struct clpRxc { /* regexp-match pattern cache */
+    char *p;      /* pattern */
+    sqlite3re_compiled *r;
+    sqlite3_uint64 t; /* last used */
+    unsigned int h; /* hash of p */
+    char i;       /* no case */
+  } g[CLP_RXC];
+  sqlite3_uint64 w; /* clock of g */
+  struct clpCsr *c; /* cursor of the facts query Eval sql-continue checks, 0 none */
+  int r;          /* SQLITE_INTERRUPT when sql-continue stopped the Eval */
+};
+
+/* SYMBOLS=IDS id of an interned symbol, added when new, 0 when out of memory */
+static sqlite3_int64
+clpSid(
+  struct clpCtx *x
+ ,CLIPSLexeme *l
+){
+  unsigned int i;
+
+  if (2 * (x->y.n + 1) > x->y.k) {
+    unsigned int *t;
+    unsigned int k;
+    unsigned int j;
+    void *w;
+
+    k = x->y.k ? 2 * x->y.k : 256;
+    if (!(w = sqlite3_realloc64(x->y.w, k / 2 * sizeof (*x->y.w))))
+      return (0);
+    x->y.w = w;
+    if (!(t = sqlite3_malloc64(k * sizeof (*t))))
+      return (0);
+    memset(t, 0, k * sizeof (*t));
+    for (j = 0; j < x->y.n; ++j) {
+      for (i = (unsigned int)(((sqlite3_uint64)(size_t)*(x->y.w + j) >> 4) * 2654435761u) & (k - 1); *(t + i); i = (i + 1) & (k - 1));
+      *(t + i) = j + 1;
+    }
+    sqlite3_free(x->y.x);
+    x->y.x = t;
+    x->y.k = k;
+  }
+  for (i = (unsigned int)(((sqlite3_uint64)(size_t)l >> 4) * 2654435761u) & (x->y.k - 1); *(x->y.x + i); i = (i + 1) & (x->y.k - 1))
+    if (*(x->y.w + *(x->y.x + i) - 1) == l)
+      return (*(x->y.x + i));
+  Retain(x->e, &l->header);
+  *(x->y.w + x->y.n) = l;
+  *(x->y.x + i) = ++x->y.n;
+  return (x->y.n);
+}
+
+/* the symbol of a SYMBOLS=IDS id else 0 */
+static CLIPSLexeme *
+clpSlx(
+  struct clpCtx *x
+ ,sqlite3_int64 i
+){
+  return (i > 0 && i <= x->y.n ? *(x->y.w + i - 1) : 0);
+}
+
+/* find, or if a add, a rule's telemetry */
+static struct clpRul *
+clpRlu(
+  struct clpCtx *x
+ ,Defrule *r
+ ,int a
+){
+  unsigned int i;
+
+  if (a && (x->u + 1) * 2 > x->n) {
+    struct clpRul *t;
+    unsigned int n;
+
+    n = x->n ? x->n * 2 : 64;
+    if (!(t = sqlite3_malloc(n * sizeof (*t))))
+      return (0);
+    memset(t, 0, n * sizeof (*t));
+    for (i = 0; i < x->n; ++i)
+      if ((x->r + i)->r) {
+        unsigned int j;
+
+        for (j = (unsigned int)(((sqlite3_uint64)(size_t)(x->r + i)->r >> 4) * 2654435761u) & (n - 1); (t + j)->r; j = (j + 1) & (n - 1));
+        *(t + j) = *(x->r + i);
+      }
+    sqlite3_free(x->r);
+    x->r = t;
+    x->n = n;
+  }
+  if (!x->n)
+    return (0);
+  for (i = (unsigned int)(((sqlite3_uint64)(size_t)r >> 4) * 2654435761u) & (x->n - 1); (x->r + i)->r; i = (i + 1) & (x->n - 1))
+    if ((x->r + i)->r == r)
+      return (x->r + i);
+  if (!a)
+    return (0);
+  (x->r + i)->r = r;
+  (x->r + i)->f = (x->r + i)->t = 0;
+  ++x->u;
+  return (x->r + i);
+}
+
+/* CLIPS calls these around each rule firing and on clear */
+static void
+clpBrf(
+  Environment *e
+ ,Activation *a
+ ,void *cx
+){
+#define X ((struct clpCtx *)cx)
+  X->c = clpRlu(X, a->theRule, 1);
+  clock_gettime(CLOCK_MONOTONIC, &X->s);
+  (void)e;
+#undef X
+}
+
+static void
+clpArf(
+  Environment *e
+ ,Activation *a
+ ,void *cx
+){
+#define X ((struct clpCtx *)cx)
+  struct timespec t;
+
+  if (!X->c)
+    return;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  ++X->c->f;
+  X->c->t += (sqlite3_int64)(t.tv_sec - X->s.tv_sec) * 1000000000 + (t.tv_nsec - X->s.tv_nsec);
+  X->c = 0;
+  (void)e;
+  (void)a;
+#undef X
+}
+
+static void
+clpClr(
+  Environment *e
+ ,void *cx
+){
+#define X ((struct clpCtx *)cx)
+  if (X->n)
+    memset(X->r, 0, X->n * sizeof (*X->r));
+  X->u = 0;
+  X->c = 0;
+  while (X->q) { /* clear removed their rules and templates */
+    struct clpQry *q;
+
+    q = X->q;
+    X->q = q->l;
+    clpQfr(q);
+  }
+  (void)e;
+#undef X
+}
+
+/* finalize the sql-query statements */
+static void
+clpSfn(
+  struct clpCtx *x
+){
+  unsigned int i;
+
+  for (i = 0; i < CLP_STM; ++i) {
+    sqlite3_finalize((x->p + i)->s);
+    (x->p + i)->s = 0;
+    (x->p + i)->n = 0;
+    (x->p + i)->t = 0;
+  }
+}
+
+static void
+clpCtf(
+  void *cx
+){
+#define X ((struct clpCtx *)cx)
+  if (X->h) {
+    RemoveBeforeRuleFiresFunction(X->e, X->h);
+    RemoveAfterRuleFiresFunction(X->e, X->h);
+    RemoveClearFunction(X->e, X->h);
+    sqlite3_free(X->h);
+  }
+  { /* unlink from the Environment, the last connection removes its functions */
+    struct clpEnv *v;
+    struct clpCtx **p;
+    unsigned int i;
+
+    if ((v = GetEnvironmentData(X->e, CLP_ENV)))
+      for (p = &v->x; *p && *p != X; p = &(*p)->l);
+    if (v && *p) {
+      *p = X->l;
+      if (!v->x) {
+        RemoveUDF(X->e, "sql-query");
+        RemoveUDF(X->e, "regexp-match");
+        RemoveUDF(X->e, "regexp-matchi");
+        RemoveUDF(X->e, "sql-continue");
+        for (i = 0; i < CLP_RXC; ++i) {
+          sqlite3re_free((v->g + i)->r);
+          sqlite3_free((v->g + i)->p);
+        }
+        memset(v->g, 0, sizeof (v->g));
+        v->w = 0;
+      }
+    }
+  }
+  clpSfn(X);
+  while (X->q) {
+    struct clpQry *q;
+
+    q = X->q;
+    X->q = q->l;
+    clpQud(q);
+    clpQfr(q);
+  }
+  while (X->y.n)
+    Release(X->e, &(*(X->y.w + --X->y.n))->header);
+  sqlite3_free(X->y.w);
+  sqlite3_free(X->y.x);
+  sqlite3_free(X->r);
+  sqlite3_free(X);
+#undef X
+}
+
+struct clpAgg {   /* maintained aggregate */
+  struct clpNum { /* min / max */
+    sqlite3_int64 i;
+    double r;
+    char t;       /* INTEGER_TYPE or FLOAT_TYPE */
+  } l, h;
+  sqlite3_int64 n; /* count of values */
+  sqlite3_int64 f; /* count of FLOAT values */
+  sqlite3_int64 i; /* INTEGER sum */
+  double r;       /* sum */
+  char o;         /* INTEGER sum overflow */
+  char d;         /* min / max need recomputation */
+};
+
+struct clpCol {   /* columnar cache of a template's facts */
+  sqlite3_int64 g; /* clpVtb g it reflects */
+  Fact **r;       /* facts, retained */
+  struct {        /* column */
+    union {
+      sqlite3_int64 i;
+      double r;
+      unsigned int d; /* index in w */
+    } *v;
+    unsigned char *z; /* NULL bitmap */
+    char *t;      /* CLIPS type of each row when the slot allows more than one */
+  } *c;
+  char **w;       /* dictionary of SYMBOL and STRING */
+  unsigned int *x; /* hash of w, index + 1 */
+  unsigned long n; /* rows */
+  unsigned long a; /* allocated rows */
+  unsigned int m; /* words of w */
+  unsigned int k; /* size of x, a power of 2 */
+  unsigned int u; /* cursors reading */
+};
+
+struct clpUnq {   /* UNIQUE key, CLIPS values are interned so compared by address */
+  unsigned int *s; /* slots, indexes of clpVtb s */
+  void **v;       /* key being looked up */
+  Fact **f;       /* open addressing by key */
+  unsigned long z; /* size of f, a power of 2 */
+  unsigned long n; /* facts in f */
+  unsigned int k; /* number of s */
+};
+
+struct clpRsc {   /* RESULTS=n cache of filter results */
+  struct {
+    char *k;      /* CLIPS expression, then LIKE, GLOB and REGEXP patterns */
+    Fact **f;     /* retained */
+    unsigned long l; /* size of k */
+    unsigned long n; /* number of f */
+    sqlite3_int64 g; /* clpVtb g of f */
+    sqlite3_uint64 t; /* last used */
+  } *e;
+  sqlite3_uint64 t; /* clock */
+  sqlite3_int64 h; /* hits */
+  sqlite3_int64 m; /* misses */
+  unsigned int n; /* number of e */
+};
+
+struct clpTtl {   /* TTL=slot:seconds, facts retained in a min heap of expiry */
+  struct clpTte {
+    double t;     /* slot + d */
+    Fact *f;
+  } *h;
+  double d;       /* duration */
+  unsigned long n; /* used h */
+  unsigned long a; /* allocated h */
+  unsigned long s; /* retracted facts in h */
+  unsigned int k; /* slot, index of clpVtb s */
+  char o;         /* a fact missed h (out of memory), clips_expire rebuilds h first */
+};
+
+#define CLP_AIC 256     /* filters an automatic index may go unused */
+
+struct clpAix {   /* AUTOINDEX=facts, facts of a slot in open addressing by its interned value */
+  Fact **f;
+  unsigned long z; /* size of f, a power of 2 */
+  unsigned long n; /* facts in f */
+  sqlite3_int64 t; /* clpVtb j when last used */
+  sqlite3_int64 u; /* filters using it */
+};
+
 struct clpVtb {
   sqlite3_vtab v;
   sqlite3 *d;
+  struct clpCtx *x;
+  struct clpVtb *l; /* next table of x */
+  char *m;        /* table name */
+  char *h;        /* CLIPS assert and retract function name */
   Environment *e;
   Deftemplate *t;
   struct {        /* slot */
     char *n;      /* name */
+    struct clpAgg *a;
+    struct clpAix *x; /* automatic index */
+    char *l;      /* last automatic index decision */
+    sqlite3_int64 q; /* = filters */
+    sqlite3_int64 f; /* facts they visited without an index */
+    unsigned int p; /* position in fact */
+    char d;       /* SYMBOLS=IDS, a SYMBOL only slot is an INTEGER column of clips_symbols ids */
     enum st {     /* type bit mask */
      stNone    = 0
     ,stSymbol  = 1
     ,stInteger = 2
     ,stFloat   = 4
     ,stString  = 8
+    ,stMulti   = 16 /* multislot, a HIDDEN column of its length */
     } t;
   } *s;
+  struct clpCol *k; /* CACHE=COLUMNS */
+  struct clpUnq *u; /* UNIQUE */
+  struct clpRsc *r; /* RESULTS */
+  struct clpTtl *w; /* TTL */
+  sqlite3_int64 c; /* maintained fact count */
+  sqlite3_int64 g; /* asserts and retracts */
+  sqlite3_int64 b; /* BUDGET bytes of a cursor's facts, 0 unlimited */
+  sqlite3_int64 o; /* bytes of open cursors */
+  sqlite3_int64 p; /* peak of o */
+  sqlite3_int64 i; /* modifies */
+  sqlite3_int64 q; /* UPDATEs that changed nothing, modifies not done */
+  sqlite3_int64 a; /* slots an UPDATE set to their value, not modified */
+  sqlite3_int64 z; /* AUTOINDEX facts visited before indexing a slot, 0 never */
+  sqlite3_int64 j; /* filters */
   unsigned int n;
+  char y;         /* CACHE=COLUMNS */
+  char f;         /* HIDDEN column "fact" after the slots */
 };
 
 static int
-clpDis(
-  sqlite3_vtab *vt
+clpNcm(
+  const struct clpNum *a
+ ,const struct clpNum *b
 ){
-#define V ((struct clpVtb *)vt)
-  while (V->n)
-    sqlite3_free((V->s + --V->n)->n);
-  sqlite3_free(V->s);
-  sqlite3_free(V);
-  return (SQLITE_OK);
-#undef V
+  if (a->t == INTEGER_TYPE && b->t == INTEGER_TYPE)
+    return (a->i < b->i ? -1 : a->i > b->i);
+  return (a->r < b->r ? -1 : a->r > b->r);
 }
 
-static int
-clpCon(
-  sqlite3 *db
- ,void *ev
- ,int ac
- ,const char *const *av
- ,sqlite3_vtab **vt
- ,char **er
+/* d > 0 adds, else removes, a slot value */
+static void
+clpAgv(
+  struct clpAgg *a
+ ,CLIPSValue *v
+ ,int d
 ){
-  struct clpVtb *v;
-  char *s;
-  CLIPSValue *p;
-  CLIPSValue v1;
-  CLIPSValue v2;
-  unsigned long z;
+  struct clpNum n;
 
-  if (ac < 4) {
-    *er = sqlite3_mprintf("template missing");
-    return (SQLITE_ERROR);
-  }
-  if (!(v = sqlite3_malloc(sizeof (*v)))
-   || !(s = sqlite3_mprintf("%s", *(av + 3)))) {
-    sqlite3_free(v);
-    return (SQLITE_NOMEM);
+  switch (v->header->type) {
+  case INTEGER_TYPE:
+    n.i = v->integerValue->contents;
+    n.r = (double)n.i;
+    break;
+  case FLOAT_TYPE:
+    n.i = 0;
+    n.r = v->floatValue->contents;
+    break;
+  default: /* NULL */
+    return;
   }
-  if (*s == '"' && *(s + (z = strlen(s)) - 1) == '"') {
-    z -= 2;
-    memmove(s, s + 1, z);
-    *(s + z) = '\0';
+  n.t = v->header->type;
+  if (d > 0) {
+    if (n.t == FLOAT_TYPE)
+      ++a->f;
+    else if (!a->o) {
+      if ((n.i > 0 && a->i > (sqlite3_int64)(~(sqlite3_uint64)0 >> 1) - n.i)
+       || (n.i < 0 && a->i < -(sqlite3_int64)(~(sqlite3_uint64)0 >> 1) - 1 - n.i))
+        a->o = 1;
+      else
+        a->i += n.i;
+    }
+    a->r += n.r;
+    if (!a->n++) {
+      a->l = a->h = n;
+      a->d = 0;
+    } else if (!a->d) {
+      if (clpNcm(&n, &a->l) < 0)
+        a->l = n;
+      if (clpNcm(&n, &a->h) > 0)
+        a->h = n;
+    }
+  } else {
+    if (n.t == FLOAT_TYPE)
+      --a->f;
+    else if (!a->o)
+      a->i -= n.i;
+    a->r -= n.r;
+    if (!--a->n) {
+      a->f = a->i = 0;
+      a->r = 0.0;
+      a->d = a->o = 0;
+    } else if (!clpNcm(&n, &a->l) || !clpNcm(&n, &a->h))
+      a->d = 1;
   }
-  v->d = db;
-  v->e = ev;
-  v->s = 0;
-  v->n = 0;
-  if (!(v->t = FindDeftemplate(v->e, s))) {
-    sqlite3_free(s);
-    clpDis(&v->v);
-    *er = sqlite3_mprintf("template not found %s", s);
-    return (SQLITE_ERROR);
+}
+
+/* recompute an aggregate from the template's facts */
+static void
+clpAgr(
+  struct clpVtb *v
+ ,unsigned int k
+){
+  Fact *f;
+
+  (v->s + k)->a->n = (v->s + k)->a->f = (v->s + k)->a->i = 0;
+  (v->s + k)->a->r = 0.0;
+  (v->s + k)->a->o = (v->s + k)->a->d = 0;
+  for (f = 0; (f = GetNextFactInTemplate(v->t, f));)
+    clpAgv((v->s + k)->a, f->theProposition.contents + (v->s + k)->p, 1);
+}
+
+static void
+clpCfr(
+  struct clpCol *h
+ ,unsigned int n
+){
+  if (h->c)
+    while (n) {
+      --n;
+      sqlite3_free((h->c + n)->v);
+      sqlite3_free((h->c + n)->z);
+      sqlite3_free((h->c + n)->t);
+    }
+  while (h->n)
+    ReleaseFact(*(h->r + --h->n));
+  while (h->m)
+    sqlite3_free(*(h->w + --h->m));
+  sqlite3_free(h->w);
+  sqlite3_free(h->x);
+  sqlite3_free(h->c);
+  sqlite3_free(h->r);
+  sqlite3_free(h);
+}
+
+/* CLIPS type of a slot that allows only one else -1 */
+static int
+clpCty(
+  int t
+){
+  if (t & stMulti)
+    return (INTEGER_TYPE);
+  switch (t) {
+  case stSymbol:
+    return (SYMBOL_TYPE);
+  case stInteger:
+  case stInteger | stSymbol: /* nil is NULL */
+    return (INTEGER_TYPE);
+  case stFloat:
+  case stFloat | stSymbol:
+    return (FLOAT_TYPE);
+  case stString:
+    return (STRING_TYPE);
+  default:
+    return (-1);
   }
-  sqlite3_free(s);
-  DeftemplateSlotNames(v->t, &v1);
-  if (!(s = sqlite3_mprintf("CREATE TABLE \"x\"("/*)*/))) {
-    clpDis(&v->v);
-    return (SQLITE_NOMEM);
+}
+
+/* dictionary index of a string else -1 */
+static long
+clpCid(
+  struct clpCol *h
+ ,const char *s
+){
+  unsigned int y;
+  unsigned int j;
+  unsigned char *p;
+
+  if (2 * (h->m + 1) > h->k) {
+    unsigned int *x;
+    unsigned int k;
+    void *t;
+
+    k = h->k ? 2 * h->k : 256;
+    if (!(x = sqlite3_malloc64(k * sizeof (*x))))
+      return (-1);
+    memset(x, 0, k * sizeof (*x));
+    for (j = 0; j < h->m; ++j) {
+      for (y = 2166136261u, p = (unsigned char *)*(h->w + j); *p; ++p)
+        y = (y ^ *p) * 16777619u;
+      for (y &= k - 1; *(x + y); y = (y + 1) & (k - 1));
+      *(x + y) = j + 1;
+    }
+    if (!(t = sqlite3_realloc64(h->w, k / 2 * sizeof (*h->w)))) {
+      sqlite3_free(x);
+      return (-1);
+    }
+    h->w = t;
+    sqlite3_free(h->x);
+    h->x = x;
+    h->k = k;
   }
-  for (z = 0; z < v1.multifieldValue->length; ++z) {
+  for (y = 2166136261u, p = (unsigned char *)s; *p; ++p)
+    y = (y ^ *p) * 16777619u;
+  for (y &= h->k - 1; *(h->x + y); y = (y + 1) & (h->k - 1))
+    if (!strcmp(*(h->w + *(h->x + y) - 1), s))
+      return (*(h->x + y) - 1);
+  if (!(*(h->w + h->m) = sqlite3_mprintf("%s", s)))
+    return (-1);
+  *(h->x + y) = ++h->m;
+  return (h->m - 1);
+}
+
+/* append a fact, nonzero when out of memory */
+static int
+clpCad(
+  struct clpCol *h
+ ,struct clpVtb *v
+ ,Fact *f
+){
+  CLIPSValue *p;
+  unsigned int k;
+  long d;
+
+  if (h->n == h->a) {
+    unsigned long a;
     void *t;
-    char *d;
-    unsigned long y;
-    int st;
 
-    if (!(p = v1.multifieldValue->contents + z)
-     || !DeftemplateSlotSingleP(v->t, p->lexemeValue->contents)
-     || !DeftemplateSlotTypes(v->t, p->lexemeValue->contents, &v2))
-      continue;
-    for (st = stNone, y = 0; y < v2.multifieldValue->length; ++y)
-      if (v2.multifieldValue->contents + y)
-        switch (*((v2.multifieldValue->contents + y)->lexemeValue->contents + 1)) {
-        case 'Y': /* SYMBOL */
-          st |= stSymbol;
-          break;
-        case 'N': /* INTEGER */
-          st |= stInteger;
-          break;
-        case 'L': /* FLOAT */
-          st |= stFloat;
-          break;
-        case 'T': /* STRING */
-          st |= stString;
-          break;
-        default:
-          break;
-        }
-    if (!st)
+    a = h->a ? 2 * h->a : 1024;
+    if (!(t = sqlite3_realloc64(h->r, a * sizeof (*h->r))))
+      return (1);
+    h->r = t;
+    for (k = 0; k < v->n; ++k) {
+      if (!(t = sqlite3_realloc64((h->c + k)->v, a * sizeof (*(h->c + k)->v))))
+        return (1);
+      (h->c + k)->v = t;
+      if (!(t = sqlite3_realloc64((h->c + k)->z, a / 8)))
+        return (1);
+      (h->c + k)->z = t;
+      memset((h->c + k)->z + h->a / 8, 0, (a - h->a) / 8);
+      if (clpCty((v->s + k)->t) < 0) {
+        if (!(t = sqlite3_realloc64((h->c + k)->t, a)))
+          return (1);
+        (h->c + k)->t = t;
+      }
+    }
+    h->a = a;
+  }
+  *(h->r + h->n) = f;
+  for (k = 0; k < v->n; ++k) {
+    p = f->theProposition.contents + (v->s + k)->p;
+    if ((v->s + k)->t & stMulti) {
+      ((h->c + k)->v + h->n)->i = (sqlite3_int64)p->multifieldValue->length;
       continue;
-    if (!(t = sqlite3_realloc(v->s, (v->n + 1) * sizeof (*v->s)))) {
-      clpDis(&v->v);
-      return (SQLITE_NOMEM);
     }
-    v->s = t;
-    (v->s + v->n)->t = st;
-    if (!(st & ~(stSymbol)))
-      d = " BLOB";
-    else if (!(st & ~(stSymbol | stInteger))) {
-      if (st & stSymbol)
-        d = " INTEGER";
-      else
-        d = " INTEGER NOT NULL";
-    } else if (!(st & ~(stSymbol | stFloat))) {
-      if (st & stSymbol)
-        d = " REAL";
-      else
-        d = " REAL NOT NULL";
-    } else if (!(st & ~(stSymbol | stString))) {
-      if (st & stSymbol)
-        d = " TEXT";
-      else
-        d = " TEXT NOT NULL";
-    } else if (!(st & stSymbol))
-      d = " NOT NULL";
-    else
-      d = "";
-    if (v->n)
-      s = sqlite3_mprintf("%z,\"%s\"%s", s, p->lexemeValue->contents, d);
-    else
-      s = sqlite3_mprintf("%z\"%s\"%s", s, p->lexemeValue->contents, d);
-    if (!s || !((v->s + v->n)->n = sqlite3_mprintf("%s", p->lexemeValue->contents))) {
-      clpDis(&v->v);
+    switch (p->header->type) {
+    case INTEGER_TYPE:
+      ((h->c + k)->v + h->n)->i = p->integerValue->contents;
+      break;
+    case FLOAT_TYPE:
+      ((h->c + k)->v + h->n)->r = p->floatValue->contents;
+      break;
+    case SYMBOL_TYPE:
+      if (!strcmp(p->lexemeValue->contents, "nil")) {
+        *((h->c + k)->z + h->n / 8) |= 1 << (h->n % 8);
+        break;
+      }
+      /* FALLTHROUGH */
+    case STRING_TYPE:
+      if ((d = clpCid(h, p->lexemeValue->contents)) < 0)
+        return (1);
+      ((h->c + k)->v + h->n)->d = (unsigned int)d;
+      break;
+    default:
+      *((h->c + k)->z + h->n / 8) |= 1 << (h->n % 8);
+      break;
+    }
+    if ((h->c + k)->t)
+      *((h->c + k)->t + h->n) = p->header->type;
+  }
+  RetainFact(f);
+  ++h->n;
+  return (0);
+}
+
+/* columns of a table's facts */
+static struct clpCol *
+clpCnw(
+  struct clpVtb *v
+){
+  struct clpCol *h;
+  Fact *f;
+
+  if (!(h = sqlite3_malloc(sizeof (*h))))
+    return (0);
+  memset(h, 0, sizeof (*h));
+  if (!(h->c = sqlite3_malloc64((v->n ? v->n : 1) * sizeof (*h->c)))) {
+    clpCfr(h, 0);
+    return (0);
+  }
+  memset(h->c, 0, (v->n ? v->n : 1) * sizeof (*h->c));
+  for (f = 0; (f = GetNextFactInTemplate(v->t, f));)
+    if (clpCad(h, v, f)) {
+      clpCfr(h, v->n);
+      return (0);
+    }
+  h->g = v->g;
+  return (h);
+}
+
+/* the cache of a table, built when missing or out of date */
+static struct clpCol *
+clpCbl(
+  struct clpVtb *v
+){
+  if (v->k && v->k->g == v->g)
+    return (v->k);
+  if (v->k && !v->k->u) /* else the last cursor frees it */
+    clpCfr(v->k, v->n);
+  return ((v->k = clpCnw(v)));
+}
+
+static void
+clpUfr(
+  struct clpUnq *u
+){
+  sqlite3_free(u->s);
+  sqlite3_free(u->v);
+  sqlite3_free(u->f);
+  sqlite3_free(u);
+}
+
+/* key of a fact */
+static void
+clpUfk(
+  struct clpVtb *v
+ ,Fact *f
+ ,void **k
+){
+  unsigned int j;
+
+  for (j = 0; j < v->u->k; ++j)
+    *(k + j) = (f->theProposition.contents + (v->s + *(v->u->s + j))->p)->value;
+}
+
+static unsigned long
+clpUhs(
+  struct clpUnq *u
+ ,void **k
+){
+  sqlite3_uint64 h;
+  unsigned int j;
+
+  for (h = 0, j = 0; j < u->k; ++j)
+    h = (h ^ (sqlite3_uint64)(size_t)*(k + j)) * 0x9e3779b97f4a7c15ull;
+  return ((unsigned long)(h >> 17) & (u->z - 1));
+}
+
+/* the entry of a key, 0 when not found */
+static Fact **
+clpUfd(
+  struct clpVtb *v
+ ,void **k
+){
+  unsigned long i;
+  unsigned int j;
+
+  for (i = clpUhs(v->u, k); *(v->u->f + i); i = (i + 1) & (v->u->z - 1)) {
+    for (j = 0; j < v->u->k
+     && ((*(v->u->f + i))->theProposition.contents + (v->s + *(v->u->s + j))->p)->value == *(k + j); ++j);
+    if (j == v->u->k)
+      break;
+  }
+  return (v->u->f + i);
+}
+
+/* index a fact, 1 when its key is indexed to another fact, -1 when out of memory */
+static int
+clpUin(
+  struct clpVtb *v
+ ,Fact *f
+){
+  Fact **p;
+
+  if (2 * (v->u->n + 1) > v->u->z) {
+    Fact **o;
+    unsigned long z;
+    unsigned long i;
+
+    o = v->u->f;
+    z = v->u->z;
+    if (!(v->u->f = sqlite3_malloc64((z ? 2 * z : 64) * sizeof (*v->u->f)))) {
+      v->u->f = o;
+      if (!z || v->u->n + 1 == z)
+        return (-1);
+    } else {
+      memset(v->u->f, 0, (z ? 2 * z : 64) * sizeof (*v->u->f));
+      v->u->z = z ? 2 * z : 64;
+      for (i = 0; i < z; ++i)
+        if (*(o + i)) {
+          clpUfk(v, *(o + i), v->u->v);
+          *clpUfd(v, v->u->v) = *(o + i);
+        }
+      sqlite3_free(o);
+    }
+  }
+  clpUfk(v, f, v->u->v);
+  if (*(p = clpUfd(v, v->u->v)))
+    return (*p != f);
+  *p = f;
+  ++v->u->n;
+  return (0);
+}
+
+static void
+clpUrm(
+  struct clpVtb *v
+ ,Fact *f
+){
+  unsigned long i;
+  unsigned long j;
+  unsigned long h;
+  Fact **p;
+
+  clpUfk(v, f, v->u->v);
+  if (*(p = clpUfd(v, v->u->v)) != f)
+    return;
+  *p = 0;
+  --v->u->n;
+  for (i = j = p - v->u->f; *(v->u->f + (j = (j + 1) & (v->u->z - 1)));) { /* close the gap */
+    clpUfk(v, *(v->u->f + j), v->u->v);
+    h = clpUhs(v->u, v->u->v);
+    if (i <= j ? (i < h && h <= j) : (i < h || h <= j))
+      continue;
+    *(v->u->f + i) = *(v->u->f + j);
+    *(v->u->f + j) = 0;
+    i = j;
+  }
+}
+
+/* the interned CLIPS value of an SQL value of single slot k, 0 when the slot can't hold it */
+static void *
+clpSvl(
+  struct clpVtb *v
+ ,unsigned int k
+ ,sqlite3_value *a
+){
+  if (sqlite3_value_type(a) == SQLITE_NULL && (v->s + k)->t & stSymbol)
+    return (CreateSymbol(v->e, "nil"));
+  if (sqlite3_value_type(a) == SQLITE_BLOB && (v->s + k)->t & stSymbol)
+    return (CreateSymbol(v->e, sqlite3_value_blob(a)));
+  if (sqlite3_value_type(a) == SQLITE_INTEGER && (v->s + k)->d)
+    return (clpSlx(v->x, sqlite3_value_int64(a)));
+  if (sqlite3_value_type(a) == SQLITE_INTEGER && (v->s + k)->t & stInteger)
+    return (CreateInteger(v->e, sqlite3_value_int64(a)));
+  if (sqlite3_value_type(a) == SQLITE_FLOAT && (v->s + k)->t & stFloat)
+    return (CreateFloat(v->e, sqlite3_value_double(a)));
+  if (sqlite3_value_type(a) == SQLITE_TEXT && (v->s + k)->t & stString)
+    return (CreateString(v->e, (const char *)sqlite3_value_text(a)));
+  return (0);
+}
+
+/* key of an INSERT or UPDATE, nochange from f, nonzero when it can't be a CLIPS value */
+static int
+clpUsk(
+  struct clpVtb *v
+ ,sqlite3_value **av
+ ,Fact *f
+){
+  sqlite3_value *a;
+  unsigned int j;
+  unsigned int k;
+
+  for (j = 0; j < v->u->k; ++j) {
+    k = *(v->u->s + j);
+    a = *(av + k);
+    if (f && sqlite3_value_nochange(a))
+      *(v->u->v + j) = (f->theProposition.contents + (v->s + k)->p)->value;
+    else if (!(*(v->u->v + j) = clpSvl(v, k, a)))
+      return (1);
+  }
+  return (0);
+}
+
+static void
+clpRse(
+  struct clpRsc *r
+ ,unsigned int i
+){
+  while ((r->e + i)->n)
+    ReleaseFact(*((r->e + i)->f + --(r->e + i)->n));
+  sqlite3_free((r->e + i)->k);
+  sqlite3_free((r->e + i)->f);
+  (r->e + i)->k = 0;
+  (r->e + i)->f = 0;
+  (r->e + i)->l = 0;
+}
+
+static void
+clpRsf(
+  struct clpRsc *r
+){
+  unsigned int i;
+
+  if (r->e)
+    for (i = 0; i < r->n; ++i)
+      clpRse(r, i);
+  sqlite3_free(r->e);
+  sqlite3_free(r);
+}
+
+static void
+clpTfr(
+  struct clpTtl *w
+){
+  while (w->n)
+    ReleaseFact((w->h + --w->n)->f);
+  sqlite3_free(w->h);
+  sqlite3_free(w);
+}
+
+static void
+clpTup(
+  struct clpTtl *w
+ ,unsigned long i
+){
+  struct clpTte e;
+
+  for (e = *(w->h + i); i && (w->h + (i - 1) / 2)->t > e.t; i = (i - 1) / 2)
+    *(w->h + i) = *(w->h + (i - 1) / 2);
+  *(w->h + i) = e;
+}
+
+static void
+clpTdn(
+  struct clpTtl *w
+ ,unsigned long i
+){
+  struct clpTte e;
+  unsigned long j;
+
+  for (e = *(w->h + i); (j = 2 * i + 1) < w->n; i = j) {
+    if (j + 1 < w->n && (w->h + j + 1)->t < (w->h + j)->t)
+      ++j;
+    if ((w->h + j)->t >= e.t)
+      break;
+    *(w->h + i) = *(w->h + j);
+  }
+  *(w->h + i) = e;
+}
+
+/* index a fact by its expiry, dropping retracted facts when they are half of the heap, SQLITE_NOMEM when it can't */
+static int
+clpTin(
+  struct clpVtb *v
+ ,Fact *f
+){
+  struct clpTtl *w;
+  CLIPSValue *p;
+  unsigned long i;
+  unsigned long j;
+
+  w = v->w;
+  if (w->s > 32 && w->s > w->n / 2) {
+    for (i = j = 0; i < w->n; ++i)
+      if (FactExistp((w->h + i)->f))
+        *(w->h + j++) = *(w->h + i);
+      else
+        ReleaseFact((w->h + i)->f);
+    w->n = j;
+    w->s = 0;
+    for (i = w->n / 2; i--;)
+      clpTdn(w, i);
+  }
+  p = f->theProposition.contents + (v->s + w->k)->p;
+  if (p->header->type != INTEGER_TYPE && p->header->type != FLOAT_TYPE) /* nil never expires */
+    return (SQLITE_OK);
+  if (w->n == w->a) {
+    void *t;
+
+    if (!(t = sqlite3_realloc64(w->h, (w->a ? 2 * w->a : 256) * sizeof (*w->h))))
+      return (SQLITE_NOMEM);
+    w->h = t;
+    w->a = w->a ? 2 * w->a : 256;
+  }
+  (w->h + w->n)->t = (p->header->type == INTEGER_TYPE ? (double)p->integerValue->contents : p->floatValue->contents) + w->d;
+  RetainFact(((w->h + w->n)->f = f));
+  clpTup(w, w->n++);
+  return (SQLITE_OK);
+}
+
+/* index the template's facts again after one missed the heap */
+static int
+clpTrb(
+  struct clpVtb *v
+){
+  Fact *f;
+
+  while (v->w->n)
+    ReleaseFact((v->w->h + --v->w->n)->f);
+  v->w->s = 0;
+  v->w->o = 0;
+  for (f = 0; (f = GetNextFactInTemplate(v->t, f));)
+    if (clpTin(v, f)) {
+      v->w->o = 1;
       return (SQLITE_NOMEM);
     }
-    ++v->n;
+  return (SQLITE_OK);
+}
+
+static void
+clpXfr(
+  struct clpAix *x
+){
+  sqlite3_free(x->f);
+  sqlite3_free(x);
+}
+
+static unsigned long
+clpXhs(
+  struct clpAix *x
+ ,const void *v
+){
+  return ((unsigned long)(((sqlite3_uint64)(size_t)v * 0x9e3779b97f4a7c15ull) >> 17) & (x->z - 1));
+}
+
+/* the empty entry after the facts with the value of slot k of f */
+static Fact **
+clpXfd(
+  struct clpVtb *v
+ ,unsigned int k
+ ,Fact *f
+){
+  struct clpAix *x;
+  unsigned long i;
+
+  x = (v->s + k)->x;
+  for (i = clpXhs(x, (f->theProposition.contents + (v->s + k)->p)->value); *(x->f + i); i = (i + 1) & (x->z - 1));
+  return (x->f + i);
+}
+
+/* index a fact by slot k, nonzero when out of memory */
+static int
+clpXin(
+  struct clpVtb *v
+ ,unsigned int k
+ ,Fact *f
+){
+  struct clpAix *x;
+
+  x = (v->s + k)->x;
+  if (2 * (x->n + 1) > x->z) {
+    Fact **o;
+    unsigned long z;
+    unsigned long i;
+
+    o = x->f;
+    z = x->z;
+    if (!(x->f = sqlite3_malloc64((z ? 2 * z : 64) * sizeof (*x->f)))) {
+      x->f = o;
+      return (1);
+    }
+    memset(x->f, 0, (z ? 2 * z : 64) * sizeof (*x->f));
+    x->z = z ? 2 * z : 64;
+    for (i = 0; i < z; ++i)
+      if (*(o + i))
+        *clpXfd(v, k, *(o + i)) = *(o + i);
+    sqlite3_free(o);
   }
-  if (!(s = sqlite3_mprintf(/*(*/"%z)", s))) {
-    clpDis(&v->v);
+  *clpXfd(v, k, f) = f;
+  ++x->n;
+  return (0);
+}
+
+static void
+clpXrm(
+  struct clpVtb *v
+ ,unsigned int k
+ ,Fact *f
+){
+  struct clpAix *x;
+  unsigned long i;
+  unsigned long j;
+  unsigned long h;
+
+  x = (v->s + k)->x;
+  for (i = clpXhs(x, (f->theProposition.contents + (v->s + k)->p)->value); *(x->f + i) != f; i = (i + 1) & (x->z - 1))
+    if (!*(x->f + i))
+      return;
+  *(x->f + i) = 0;
+  --x->n;
+  for (j = i; *(x->f + (j = (j + 1) & (x->z - 1)));) { /* close the gap */
+    h = clpXhs(x, ((*(x->f + j))->theProposition.contents + (v->s + k)->p)->value);
+    if (i <= j ? (i < h && h <= j) : (i < h || h <= j))
+      continue;
+    *(x->f + i) = *(x->f + j);
+    *(x->f + j) = 0;
+    i = j;
+  }
+}
+
+/* drop the automatic index of slot k, recording why */
+static void
+clpXdr(
+  struct clpVtb *v
+ ,unsigned int k
+ ,const char *w
+){
+  sqlite3_free((v->s + k)->l);
+  (v->s + k)->l = sqlite3_mprintf("filter %lld dropped %s after %lld uses", v->j, w, (v->s + k)->x->u);
+  clpXfr((v->s + k)->x);
+  (v->s + k)->x = 0;
+  (v->s + k)->f = 0;
+}
+
+/* index the facts by slot k, recording why */
+static void
+clpXbl(
+  struct clpVtb *v
+ ,unsigned int k
+){
+  Fact *f;
+
+  if (!((v->s + k)->x = sqlite3_malloc(sizeof (*(v->s + k)->x))))
+    return;
+  memset((v->s + k)->x, 0, sizeof (*(v->s + k)->x));
+  (v->s + k)->x->t = v->j;
+  for (f = 0; (f = GetNextFactInTemplate(v->t, f));)
+    if (clpXin(v, k, f)) {
+      clpXfr((v->s + k)->x);
+      (v->s + k)->x = 0;
+      return;
+    }
+  sqlite3_free((v->s + k)->l);
+  (v->s + k)->l = sqlite3_mprintf("filter %lld built after %lld = filters visited %lld facts", v->j, (v->s + k)->q, (v->s + k)->f);
+}
+
+/* count a filter's = constraints, build indexes of hot slots, drop cold ones,
+ * the column of an indexed = constraint else -1 */
+static int
+clpXpk(
+  struct clpVtb *v
+ ,const char *is
+ ,int ac
+){
+  unsigned int k;
+  int i;
+  int c;
+  char o;
+
+  ++v->j;
+  for (c = -1, i = 0; i < ac && (o = *is++); ++i) {
+    if (*is == '-') {
+      for (++is; *is >= '0' && *is <= '9'; ++is);
+      continue;
+    }
+    for (k = 0; *is >= '0' && *is <= '9'; ++is)
+      k = k * 10 + (*is - '0');
+    if (o != 'e' && o != 'i')
+      continue;
+    ++(v->s + k)->q;
+    if (!(v->s + k)->x) {
+      (v->s + k)->f += v->c; /* find-all-facts visits them all */
+      if ((v->s + k)->f >= v->z)
+        clpXbl(v, k);
+    }
+    if ((v->s + k)->x && c < 0) {
+      (v->s + k)->x->t = v->j;
+      ++(v->s + k)->x->u;
+      c = k;
+    }
+  }
+  for (k = 0; k < v->n; ++k)
+    if ((v->s + k)->x && v->j - (v->s + k)->x->t > CLP_AIC)
+      clpXdr(v, k, "unused");
+  return (c);
+}
+
+/* CLIPS calls these for each assert and retract, a modify is a retract then an assert */
+static void
+clpAst(
+  Environment *e
+ ,void *f
+ ,void *vt
+){
+#define V ((struct clpVtb *)vt)
+  unsigned int k;
+
+  if (FactDeftemplate(f) != V->t)
+    return;
+  ++V->c;
+  ++V->g;
+  if (V->k && V->k->g == V->g - 1 && !clpCad(V->k, V, f)) /* else rebuilt when read */
+    V->k->g = V->g;
+  if (V->u) /* a duplicate from CLIPS stays unindexed */
+    clpUin(V, f);
+  for (k = 0; k < V->n; ++k)
+    if ((V->s + k)->x && clpXin(V, k, f))
+      clpXdr(V, k, "out of memory");
+  if (V->w && clpTin(V, f))
+    V->w->o = 1;
+  for (k = 0; k < V->n; ++k)
+    if ((V->s + k)->a)
+      clpAgv((V->s + k)->a, ((Fact *)f)->theProposition.contents + (V->s + k)->p, 1);
+  (void)e;
+#undef V
+}
+
+static void
+clpRtr(
+  Environment *e
+ ,void *f
+ ,void *vt
+){
+#define V ((struct clpVtb *)vt)
+  unsigned int k;
+
+  if (FactDeftemplate(f) != V->t)
+    return;
+  --V->c;
+  ++V->g;
+  if (V->k && !V->k->u) { /* rebuilt when read, not keeping retracted facts */
+    clpCfr(V->k, V->n);
+    V->k = 0;
+  }
+  if (V->u)
+    clpUrm(V, f);
+  if (V->w)
+    ++V->w->s;
+  for (k = 0; k < V->n; ++k)
+    if ((V->s + k)->x)
+      clpXrm(V, k, f);
+  for (k = 0; k < V->n; ++k)
+    if ((V->s + k)->a)
+      clpAgv((V->s + k)->a, ((Fact *)f)->theProposition.contents + (V->s + k)->p, -1);
+  (void)e;
+#undef V
+}
+
+static int
+clpDis(
+  sqlite3_vtab *vt
+){
+#define V ((struct clpVtb *)vt)
+  struct clpVtb **p;
+
+  if (V->h) {
+    RemoveAssertFunction(V->e, V->h);
+    RemoveRetractFunction(V->e, V->h);
+    for (p = &V->x->v; *p; p = &(*p)->l)
+      if (*p == V) {
+        *p = V->l;
+        break;
+      }
+    sqlite3_free(V->h);
+  }
+  if (V->k)
+    clpCfr(V->k, V->n);
+  if (V->u)
+    clpUfr(V->u);
+  if (V->r)
+    clpRsf(V->r);
+  if (V->w)
+    clpTfr(V->w);
+  while (V->n) {
+    --V->n;
+    sqlite3_free((V->s + V->n)->n);
+    sqlite3_free((V->s + V->n)->a);
+    if ((V->s + V->n)->x)
+      clpXfr((V->s + V->n)->x);
+    sqlite3_free((V->s + V->n)->l);
+  }
+  sqlite3_free(V->s);
+  sqlite3_free(V->m);
+  sqlite3_free(V);
+  return (SQLITE_OK);
+#undef V
+}
+
+/* dequote a module argument in place */
+static void
+clpDeq(
+  char *s
+){
+  unsigned long z;
+
+  if (*s == '"' && *(s + (z = strlen(s)) - 1) == '"') {
+    z -= 2;
+    memmove(s, s + 1, z);
+    *(s + z) = '\0';
+  }
+}
+
+/* return the value of a "key=value" module argument else 0 */
+static const char *
+clpArg(
+  const char *a
+ ,const char *k
+){
+  unsigned long z;
+
+  z = strlen(k);
+  for (; *a == ' '; ++a);
+  if (sqlite3_strnicmp(a, k, z))
+    return (0);
+  for (a += z; *a == ' '; ++a);
+  if (*a != '=')
+    return (0);
+  for (++a; *a == ' '; ++a);
+  return (a);
+}
+
+static int
+clpCon(
+  sqlite3 *db
+ ,void *ev
+ ,int ac
+ ,const char *const *av
+ ,sqlite3_vtab **vt
+ ,char **er
+){
+  struct clpVtb *v;
+  char *s;
+  CLIPSValue *p;
+  CLIPSValue v1;
+  CLIPSValue v2;
+  unsigned long z;
+  char o;
+
+  if (ac < 4) {
+    *er = sqlite3_mprintf("template missing");
+    return (SQLITE_ERROR);
+  }
+  if (!(v = sqlite3_malloc(sizeof (*v)))
+   || !(s = sqlite3_mprintf("%s", *(av + 3)))) {
+    sqlite3_free(v);
     return (SQLITE_NOMEM);
   }
-  z = sqlite3_declare_vtab(v->d, s);
+  clpDeq(s);
+  v->d = db;
+  v->x = ev;
+  v->l = 0;
+  v->m = 0;
+  v->h = 0;
+  v->e = v->x->e;
+  v->s = 0;
+  v->k = 0;
+  v->u = 0;
+  v->r = 0;
+  v->w = 0;
+  v->c = v->g = 0;
+  v->b = v->o = v->p = 0;
+  v->z = v->j = 0;
+  v->i = v->q = v->a = 0;
+  v->n = 0;
+  v->y = 0;
+  v->f = 1;
+  if (!(v->t = FindDeftemplate(v->e, s))) {
+    sqlite3_free(s);
+    clpDis(&v->v);
+    *er = sqlite3_mprintf("template not found %s", s);
+    return (SQLITE_ERROR);
+  }
   sqlite3_free(s);
-  if (z) {
+  for (o = 0, z = 4; z < (unsigned long)ac; ++z) /* declares the columns */
+    if (clpArg(*(av + z), "SYMBOLS"))
+      o = 1;
+  DeftemplateSlotNames(v->t, &v1);
+  if (!(s = sqlite3_mprintf("CREATE TABLE \"x\"("/*)*/))) {
+    clpDis(&v->v);
+    return (SQLITE_NOMEM);
+  }
+  for (z = 0; z < v1.multifieldValue->length; ++z) {
+    void *t;
+    char *d;
+    unsigned long y;
+    int st;
+    int m;
+
+    if (!(p = v1.multifieldValue->contents + z)
+     || !DeftemplateSlotTypes(v->t, p->lexemeValue->contents, &v2))
+      continue;
+    m = !DeftemplateSlotSingleP(v->t, p->lexemeValue->contents);
+    for (st = stNone, y = 0; y < v2.multifieldValue->length; ++y)
+      if (v2.multifieldValue->contents + y)
+        switch (*((v2.multifieldValue->contents + y)->lexemeValue->contents + 1)) {
+        case 'Y': /* SYMBOL */
+          st |= stSymbol;
+          break;
+        case 'N': /* INTEGER */
+          st |= stInteger;
+          break;
+        case 'L': /* FLOAT */
+          st |= stFloat;
+          break;
+        case 'T': /* STRING */
+          st |= stString;
+          break;
+        default:
+          break;
+        }
+    if (!strcmp(p->lexemeValue->contents, "fact"))
+      v->f = 0;
+    if (!st && !m)
+      continue;
+    if (m)
+      st |= stMulti;
+    if (!(t = sqlite3_realloc(v->s, (v->n + 1) * sizeof (*v->s)))) {
+      clpDis(&v->v);
+      return (SQLITE_NOMEM);
+    }
+    v->s = t;
+    (v->s + v->n)->a = 0;
+    (v->s + v->n)->x = 0;
+    (v->s + v->n)->l = 0;
+    (v->s + v->n)->q = (v->s + v->n)->f = 0;
+    (v->s + v->n)->p = z;
+    (v->s + v->n)->t = st;
+    (v->s + v->n)->d = o && st == stSymbol;
+    if (m) /* read with clips_multifield(rowid, 'slot') */
+      d = " INTEGER HIDDEN";
+    else if ((v->s + v->n)->d) /* decoded by clips_symbols */
+      d = " INTEGER";
+    else if (!(st & ~(stSymbol)))
+      d = " BLOB";
+    else if (!(st & ~(stSymbol | stInteger))) {
+      if (st & stSymbol)
+        d = " INTEGER";
+      else
+        d = " INTEGER NOT NULL";
+    } else if (!(st & ~(stSymbol | stFloat))) {
+      if (st & stSymbol)
+        d = " REAL";
+      else
+        d = " REAL NOT NULL";
+    } else if (!(st & ~(stSymbol | stString))) {
+      if (st & stSymbol)
+        d = " TEXT";
+      else
+        d = " TEXT NOT NULL";
+    } else if (!(st & stSymbol))
+      d = " NOT NULL";
+    else
+      d = "";
+    if (v->n)
+      s = sqlite3_mprintf("%z,\"%s\"%s", s, p->lexemeValue->contents, d);
+    else
+      s = sqlite3_mprintf("%z\"%s\"%s", s, p->lexemeValue->contents, d);
+    if (!s || !((v->s + v->n)->n = sqlite3_mprintf("%s", p->lexemeValue->contents))) {
+      clpDis(&v->v);
+      return (SQLITE_NOMEM);
+    }
+    ++v->n;
+  }
+  if (v->f) /* the Fact as a pointer, see CLP_FPT */
+    s = sqlite3_mprintf("%z%s\"fact\" HIDDEN", s, v->n ? "," : "");
+  if (!s || !(s = sqlite3_mprintf(/*(*/"%z)", s))) {
+    clpDis(&v->v);
+    return (SQLITE_NOMEM);
+  }
+  z = sqlite3_declare_vtab(v->d, s);
+  sqlite3_free(s);
+  if (z) {
     clpDis(&v->v);
     return (z);
   }
-  sqlite3_vtab_config(v->d, SQLITE_VTAB_CONSTRAINT_SUPPORT, 1);
-  *vt = &v->v;
+  sqlite3_vtab_config(v->d, SQLITE_VTAB_CONSTRAINT_SUPPORT, 1);
+  for (z = 4; z < (unsigned long)ac; ++z) {
+    const char *a;
+    unsigned int k;
+
+    if ((a = clpArg(*(av + z), "UNIQUE"))) {
+      const char *b;
+      void *t;
+
+      if (v->u) {
+        *er = sqlite3_mprintf("UNIQUE twice %s", a);
+        clpDis(&v->v);
+        return (SQLITE_ERROR);
+      }
+      if (!(v->u = sqlite3_malloc(sizeof (*v->u)))) {
+        clpDis(&v->v);
+        return (SQLITE_NOMEM);
+      }
+      memset(v->u, 0, sizeof (*v->u));
+      if (!(s = sqlite3_mprintf("%s", a))) {
+        clpDis(&v->v);
+        return (SQLITE_NOMEM);
+      }
+      clpDeq(s);
+      /* SQLite splits UNIQUE=a,b at the comma, the arguments without = that follow are slots */
+      for (; z + 1 < (unsigned long)ac && !strchr(*(av + z + 1), '='); ++z)
+        if (!(s = sqlite3_mprintf("%z,%s", s, *(av + z + 1)))) {
+          clpDis(&v->v);
+          return (SQLITE_NOMEM);
+        }
+      for (b = s; *b == ' '; ++b);
+      while (*b) { /* slot[,slot]... */
+        const char *e;
+        unsigned int k;
+
+        for (e = b; *e && *e != ',' && *e != ' '; ++e);
+        for (k = 0; k < v->n
+         && (strncmp((v->s + k)->n, b, e - b) || *((v->s + k)->n + (e - b))); ++k);
+        if (k == v->n || (v->s + k)->t & stMulti
+         || !(t = sqlite3_realloc(v->u->s, (v->u->k + 1) * sizeof (*v->u->s)))) {
+          if (k == v->n || (v->s + k)->t & stMulti)
+            *er = sqlite3_mprintf("UNIQUE slot not a column %.*s", (int)(e - b), b);
+          sqlite3_free(s);
+          clpDis(&v->v);
+          return (*er ? SQLITE_ERROR : SQLITE_NOMEM);
+        }
+        v->u->s = t;
+        *(v->u->s + v->u->k++) = k;
+        for (b = e; *b == ',' || *b == ' '; ++b);
+      }
+      sqlite3_free(s);
+      if (!v->u->k || !(v->u->v = sqlite3_malloc(v->u->k * sizeof (*v->u->v)))) {
+        if (!v->u->k)
+          *er = sqlite3_mprintf("UNIQUE without slots");
+        clpDis(&v->v);
+        return (*er ? SQLITE_ERROR : SQLITE_NOMEM);
+      }
+      continue;
+    }
+    if ((a = clpArg(*(av + z), "TTL"))) {
+      const char *b;
+      unsigned int k;
+
+      if (!(s = sqlite3_mprintf("%s", a))) {
+        clpDis(&v->v);
+        return (SQLITE_NOMEM);
+      }
+      clpDeq(s);
+      for (b = s; *b && *b != ':'; ++b);
+      for (k = 0; k < v->n
+       && (strncmp((v->s + k)->n, s, b - s) || *((v->s + k)->n + (b - s))); ++k);
+      if (v->w || k == v->n || (v->s + k)->t & ~(stInteger | stFloat | stSymbol) || !((v->s + k)->t & (stInteger | stFloat))
+       || *b != ':' || atof(b + 1) <= 0.0) {
+        *er = sqlite3_mprintf("TTL not once INTEGER and / or FLOAT slot:seconds %s", s);
+        sqlite3_free(s);
+        clpDis(&v->v);
+        return (SQLITE_ERROR);
+      }
+      if (!(v->w = sqlite3_malloc(sizeof (*v->w)))) {
+        sqlite3_free(s);
+        clpDis(&v->v);
+        return (SQLITE_NOMEM);
+      }
+      memset(v->w, 0, sizeof (*v->w));
+      v->w->d = atof(b + 1);
+      v->w->k = k;
+      sqlite3_free(s);
+      continue;
+    }
+    if ((a = clpArg(*(av + z), "RESULTS"))) {
+      int n;
+
+      if (v->r || (n = atoi(a)) < 1 || n > 1024) {
+        *er = sqlite3_mprintf("RESULTS not once 1 to 1024 %s", a);
+        clpDis(&v->v);
+        return (SQLITE_ERROR);
+      }
+      if (!(v->r = sqlite3_malloc(sizeof (*v->r)))
+       || !(v->r->e = sqlite3_malloc(n * sizeof (*v->r->e)))) {
+        if (v->r)
+          v->r->e = 0;
+        clpDis(&v->v);
+        return (SQLITE_NOMEM);
+      }
+      memset(v->r->e, 0, n * sizeof (*v->r->e));
+      v->r->n = n;
+      v->r->t = 0;
+      v->r->h = v->r->m = 0;
+      continue;
+    }
+    if ((a = clpArg(*(av + z), "SYMBOLS"))) {
+      if (sqlite3_strnicmp(a, "IDS", 3)) {
+        *er = sqlite3_mprintf("SYMBOLS not IDS %s", a);
+        clpDis(&v->v);
+        return (SQLITE_ERROR);
+      }
+      continue;
+    }
+    if ((a = clpArg(*(av + z), "AUTOINDEX"))) {
+      if (v->z || (v->z = strtoll(a, 0, 10)) < 1) {
+        *er = sqlite3_mprintf("AUTOINDEX not once facts %s", a);
+        clpDis(&v->v);
+        return (SQLITE_ERROR);
+      }
+      continue;
+    }
+    if ((a = clpArg(*(av + z), "BUDGET"))) {
+      if (v->b || (v->b = strtoll(a, 0, 10)) < 1024) {
+        *er = sqlite3_mprintf("BUDGET not once at least 1024 bytes %s", a);
+        clpDis(&v->v);
+        return (SQLITE_ERROR);
+      }
+      continue;
+    }
+    if ((a = clpArg(*(av + z), "CACHE"))) {
+      if (sqlite3_strnicmp(a, "COLUMNS", 7)) {
+        *er = sqlite3_mprintf("CACHE not COLUMNS %s", a);
+        clpDis(&v->v);
+        return (SQLITE_ERROR);
+      }
+      v->y = 1;
+      continue;
+    }
+    if (!(a = clpArg(*(av + z), "AGGREGATE"))) {
+      *er = sqlite3_mprintf("unknown option %s", *(av + z));
+      clpDis(&v->v);
+      return (SQLITE_ERROR);
+    }
+    if (!(s = sqlite3_mprintf("%s", a))) {
+      clpDis(&v->v);
+      return (SQLITE_NOMEM);
+    }
+    clpDeq(s);
+    for (k = 0; k < v->n && strcmp((v->s + k)->n, s); ++k);
+    if (k == v->n || (v->s + k)->t & ~(stInteger | stFloat)) {
+      *er = sqlite3_mprintf("aggregate slot not INTEGER and / or FLOAT %s", s);
+      sqlite3_free(s);
+      clpDis(&v->v);
+      return (SQLITE_ERROR);
+    }
+    sqlite3_free(s);
+    if (!(v->s + k)->a) {
+      if (!((v->s + k)->a = sqlite3_malloc(sizeof (*(v->s + k)->a)))) {
+        clpDis(&v->v);
+        return (SQLITE_NOMEM);
+      }
+      clpAgr(v, k);
+    }
+  }
+  {
+    Fact *f;
+    int i;
+
+    for (f = 0; (f = GetNextFactInTemplate(v->t, f)); ++v->c) {
+      if (v->w && clpTin(v, f)) {
+        clpDis(&v->v);
+        return (SQLITE_NOMEM);
+      }
+      if (v->u && (i = clpUin(v, f))) {
+        if (i > 0)
+          *er = sqlite3_mprintf("UNIQUE key of f-%lld duplicated", FactIndex(f));
+        clpDis(&v->v);
+        return (i > 0 ? SQLITE_CONSTRAINT : SQLITE_NOMEM);
+      }
+    }
+  }
+  if (!(v->m = sqlite3_mprintf("%s", *(av + 2)))
+   || !(v->h = sqlite3_mprintf("SQLiteCLIPS %p", (void *)v))) {
+    clpDis(&v->v);
+    return (SQLITE_NOMEM);
+  }
+  v->l = v->x->v;
+  v->x->v = v;
+  if (!AddAssertFunction(v->e, v->h, clpAst, 0, v)
+   || !AddRetractFunction(v->e, v->h, clpRtr, 0, v)) {
+    *er = sqlite3_mprintf("CLIPS assert / retract function %s", v->h);
+    clpDis(&v->v);
+    return (SQLITE_ERROR);
+  }
+  *vt = &v->v;
+  return (SQLITE_OK);
+}
+
+static int
+clpCrt(
+  sqlite3 *db
+ ,void *ev
+ ,int ac
+ ,const char *const *av
+ ,sqlite3_vtab **vt
+ ,char **er
+){
+  return (clpCon(db, ev, ac, av, vt, er));
+}
+
+struct clpCsr {
+  sqlite3_vtab_cursor c;
+  struct clpVtb *t;
+  Fact *f;
+  Fact **a;         /* b when reading retained facts */
+  Fact **b;         /* reused by each filter */
+  char *e;          /* CLIPS expression, reused by each filter */
+  struct {          /* LIKE, GLOB and REGEXP, = and <> when streaming */
+    sqlite3re_compiled *r; /* compiled pattern, 0 when the literal prefix suffices */
+    char *p;        /* literal prefix */
+    TypeHeader *v;  /* = and <> interned value, retained, 0 for ROWID */
+    sqlite3_int64 i; /* = and <> ROWID */
+    unsigned int l; /* literal prefix length */
+    unsigned int c; /* column */
+    char o;         /* 'l' LIKE, 'g' GLOB, 'r' REGEXP, 'e' =, 'E' <> or '\0' match nothing */
+    char x;         /* literal prefix is the entire pattern */
+  } *m;
+  unsigned long n;
+  unsigned long o;
+  unsigned long w;  /* count mode position of f */
+  unsigned long y;  /* allocated b */
+  unsigned long z;  /* allocated e */
+  sqlite3_int64 u;  /* bytes counted in t->o */
+  sqlite3_int64 d;  /* clips_timeout deadline, CLOCK_MONOTONIC nanoseconds, 0 none */
+  struct clpCol *h;  /* columnar cache mode */
+  unsigned int k;   /* number of m */
+  unsigned int j;   /* allocated m */
+  unsigned int i;   /* facts visited since the last interrupt check */
+  unsigned int p;   /* clips_explain plan + 1 of the filter, 0 none */
+  char q;           /* count mode */
+};
+
+/* stop reading a columnar cache, freeing it when replaced */
+static void
+clpChr(
+  struct clpCsr *c
+){
+  if (!c->h)
+    return;
+  if (!--c->h->u && c->h != c->t->k)
+    clpCfr(c->h, c->t->n);
+  c->h = 0;
+}
+
+static void
+clpMfr(
+  struct clpCsr *c
+){
+  while (c->k) {
+    --c->k;
+    sqlite3re_free((c->m + c->k)->r);
+    sqlite3_free((c->m + c->k)->p);
+    if ((c->m + c->k)->v)
+      Release(c->t->e, (c->m + c->k)->v);
+  }
+}
+
+static int
+clpMre(
+  struct clpCsr *c
+ ,const char *p
+ ,int nc
+){
+  const char *e;
+
+  if ((e = sqlite3re_compile(&(c->m + c->k - 1)->r, p, nc))) {
+    sqlite3re_free((c->m + c->k - 1)->r);
+    (c->m + c->k - 1)->r = 0;
+    sqlite3_free(c->c.pVtab->zErrMsg);
+    c->c.pVtab->zErrMsg = sqlite3_mprintf("%s", e);
+    return (SQLITE_ERROR);
+  }
+  if (!(c->m + c->k - 1)->r)
+    return (SQLITE_NOMEM);
+  return (SQLITE_OK);
+}
+
+/* compile a LIKE, GLOB or REGEXP pattern once per filter */
+static int
+clpMad(
+  struct clpCsr *c
+ ,char o
+ ,unsigned int cn
+ ,const char *p
+){
+  sqlite3_str *s;
+  const char *q;
+  char *r;
+  void *t;
+  unsigned int i;
+
+  if (c->k == c->j) {
+    if (!(t = sqlite3_realloc(c->m, (c->j + 4) * sizeof (*c->m))))
+      return (SQLITE_NOMEM);
+    c->m = t;
+    c->j += 4;
+  }
+  (c->m + c->k)->r = 0;
+  (c->m + c->k)->p = 0;
+  (c->m + c->k)->v = 0;
+  (c->m + c->k)->i = 0;
+  (c->m + c->k)->l = 0;
+  (c->m + c->k)->c = cn;
+  (c->m + c->k)->o = p ? o : '\0'; /* NULL pattern matches nothing */
+  (c->m + c->k)->x = 0;
+  ++c->k;
+  if (!p)
+    return (SQLITE_OK);
+  if (o == 'r')
+    return (clpMre(c, p, 0));
+  for (i = 0; *(p + i); ++i)
+    if (o == 'l' ? (*(p + i) == '%' || *(p + i) == '_')
+                 : (*(p + i) == '*' || *(p + i) == '?' || *(p + i) == '['))
+      break;
+  if (i && !((c->m + c->k - 1)->p = sqlite3_mprintf("%.*s", i, p)))
+    return (SQLITE_NOMEM);
+  (c->m + c->k - 1)->l = i;
+  if (!*(p + i)) {
+    (c->m + c->k - 1)->x = 1;
+    return (SQLITE_OK);
+  }
+  if (!*(p + i + 1) && *(p + i) == (o == 'l' ? '%' : '*'))
+    return (SQLITE_OK);
+  if (!(s = sqlite3_str_new(0)))
+    return (SQLITE_NOMEM);
+  sqlite3_str_appendchar(s, 1, '^');
+  for (; *p; ++p) {
+    if (o == 'l' ? *p == '%' : *p == '*')
+      sqlite3_str_appendall(s, ".*");
+    else if (o == 'l' ? *p == '_' : *p == '?')
+      sqlite3_str_appendchar(s, 1, '.');
+    else if (o == 'g' && *p == '[') {
+      q = p + 1;
+      if (*q == '^')
+        ++q;
+      if (*q == ']')
+        ++q;
+      for (; *q && *q != ']'; ++q);
+      if (!*q) { /* unclosed [ matches nothing */
+        sqlite3_free(sqlite3_str_finish(s));
+        (c->m + c->k - 1)->o = '\0';
+        return (SQLITE_OK);
+      }
+      sqlite3_str_appendchar(s, 1, '[');
+      if (*++p == '^') {
+        sqlite3_str_appendchar(s, 1, '^');
+        ++p;
+      }
+      for (; p < q; ++p) {
+        if (*p == '\\' || *p == '[' || *p == ']')
+          sqlite3_str_appendchar(s, 1, '\\');
+        sqlite3_str_appendchar(s, 1, *p);
+      }
+      sqlite3_str_appendchar(s, 1, ']');
+    } else {
+      if (strchr("\\()*.+?[$^{|}]", *p))
+        sqlite3_str_appendchar(s, 1, '\\');
+      sqlite3_str_appendchar(s, 1, *p);
+    }
+  }
+  sqlite3_str_appendchar(s, 1, '$');
+  if (!(r = sqlite3_str_finish(s)))
+    return (SQLITE_NOMEM);
+  i = clpMre(c, r, o == 'l');
+  sqlite3_free(r);
+  return (i);
+}
+
+/* a streamed = ('e') or <> ('E') of a column against the interned value of a, NULL when a is 0 */
+static int
+clpMeq(
+  struct clpCsr *c
+ ,char o
+ ,int cn
+ ,sqlite3_value *a
+){
+  TypeHeader *v;
+  int i;
+
+  if ((i = clpMad(c, '\0', cn < 0 ? 0 : cn, 0)))
+    return (i);
+  if (cn < 0) { /* fact indexes start at 1 */
+    (c->m + c->k - 1)->i = a && sqlite3_value_type(a) == SQLITE_INTEGER ? sqlite3_value_int64(a) : 0;
+    (c->m + c->k - 1)->o = o;
+    return (SQLITE_OK);
+  }
+  switch (a ? sqlite3_value_type(a) : SQLITE_NULL) {
+  case SQLITE_NULL:
+    v = &CreateSymbol(c->t->e, "nil")->header;
+    break;
+  case SQLITE_INTEGER: /* an unknown id stays an INTEGER, never equal to a SYMBOL */
+    if ((c->t->s + cn)->d && clpSlx(c->t->x, sqlite3_value_int64(a)))
+      v = &clpSlx(c->t->x, sqlite3_value_int64(a))->header;
+    else
+      v = &CreateInteger(c->t->e, sqlite3_value_int64(a))->header;
+    break;
+  case SQLITE_FLOAT:
+    v = &CreateFloat(c->t->e, sqlite3_value_double(a))->header;
+    break;
+  case SQLITE_TEXT:
+    v = &CreateString(c->t->e, (const char *)sqlite3_value_text(a))->header;
+    break;
+  default:
+    v = &CreateSymbol(c->t->e, (const char *)sqlite3_value_text(a))->header;
+    break;
+  }
+  Retain(c->t->e, v);
+  (c->m + c->k - 1)->v = v;
+  (c->m + c->k - 1)->o = o;
+  return (SQLITE_OK);
+}
+
+/* return -1 on alloc error, 0 for no match, 1 for match on the interned lexeme */
+static int
+clpMch(
+  struct clpCsr *c
+ ,Fact *f
+){
+  CLIPSValue *v;
+  unsigned int i;
+  int j;
+
+  for (i = 0; i < c->k; ++i) {
+    if (!(c->m + i)->o)
+      return (0);
+    if ((c->m + i)->o == 'e' || (c->m + i)->o == 'E') {
+      if ((c->m + i)->v)
+        j = (f->theProposition.contents + (c->t->s + (c->m + i)->c)->p)->header == (c->m + i)->v;
+      else
+        j = FactIndex(f) == (c->m + i)->i;
+      if (j != ((c->m + i)->o == 'e'))
+        return (0);
+      continue;
+    }
+    v = f->theProposition.contents + (c->t->s + (c->m + i)->c)->p;
+    if (v->header->type == SYMBOL_TYPE) {
+      if (*(v->lexemeValue->contents + 0) == 'n'
+       && *(v->lexemeValue->contents + 1) == 'i'
+       && *(v->lexemeValue->contents + 2) == 'l'
+       && *(v->lexemeValue->contents + 3) == '\0')
+        return (0);
+    } else if (v->header->type != STRING_TYPE)
+      return (0);
+    if ((c->m + i)->l
+     && ((c->m + i)->o == 'l'
+      ? sqlite3_strnicmp(v->lexemeValue->contents, (c->m + i)->p, (c->m + i)->l)
+      : strncmp(v->lexemeValue->contents, (c->m + i)->p, (c->m + i)->l)))
+      return (0);
+    if ((c->m + i)->x) {
+      if (*(v->lexemeValue->contents + (c->m + i)->l))
+        return (0);
+    } else if ((c->m + i)->r) {
+      if ((j = sqlite3re_match((c->m + i)->r, (const unsigned char *)v->lexemeValue->contents, -1)) < 1)
+        return (j);
+    }
+  }
+  return (1);
+}
+
+/* every CLP_CHK facts a scan visits, SQLITE_INTERRUPT when interrupted or past clips_timeout */
+static int
+clpChk(
+  struct clpCsr *c
+){
+  struct timespec t;
+
+  if (++c->i < CLP_CHK)
+    return (SQLITE_OK);
+  c->i = 0;
+#if SQLITE_VERSION_NUMBER >= 3041000
+  if (sqlite3_is_interrupted(c->t->d))
+    return (SQLITE_INTERRUPT);
+#endif
+  if (c->d) {
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    if ((sqlite3_int64)t.tv_sec * 1000000000 + t.tv_nsec > c->d) {
+      sqlite3_free(c->c.pVtab->zErrMsg);
+      c->c.pVtab->zErrMsg = sqlite3_mprintf("clips_timeout %lld ms", c->t->x->m);
+      return (SQLITE_INTERRUPT);
+    }
+  }
+  return (SQLITE_OK);
+}
+
+/* (sql-continue) in the facts query of a filter, an error stops the query when clpChk does */
+static void
+clpScn(
+  Environment *e
+ ,UDFContext *uc
+ ,UDFValue *r
+){
+#define X ((struct clpEnv *)uc->context)
+  r->lexemeValue = TrueSymbol(e);
+  if (X->c && (X->r = clpChk(X->c)))
+    UDFThrowError(uc);
+#undef X
+}
+
+/* advance to the next matching template fact */
+static int
+clpNft(
+  struct clpCsr *c
+){
+  Fact *f;
+  int i;
+  int r;
+
+  f = c->f;
+  i = 1;
+  r = SQLITE_OK;
+  while ((c->f = GetNextFactInTemplate(c->t->t, c->f))
+   && (!(r = clpChk(c)))
+   && c->k
+   && (i = clpMch(c, c->f)) < 1)
+    if (i < 0) {
+      r = SQLITE_NOMEM;
+      break;
+    }
+  if (r)
+    c->f = 0;
+  if (c->f)
+    RetainFact(c->f);
+  if (f)
+    ReleaseFact(f);
+  return (r);
+}
+
+/* release what a filter retained, keeping the buffers */
+static void
+clpRel(
+  struct clpCsr *c
+){
+  clpMfr(c);
+  clpChr(c);
+  if (c->f)
+    ReleaseFact(c->f);
+  c->f = 0;
+  if (c->a)
+    while (c->n)
+      ReleaseFact(*(c->a + --c->n));
+  c->a = 0;
+  c->n = c->o = c->w = 0;
+  c->q = 0;
+}
+
+/* account the buffers of a cursor and x bytes CLIPS used for it to its table */
+static void
+clpCac(
+  struct clpCsr *c
+ ,sqlite3_int64 x
+){
+  sqlite3_int64 z;
+
+  z = sqlite3_msize(c) + sqlite3_msize(c->b) + sqlite3_msize(c->e) + sqlite3_msize(c->m) + x;
+  c->t->o += z - c->u;
+  c->u = z;
+  if (c->t->o > c->t->p)
+    c->t->p = c->t->o;
+}
+
+/* append to the CLIPS expression e at *l, nonzero when out of memory */
+static int
+clpEpf(
+  struct clpCsr *c
+ ,unsigned long *l
+ ,const char *f
+ ,...
+){
+  va_list a;
+  unsigned long n;
+  void *t;
+
+  for (;;) {
+    if (c->z > *l + 1) {
+      va_start(a, f);
+      sqlite3_vsnprintf((int)(c->z - *l), c->e + *l, f, a);
+      va_end(a);
+      if (*l + (n = strlen(c->e + *l)) + 1 < c->z) {
+        *l += n;
+        return (0);
+      }
+    }
+    if (!(t = sqlite3_realloc64(c->e, c->z ? 2 * c->z : 256)))
+      return (1);
+    c->e = t;
+    c->z = c->z ? 2 * c->z : 256;
+  }
+}
+
+/* load the cached result of the key e[0..l), 1 when found, -1 when out of memory */
+static int
+clpRsl(
+  struct clpCsr *c
+ ,unsigned long l
+){
+  struct clpRsc *r;
+  unsigned long j;
+  unsigned int i;
+
+  r = c->t->r;
+  for (i = 0; i < r->n; ++i)
+    if ((r->e + i)->k && (r->e + i)->g != c->t->g) /* the template changed */
+      clpRse(r, i);
+  for (i = 0; i < r->n; ++i)
+    if ((r->e + i)->l == l && !memcmp((r->e + i)->k, c->e, l))
+      break;
+  if (i == r->n) {
+    ++r->m;
+    return (0);
+  }
+  if ((r->e + i)->n > c->y) {
+    void *t;
+
+    if (!(t = sqlite3_realloc64(c->b, (r->e + i)->n * sizeof (*c->b))))
+      return (-1);
+    c->b = t;
+    c->y = (r->e + i)->n;
+  }
+  c->a = c->b;
+  for (j = 0; j < (r->e + i)->n; ++j)
+    RetainFact((*(c->a + j) = *((r->e + i)->f + j)));
+  c->n = (r->e + i)->n;
+  (r->e + i)->t = ++r->t;
+  ++r->h;
+  return (1);
+}
+
+/* cache the result of the key e[0..l) in the least recently used entry */
+static void
+clpRss(
+  struct clpCsr *c
+ ,unsigned long l
+){
+  struct clpRsc *r;
+  unsigned long j;
+  unsigned int i;
+  unsigned int k;
+
+  r = c->t->r;
+  for (k = i = 0; i < r->n; ++i)
+    if ((r->e + i)->t < (r->e + k)->t)
+      k = i;
+  clpRse(r, k);
+  if (!((r->e + k)->k = sqlite3_malloc64(l))
+   || !((r->e + k)->f = sqlite3_malloc64((c->n ? c->n : 1) * sizeof (*(r->e + k)->f)))) {
+    clpRse(r, k);
+    return;
+  }
+  memcpy((r->e + k)->k, c->e, l);
+  (r->e + k)->l = l;
+  for (j = 0; j < c->n; ++j)
+    RetainFact((*((r->e + k)->f + j) = *(c->a + j)));
+  (r->e + k)->n = c->n;
+  (r->e + k)->g = c->t->g;
+  (r->e + k)->t = ++r->t;
+}
+
+/* retain the matching template facts in a, those of the automatic index of column x when x >= 0 */
+static int
+clpAll(
+  struct clpCsr *c
+ ,int x
+){
+  struct clpAix *h;
+  TypeHeader *v;
+  Fact *f;
+  void *t;
+  unsigned long y;
+  unsigned int j;
+  int i;
+
+  c->a = c->b;
+  h = 0;
+  v = 0;
+  y = 0;
+  if (x >= 0) { /* the interned value of the = constraint is in m */
+    for (j = 0; j < c->k && ((c->m + j)->o != 'e' || !(c->m + j)->v || (c->m + j)->c != (unsigned int)x); ++j);
+    if (j == c->k)
+      return (SQLITE_OK);
+    h = (c->t->s + x)->x;
+    v = (c->m + j)->v;
+    y = clpXhs(h, v);
+  }
+  for (f = 0; h ? (f = *(h->f + y)) != 0 : (f = GetNextFactInTemplate(c->t->t, f)) != 0;) {
+    if (h)
+      y = (y + 1) & (h->z - 1);
+    if ((i = clpChk(c)))
+      return (i);
+    if (c->k && (i = clpMch(c, f)) < 1) {
+      if (i < 0)
+        return (SQLITE_NOMEM);
+      continue;
+    }
+    if (c->n == c->y) {
+      if (c->t->b && (sqlite3_int64)((c->n + 1) * sizeof (*c->b)) > c->t->b) {
+        sqlite3_free(c->c.pVtab->zErrMsg);
+        c->c.pVtab->zErrMsg = sqlite3_mprintf("%lu facts over BUDGET %lld", c->n + 1, c->t->b);
+        return (SQLITE_NOMEM);
+      }
+      if (!(t = sqlite3_realloc64(c->b, (c->y ? 2 * c->y : 64) * sizeof (*c->b))))
+        return (SQLITE_NOMEM);
+      c->a = c->b = t;
+      c->y = c->y ? 2 * c->y : 64;
+    }
+    RetainFact((*(c->a + c->n++) = f));
+  }
+  return (SQLITE_OK);
+}
+
+/* group ('G') or keep the first of ('D') the facts of a with the same interned value of column k in one hash pass */
+static int
+clpGrp(
+  struct clpCsr *c
+ ,char d
+ ,unsigned int k
+){
+  TypeHeader **h;   /* values */
+  unsigned long *x; /* group of each h */
+  unsigned long *g; /* 'G' group of each fact, then where each group starts */
+  Fact **b;
+  TypeHeader *v;
+  TypeHeader *o;    /* the first FLOAT zero, -0.0 and 0.0 are one group as in SQL */
+  unsigned long z;
+  unsigned long m;
+  unsigned long i;
+  unsigned long j;
+  unsigned long y;
+
+  if (c->n < 2)
+    return (SQLITE_OK);
+  for (z = 16; z < 2 * c->n; z *= 2);
+  h = sqlite3_malloc64(z * sizeof (*h));
+  x = sqlite3_malloc64(z * sizeof (*x));
+  g = d == 'G' ? sqlite3_malloc64(2 * c->n * sizeof (*g)) : 0;
+  b = d == 'G' ? sqlite3_malloc64(c->y * sizeof (*b)) : 0;
+  if (!h || !x || (d == 'G' && (!g || !b))) {
+    sqlite3_free(h);
+    sqlite3_free(x);
+    sqlite3_free(g);
+    sqlite3_free(b);
+    return (SQLITE_NOMEM);
+  }
+  memset(h, 0, z * sizeof (*h));
+  for (o = 0, m = j = i = 0; i < c->n; ++i) {
+    v = ((*(c->a + i))->theProposition.contents + (c->t->s + k)->p)->header;
+    if (v->type == FLOAT_TYPE && ((CLIPSFloat *)v)->contents == 0.0)
+      v = o ? o : (o = v);
+    for (y = (unsigned long)(((sqlite3_uint64)(size_t)v >> 4) * 2654435761u) & (z - 1);
+     *(h + y) && *(h + y) != v; y = (y + 1) & (z - 1));
+    if (!*(h + y)) {
+      *(h + y) = v;
+      *(x + y) = m;
+      if (g)
+        *(g + c->n + m) = 0;
+      ++m;
+    } else if (d == 'D') {
+      ReleaseFact(*(c->a + i));
+      continue;
+    }
+    if (g) {
+      *(g + i) = *(x + y);
+      ++*(g + c->n + *(x + y));
+    } else
+      *(c->a + j++) = *(c->a + i);
+  }
+  if (g) { /* counts to starts, then scatter keeping each group's order */
+    for (y = i = 0; i < m; ++i) {
+      j = *(g + c->n + i);
+      *(g + c->n + i) = y;
+      y += j;
+    }
+    for (i = 0; i < c->n; ++i)
+      *(b + (*(g + c->n + *(g + i)))++) = *(c->a + i);
+    sqlite3_free(c->b);
+    c->a = c->b = b;
+  } else
+    c->n = j;
+  sqlite3_free(h);
+  sqlite3_free(x);
+  sqlite3_free(g);
+  return (SQLITE_OK);
+}
+
+static int
+clpCls(
+  sqlite3_vtab_cursor *vc
+){
+#define V ((struct clpCsr *)vc)
+  clpRel(V);
+  V->t->o -= V->u;
+  sqlite3_free(V->m);
+  sqlite3_free(V->b);
+  sqlite3_free(V->e);
+  sqlite3_free(V);
+  return (SQLITE_OK);
+#undef V
+}
+
+static int
+clpOpn(
+  sqlite3_vtab *vt
+ ,sqlite3_vtab_cursor **vc
+){
+#define V ((struct clpVtb *)vt)
+  struct clpCsr *c;
+
+  if (!(c = sqlite3_malloc(sizeof (*c))))
+    return (SQLITE_NOMEM);
+  c->t = V; 
+  c->f = 0;
+  c->a = c->b = 0;
+  c->e = 0;
+  c->m = 0;
+  c->n = c->o = c->w = 0;
+  c->y = c->z = 0;
+  c->u = 0;
+  c->d = 0;
+  c->h = 0;
+  c->k = c->j = 0;
+  c->i = 0;
+  c->q = 0;
+  clpCac(c, 0);
+  *vc = &c->c;
+  return (SQLITE_OK);
+#undef V
+}
+
+/* free clips_explain plans */
+static void
+clpPlf(
+  struct clpPln *k
+ ,unsigned int n
+){
+  while (n) {
+    --n;
+    sqlite3_free((k + n)->m);
+    sqlite3_free((k + n)->s);
+    sqlite3_free((k + n)->p);
+    sqlite3_free((k + n)->u);
+    sqlite3_free((k + n)->e);
+  }
+  sqlite3_free(k);
+}
+
+/* the clips_explain plan + 1 of table v with idxStr s and unpushed constraints u, added when new, 0 on NOMEM */
+static unsigned int
+clpPla(
+  struct clpVtb *v
+ ,const char *s
+ ,const char *u
+){
+  struct clpCtx *x;
+  struct clpPln *k;
+  unsigned int i;
+
+  x = v->x;
+  for (i = 0; i < x->i; ++i)
+    if ((x->k + i)->t == v
+     && (s ? (x->k + i)->s && !strcmp(s, (x->k + i)->s) : !(x->k + i)->s)
+     && (!u || ((x->k + i)->u ? !strcmp(u, (x->k + i)->u) : !*u)))
+      return (i + 1);
+  if (x->i == x->j) {
+    if (!(k = sqlite3_realloc64(x->k, (x->j ? 2 * x->j : 8) * sizeof (*k))))
+      return (0);
+    x->k = k;
+    x->j = x->j ? 2 * x->j : 8;
+  }
+  k = x->k + x->i;
+  memset(k, 0, sizeof (*k));
+  k->t = v;
+  if (!(k->m = sqlite3_mprintf("%s", v->m))
+   || (s && !(k->s = sqlite3_mprintf("%s", s)))
+   || (u && *u && !(k->u = sqlite3_mprintf("%s", u)))) {
+    sqlite3_free(k->m);
+    sqlite3_free(k->s);
+    return (0);
+  }
+  return (++x->i);
+}
+
+/* record an xBestIndex result of table v for clips_explain */
+static int
+clpPlb(
+  struct clpVtb *v
+ ,sqlite3_index_info *ii
+){
+  static const struct {
+    unsigned char o;
+    const char *n;
+  } op[] = {
+    {SQLITE_INDEX_CONSTRAINT_EQ, "="}, {SQLITE_INDEX_CONSTRAINT_GT, ">"},
+    {SQLITE_INDEX_CONSTRAINT_LE, "<="}, {SQLITE_INDEX_CONSTRAINT_LT, "<"},
+    {SQLITE_INDEX_CONSTRAINT_GE, ">="}, {SQLITE_INDEX_CONSTRAINT_MATCH, "MATCH"},
+    {SQLITE_INDEX_CONSTRAINT_LIKE, "LIKE"}, {SQLITE_INDEX_CONSTRAINT_GLOB, "GLOB"},
+    {SQLITE_INDEX_CONSTRAINT_REGEXP, "REGEXP"}, {SQLITE_INDEX_CONSTRAINT_NE, "<>"},
+    {SQLITE_INDEX_CONSTRAINT_ISNOT, "IS NOT"}, {SQLITE_INDEX_CONSTRAINT_ISNOTNULL, "IS NOT NULL"},
+    {SQLITE_INDEX_CONSTRAINT_ISNULL, "IS NULL"}, {SQLITE_INDEX_CONSTRAINT_IS, "IS"},
+    {SQLITE_INDEX_CONSTRAINT_LIMIT, "LIMIT"}, {SQLITE_INDEX_CONSTRAINT_OFFSET, "OFFSET"},
+    {0, 0}
+  };
+  struct clpPln *k;
+  const char *c;
+  const char *o;
+  char *p;
+  char *u;
+  unsigned int j;
+  int i;
+
+  for (p = u = 0, i = 0; i < ii->nConstraint; ++i) {
+    if (!(ii->aConstraint + i)->usable)
+      continue;
+    if ((ii->aConstraint + i)->op == SQLITE_INDEX_CONSTRAINT_LIMIT
+     || (ii->aConstraint + i)->op == SQLITE_INDEX_CONSTRAINT_OFFSET)
+      c = "";
+    else if ((ii->aConstraint + i)->iColumn < 0)
+      c = "rowid";
+    else if ((unsigned int)(ii->aConstraint + i)->iColumn < v->n)
+      c = (v->s + (ii->aConstraint + i)->iColumn)->n;
+    else
+      c = "fact";
+    for (j = 0; op[j].n && op[j].o != (ii->aConstraint + i)->op; ++j);
+    o = op[j].n ? op[j].n : "function";
+    if ((ii->aConstraintUsage + i)->argvIndex > 0) {
+      if (!(p = sqlite3_mprintf("%z%s%s%s%s", p, p ? ", " : "", c, *c ? " " : "", o)))
+        break;
+    } else if (!(u = sqlite3_mprintf("%z%s%s%s%s", u, u ? ", " : "", c, *c ? " " : "", o)))
+      break;
+  }
+  if (i < ii->nConstraint || !(j = clpPla(v, ii->idxStr, u ? u : ""))) {
+    sqlite3_free(p);
+    sqlite3_free(u);
+    return (SQLITE_NOMEM);
+  }
+  sqlite3_free(u);
+  k = v->x->k + j - 1;
+  sqlite3_free(k->p);
+  k->p = p;
+  if (ii->orderByConsumed
+   && !(k->p = sqlite3_mprintf("%z%s%s %s", k->p, k->p ? ", " : "",
+    sqlite3_vtab_distinct(ii) == 1 ? "GROUP BY" : "DISTINCT", (v->s + ii->aOrderBy->iColumn)->n)))
+    return (SQLITE_NOMEM);
+  k->c = ii->estimatedCost;
+  k->r = ii->estimatedRows;
+  return (SQLITE_OK);
+}
+
+/* record for clips_explain how filter c read the facts, m, with CLIPS expression e, grouped by d */
+static void
+clpPld(
+  struct clpCsr *c
+ ,const char *m
+ ,const char *e
+ ,char d
+){
+  struct clpPln *k;
+
+  if (!c->p)
+    return;
+  k = c->t->x->k + c->p - 1;
+  sqlite3_free(k->e);
+  k->e = sqlite3_mprintf("%s%s%s%s%s", m, e ? " " : "", e ? e : "",
+   c->k ? ", compared in the cursor" : "",
+   d == 'G' ? ", grouped in the cursor" : d == 'D' ? ", distinct in the cursor" : "");
+}
+
+static int
+clpBst(
+  sqlite3_vtab *vt
+ ,sqlite3_index_info *ii
+){
+#define V ((struct clpVtb *)vt)
+  int i;
+  int j;
+  char o;
+
+  for (i = 0; i < ii->nConstraint; ++i) {
+    if ((ii->aConstraint + i)->usable
+     && ((ii->aConstraint + i)->iColumn < 0
+      || ((unsigned int)(ii->aConstraint + i)->iColumn < V->n
+       && !((V->s + (ii->aConstraint + i)->iColumn)->t & stMulti)))) {
+      switch ((ii->aConstraint + i)->op) {
+      case SQLITE_INDEX_CONSTRAINT_ISNULL:
+        o = 'n';
+        ii->estimatedCost /= 2;
+        break;
+      case SQLITE_INDEX_CONSTRAINT_ISNOTNULL:
+        o = 'N';
+        ii->estimatedCost /= 2;
+        break;
+      case SQLITE_INDEX_CONSTRAINT_IS:
+        o = 'i';
+        if ((ii->aConstraint + i)->iColumn < 0)
+          ii->estimatedCost /= 4;
+        else
+          ii->estimatedCost /= 5;
+        break;
+      case SQLITE_INDEX_CONSTRAINT_ISNOT:
+        o = 'I';
+        if ((ii->aConstraint + i)->iColumn < 0)
+          ii->estimatedCost /= 3;
+        else
+          ii->estimatedCost /= 4;
+        break;
+      case SQLITE_INDEX_CONSTRAINT_EQ:
+        o = 'e';
+        if ((ii->aConstraint + i)->iColumn < 0)
+          ii->estimatedCost /= 4;
+        else
+          ii->estimatedCost /= 5;
+        break;
+      case SQLITE_INDEX_CONSTRAINT_NE:
+        o = 'E';
+        if ((ii->aConstraint + i)->iColumn < 0)
+          ii->estimatedCost /= 3;
+        else
+          ii->estimatedCost /= 4;
+        break;
+      case SQLITE_INDEX_CONSTRAINT_LIKE:
+      case SQLITE_INDEX_CONSTRAINT_GLOB:
+      case SQLITE_INDEX_CONSTRAINT_REGEXP:
+        if ((ii->aConstraint + i)->iColumn < 0
+         || (V->s + (ii->aConstraint + i)->iColumn)->t & (stInteger | stFloat)
+         || (V->s + (ii->aConstraint + i)->iColumn)->d
+         || ((ii->aConstraint + i)->op == SQLITE_INDEX_CONSTRAINT_REGEXP && !V->x->f)) /* the application's regexp() */
+          continue;
+        if ((ii->aConstraint + i)->op == SQLITE_INDEX_CONSTRAINT_LIKE)
+          o = 'l';
+        else if ((ii->aConstraint + i)->op == SQLITE_INDEX_CONSTRAINT_GLOB)
+          o = 'g';
+        else
+          o = 'r';
+        ii->estimatedCost /= 2;
+        break;
+      default:
+        continue;
+      }
+      if (!(ii->idxStr = sqlite3_mprintf("%z%c%d", ii->idxStr, o, (ii->aConstraint + i)->iColumn)))
+        return (SQLITE_NOMEM);
+      ++ii->idxNum;
+      (ii->aConstraintUsage + i)->argvIndex = ii->idxNum;
+      /* the cursor matches LIKE without case, which PRAGMA case_sensitive_like=ON narrows,
+       * that PRAGMA is not visible here so SQLite checks LIKE again on the rows returned */
+      (ii->aConstraintUsage + i)->omit = o != 'l';
+      if ((ii->aConstraint + i)->iColumn == -1)
+        ii->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+    }
+  }
+  /* GROUP BY or DISTINCT, when SQLite checks no constraint again (it does LIKE), of a column of one CLIPS type,
+   * its values are interned so the cursor groups the facts by address in one hash pass */
+  for (j = 0; j < ii->nConstraint && (ii->aConstraintUsage + j)->omit; ++j);
+  if (ii->nOrderBy == 1
+   && ii->aOrderBy->iColumn >= 0
+   && (unsigned int)ii->aOrderBy->iColumn < V->n
+   && !((V->s + ii->aOrderBy->iColumn)->t & stMulti)
+   && clpCty((V->s + ii->aOrderBy->iColumn)->t) >= 0
+   && j == ii->nConstraint
+   && ((i = sqlite3_vtab_distinct(ii)) == 1 || i == 2)) {
+    if (!(ii->idxStr = sqlite3_mprintf("%z%c%d", ii->idxStr, i == 1 ? 'G' : 'D', ii->aOrderBy->iColumn)))
+      return (SQLITE_NOMEM);
+    ii->orderByConsumed = 1;
+  }
+  if (ii->idxStr)
+    ii->needToFreeIdxStr = 1;
+  if (!ii->idxNum) {
+    ii->estimatedRows = V->c;
+    if (!ii->colUsed && !ii->idxStr) /* e.g. COUNT(*), count the maintained count */
+      ii->idxStr = "#";
+  }
+  if (V->x->o)
+    return (clpPlb(V, ii));
+  return (SQLITE_OK);
+#undef V
+}
+
+static int
+clpFlt(
+  sqlite3_vtab_cursor *vc
+ ,int in
+ ,const char *is
+ ,int ac
+ ,sqlite3_value **av
+){
+#define V ((struct clpCsr *)vc)
+  const char *q;
+  CLIPSValue v;
+  sqlite3_int64 x;
+  unsigned long j;
+  unsigned long l;
+  int i;
+  int c;
+  int r;
+  int g;
+  int h;
+  char o;
+  char s;
+  char d;
+
+  clpRel(V);
+  if (V->t->x->o) {
+    if (!(V->p = clpPla(V->t, is, 0)))
+      return (SQLITE_NOMEM);
+    ++(V->t->x->k + V->p - 1)->f;
+  } else
+    V->p = 0;
+  if (V->e)
+    *V->e = '\0';
+  if (is && *is == '#') {
+    V->n = V->t->c;
+    V->q = 1;
+    clpPld(V, "maintained count", 0, '\0');
+    return (SQLITE_OK);
+  }
+  for (d = '\0', g = 0, q = is; q && *q; ++q)
+    if (*q == 'l' || *q == 'g' || *q == 'r')
+      --in;
+    else if (*q == 'G' || *q == 'D') { /* GROUP BY or DISTINCT column, after the constraints */
+      d = *q;
+      g = atoi(q + 1);
+    }
+  if (V->t->x->m) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    V->d = (sqlite3_int64)t.tv_sec * 1000000000 + t.tv_nsec + V->t->x->m * 1000000;
+  } else
+    V->d = 0;
+  V->i = 0;
+  /* columns or an array of every fact over BUDGET streams the facts, grouping needs the array */
+  s = !d && V->t->b && V->t->c * (sqlite3_int64)sizeof (*V->b) > V->t->b;
+  /* an indexed = constraint reads its facts from the index, comparing all in the cursor */
+  if ((h = V->t->z ? clpXpk(V->t, is, ac) : -1) >= 0)
+    s = 1;
+  if (!ac && !d && V->t->y
+   && (!V->t->b || V->t->c * (sqlite3_int64)(sizeof (*V->t->k->r) + V->t->n * (sizeof (double) + 1)) <= V->t->b)
+   && (V->h = clpCbl(V->t))) { /* read the columns, not the facts */
+    ++V->h->u;
+    V->n = V->h->n;
+    clpPld(V, "CACHE=COLUMNS arrays", 0, '\0');
+    return (SQLITE_OK);
+  }
+  if (s)
+    in = 0;
+  q = is;
+  l = 0;
+  r = 0;
+  if (in && clpEpf(V, &l, "(find-all-facts((?f %s))(and(sql-continue)"/*))*/, DeftemplateName(V->t->t)))
+    return (SQLITE_NOMEM);
+  for (i = 0; i < ac && (o = *is++); ++i) {
+    if (*is == '-') {
+      for (++is; *is >= '0' && *is <= '9'; ++is);
+      c = -1;
+    } else
+      for (c = 0; *is >= '0' && *is <= '9'; ++is)
+        c = c * 10 + (*is - '0');
+    if (s && o != 'l' && o != 'g' && o != 'r') { /* compared in the cursor */
+      if ((c = clpMeq(V, o == 'n' || o == 'i' || o == 'e' ? 'e' : 'E', c, o == 'n' || o == 'N' ? 0 : *(av + i))))
+        return (c);
+      continue;
+    }
+    switch (o) {
+    case 'n': /* SQLITE_INDEX_CONSTRAINT_ISNULL */
+      if (c < 0)
+        r = clpEpf(V, &l, "(eq ?f nil)");
+      else
+        r = clpEpf(V, &l, "(eq ?f:%s nil)", (V->t->s + c)->n);
+      break;
+    case 'N': /* SQLITE_INDEX_CONSTRAINT_ISNOTNULL */
+      if (c < 0)
+        r = clpEpf(V, &l, "(neq ?f nil)");
+      else
+        r = clpEpf(V, &l, "(neq ?f:%s nil)", (V->t->s + c)->n);
+      break;
+    case 'i': /* SQLITE_INDEX_CONSTRAINT_IS */
+    case 'e': /* SQLITE_INDEX_CONSTRAINT_EQ */
+      if (c < 0)
+        r = clpEpf(V, &l, "(eq(fact-index ?f)%s)", sqlite3_value_text(*(av + i)));
+      else if (sqlite3_value_type(*(av + i)) == SQLITE_NULL)
+        r = clpEpf(V, &l, "(eq ?f:%s nil)", (V->t->s + c)->n);
+      else if (sqlite3_value_type(*(av + i)) == SQLITE_TEXT)
+        r = clpEpf(V, &l, "(eq ?f:%s \"%s\")", (V->t->s + c)->n, sqlite3_value_text(*(av + i)));
+      else if ((V->t->s + c)->d && sqlite3_value_type(*(av + i)) == SQLITE_INTEGER
+       && clpSlx(V->t->x, sqlite3_value_int64(*(av + i))))
+        r = clpEpf(V, &l, "(eq ?f:%s %s)", (V->t->s + c)->n, clpSlx(V->t->x, sqlite3_value_int64(*(av + i)))->contents);
+      else
+        r = clpEpf(V, &l, "(eq ?f:%s %s)", (V->t->s + c)->n, sqlite3_value_text(*(av + i)));
+      break;
+    case 'I': /* SQLITE_INDEX_CONSTRAINT_ISNOT */
+    case 'E': /* SQLITE_INDEX_CONSTRAINT_NE */
+      if (c < 0)
+        r = clpEpf(V, &l, "(neq(fact-index ?f)%s)", sqlite3_value_text(*(av + i)));
+      else if (sqlite3_value_type(*(av + i)) == SQLITE_NULL)
+        r = clpEpf(V, &l, "(neq ?f:%s nil)", (V->t->s + c)->n);
+      else if (sqlite3_value_type(*(av + i)) == SQLITE_TEXT)
+        r = clpEpf(V, &l, "(neq ?f:%s \"%s\")", (V->t->s + c)->n, sqlite3_value_text(*(av + i)));
+      else if ((V->t->s + c)->d && sqlite3_value_type(*(av + i)) == SQLITE_INTEGER
+       && clpSlx(V->t->x, sqlite3_value_int64(*(av + i))))
+        r = clpEpf(V, &l, "(neq ?f:%s %s)", (V->t->s + c)->n, clpSlx(V->t->x, sqlite3_value_int64(*(av + i)))->contents);
+      else
+        r = clpEpf(V, &l, "(neq ?f:%s %s)", (V->t->s + c)->n, sqlite3_value_text(*(av + i)));
+      break;
+    case 'l': /* SQLITE_INDEX_CONSTRAINT_LIKE */
+    case 'g': /* SQLITE_INDEX_CONSTRAINT_GLOB */
+    case 'r': /* SQLITE_INDEX_CONSTRAINT_REGEXP */
+      if ((c = clpMad(V, o, c, (const char *)sqlite3_value_text(*(av + i)))))
+        return (c);
+      continue;
+    default:
+      return (SQLITE_ERROR);
+    }
+    if (r)
+      return (SQLITE_NOMEM);
+  }
+  if (!in && (d || h >= 0)) {
+    if ((r = clpAll(V, h)) || (d && (r = clpGrp(V, d, g))))
+      return (r);
+    clpCac(V, 0);
+    clpPld(V, h >= 0 ? "AUTOINDEX facts" : "all facts", 0, d);
+    return (SQLITE_OK);
+  }
+  if (!in) {
+    clpCac(V, 0);
+    clpPld(V, "facts in the cursor", 0, '\0');
+    return (clpNft(V));
+  }
+  if (clpEpf(V, &l, /*((*/"))"))
+    return (SQLITE_NOMEM);
+  if (V->t->r) { /* key on the expression and the patterns after it */
+    for (++l, i = 0; i < ac && (o = *q++); ++i) {
+      for (c = 0; *q == '-' || (*q >= '0' && *q <= '9'); ++q)
+        if (*q != '-')
+          c = c * 10 + (*q - '0');
+      if ((o == 'l' || o == 'g' || o == 'r')
+       && clpEpf(V, &l, "%c%d %s%c", o, c, sqlite3_value_text(*(av + i)) ? (const char *)sqlite3_value_text(*(av + i)) : "", 1))
+        return (SQLITE_NOMEM);
+    }
+    if ((i = clpRsl(V, l))) {
+      if (i < 0 || (d && clpGrp(V, d, g)))
+        return (SQLITE_NOMEM);
+      clpCac(V, 0);
+      clpPld(V, "RESULTS of", V->e, d);
+      return (SQLITE_OK);
+    }
+  }
+  { /* sql-continue checks this cursor every CLP_CHK facts */
+    struct clpEnv *n;
+    struct clpCsr *p;
+
+    n = GetEnvironmentData(V->t->e, CLP_ENV);
+    p = n->c;
+    n->c = V;
+    n->r = SQLITE_OK;
+    x = MemUsed(V->t->e);
+    i = Eval(V->t->e, V->e, &v);
+    x = MemUsed(V->t->e) - x;
+    n->c = p;
+    if (i)
+      return (n->r ? n->r : SQLITE_ERROR);
+  }
+  if (V->t->b && (sqlite3_int64)(v.multifieldValue->length * sizeof (*V->b)) > V->t->b) {
+    sqlite3_free(V->c.pVtab->zErrMsg);
+    V->c.pVtab->zErrMsg = sqlite3_mprintf("%lu facts over BUDGET %lld", (unsigned long)v.multifieldValue->length, V->t->b);
+    return (SQLITE_NOMEM);
+  }
+  if (v.multifieldValue->length > V->y) {
+    void *t;
+
+    if (!(t = sqlite3_realloc64(V->b, v.multifieldValue->length * sizeof (*V->b))))
+      return (SQLITE_NOMEM);
+    V->b = t;
+    V->y = v.multifieldValue->length;
+  }
+  V->a = V->b;
+  for (j = V->n = 0; j < v.multifieldValue->length; ++j) {
+    if (V->k && (i = clpMch(V, (v.multifieldValue->contents + j)->factValue)) < 1) {
+      if (i < 0)
+        return (SQLITE_NOMEM);
+      continue;
+    }
+    RetainFact((*(V->a + V->n++) = (v.multifieldValue->contents + j)->factValue));
+  }
+  if (V->t->r)
+    clpRss(V, l);
+  if (d && clpGrp(V, d, g))
+    return (SQLITE_NOMEM);
+  clpCac(V, x > 0 ? x : 0);
+  clpPld(V, "Eval", V->e, d);
+  return (SQLITE_OK);
+#undef V
+}
+
+static int
+clpNxt(
+  sqlite3_vtab_cursor *vc
+){
+#define V ((struct clpCsr *)vc)
+  if (!V->a && !V->q && !V->h)
+    return (clpNft(V));
+  ++V->o;
+  return (SQLITE_OK);
+#define V ((struct clpCsr *)vc)
+}
+
+static int
+clpEof(
+  sqlite3_vtab_cursor *vc
+){
+#define V ((struct clpCsr *)vc)
+  int r;
+
+  if (V->q || V->h)
+    r = V->o >= V->n;
+  else
+    r = !V->f && !(V->a && V->o < V->n);
+  if (!r && V->p && V->t->x->o) /* a row for clips_explain */
+    ++(V->t->x->k + V->p - 1)->a;
+  return (r);
+#define V ((struct clpCsr *)vc)
+}
+
+static int
+clpRid(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_int64 *id
+){
+#define V ((struct clpCsr *)vc)
+  if (V->q) { /* walk to the fact only when its ROWID is needed */
+    Fact *f;
+
+    for (; V->w <= V->o; ++V->w) {
+      if (!(f = GetNextFactInTemplate(V->t->t, V->f)))
+        return (SQLITE_ERROR);
+      RetainFact(f);
+      if (V->f)
+        ReleaseFact(V->f);
+      V->f = f;
+    }
+    *id = FactIndex(V->f);
+  } else if (V->h)
+    *id = FactIndex(*(V->h->r + V->o));
+  else if (!V->a)
+    *id = FactIndex(V->f);
+  else
+    *id = FactIndex(*(V->a + V->o));
+  return (SQLITE_OK);
+#undef V
+}
+
+/* release a CLP_FPT pointer */
+static void
+clpFrl(
+  void *f
+){
+  ReleaseFact(f);
+}
+
+/* result a CLIPS value, SYMBOL as BLOB, nil as NULL */
+static void
+clpVal(
+  sqlite3_context *sc
+ ,CLIPSValue *v
+){
+  switch (v->header->type) {
+  case SYMBOL_TYPE:
+    if (*(v->lexemeValue->contents + 0) != 'n'
+     || *(v->lexemeValue->contents + 1) != 'i'
+     || *(v->lexemeValue->contents + 2) != 'l'
+     || *(v->lexemeValue->contents + 3) != '\0')
+      sqlite3_result_blob(sc, v->lexemeValue->contents, strlen(v->lexemeValue->contents) + 1, SQLITE_TRANSIENT);
+    break;
+  case INTEGER_TYPE:
+    sqlite3_result_int64(sc, v->integerValue->contents);
+    break;
+  case FLOAT_TYPE:
+    sqlite3_result_double(sc, v->floatValue->contents);
+    break;
+  case STRING_TYPE:
+    sqlite3_result_text(sc, v->lexemeValue->contents, -1, SQLITE_TRANSIENT);
+    break;
+  default:
+    break;
+  }
+}
+
+static int
+clpClm(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_context *sc
+ ,int cn
+){
+#define V ((struct clpCsr *)vc)
+  CLIPSValue v;
+  sqlite3_int64 id;
+  Fact *f;
+  int i;
+
+  if (sqlite3_vtab_nochange(sc))
+    return (SQLITE_OK);
+  if ((unsigned int)cn == V->t->n) { /* fact, retained until SQLite frees the value */
+    if (V->h)
+      f = FactExistp(*(V->h->r + V->o)) ? *(V->h->r + V->o) : 0;
+    else
+      f = V->a ? *(V->a + V->o) : V->f;
+    if (f) {
+      RetainFact(f);
+      sqlite3_result_pointer(sc, f, CLP_FPT, clpFrl);
+    }
+    return (SQLITE_OK);
+  }
+  if (V->h) {
+    if (*((V->h->c + cn)->z + V->o / 8) & 1 << (V->o % 8))
+      return (SQLITE_OK);
+    switch ((V->h->c + cn)->t ? *((V->h->c + cn)->t + V->o) : clpCty((V->t->s + cn)->t)) {
+    case INTEGER_TYPE:
+      sqlite3_result_int64(sc, ((V->h->c + cn)->v + V->o)->i);
+      break;
+    case FLOAT_TYPE:
+      sqlite3_result_double(sc, ((V->h->c + cn)->v + V->o)->r);
+      break;
+    case SYMBOL_TYPE:
+      if ((V->t->s + cn)->d) {
+        if (!(id = clpSid(V->t->x, CreateSymbol(V->t->e, *(V->h->w + ((V->h->c + cn)->v + V->o)->d)))))
+          return (SQLITE_NOMEM);
+        sqlite3_result_int64(sc, id);
+      } else
+        sqlite3_result_blob(sc, *(V->h->w + ((V->h->c + cn)->v + V->o)->d), strlen(*(V->h->w + ((V->h->c + cn)->v + V->o)->d)) + 1, SQLITE_TRANSIENT);
+      break;
+    case STRING_TYPE:
+      sqlite3_result_text(sc, *(V->h->w + ((V->h->c + cn)->v + V->o)->d), -1, SQLITE_TRANSIENT);
+      break;
+    default:
+      break;
+    }
+    return (SQLITE_OK);
+  }
+  if (!V->a)
+    i = GetFactSlot(V->f, (V->t->s + cn)->n, &v);
+  else
+    i = GetFactSlot(*(V->a + V->o), (V->t->s + cn)->n, &v);
+  if (i)
+    return (SQLITE_OK);
+  if ((V->t->s + cn)->t & stMulti)
+    sqlite3_result_int64(sc, (sqlite3_int64)v.multifieldValue->length);
+  else if ((V->t->s + cn)->d && v.header->type == SYMBOL_TYPE && strcmp(v.lexemeValue->contents, "nil")) {
+    if (!(id = clpSid(V->t->x, v.lexemeValue)))
+      return (SQLITE_NOMEM);
+    sqlite3_result_int64(sc, id);
+  } else
+    clpVal(sc, &v);
+  return (SQLITE_OK);
+#undef V
+}
+
+/* UNIQUE constraint failed */
+static int
+clpUer(
+  struct clpVtb *v
+){
+  sqlite3_free(v->v.zErrMsg);
+  v->v.zErrMsg = sqlite3_mprintf("UNIQUE constraint failed: %s", v->m);
+  return (SQLITE_CONSTRAINT);
+}
+
+/* modify a fact with the columns of an INSERT or UPDATE */
+static int
+clpFmd(
+  struct clpVtb *v
+ ,Fact *f
+ ,int ac
+ ,sqlite3_value **av
+ ,sqlite3_int64 *id
+){
+  FactModifier *m;
+  CLIPSValue *p;
+  CLIPSValue c;
+  unsigned long y;
+  int i;
+  int j;
+  unsigned int k;
+  int n;
+
+  if (!(m = CreateFactModifier(v->e, f)))
+    return (SQLITE_NOMEM);
+  for (n = 0, j = 2, k = 0; j < ac && k < v->n; ++j, ++k) {
+    if (sqlite3_value_nochange(*(av + j)))
+      continue;
+    p = f->theProposition.contents + (v->s + k)->p;
+    if ((v->s + k)->t & stMulti) { /* NULL keeps the fields */
+      Multifield *u;
+
+      if (sqlite3_value_type(*(av + j)) == SQLITE_NULL)
+        continue;
+      if (!(u = StringToMultifield(v->e, (const char *)sqlite3_value_text(*(av + j)))))
+        i = 1;
+      else {
+        for (y = 0; y < u->length && y < p->multifieldValue->length
+         && (u->contents + y)->value == (p->multifieldValue->contents + y)->value; ++y);
+        if (y == u->length && y == p->multifieldValue->length) { /* the same fields */
+          ++v->a;
+          continue;
+        }
+        i = FMPutSlotMultifield(m, (v->s + k)->n, u);
+      }
+    } else if (!(c.value = clpSvl(v, k, *(av + j))))
+      i = 1;
+    else if (c.value == p->value) { /* interned, the same value */
+      ++v->a;
+      continue;
+    } else
+      i = FMPutSlot(m, (v->s + k)->n, &c);
+    if (i) {
+      FMDispose(m);
+      return (SQLITE_CONSTRAINT);
+    }
+    ++n;
+  }
+  if (!n) { /* no retract, assert nor pattern matching */
+    FMDispose(m);
+    ++v->q;
+    *id = FactIndex(f);
+    return (SQLITE_OK);
+  }
+  f = FMModify(m);
+  FMDispose(m);
+  if (!f)
+    return (SQLITE_CONSTRAINT);
+  ++v->i;
+  *id = FactIndex(f);
+  return (SQLITE_OK);
+}
+
+static int
+clpUpd(
+  sqlite3_vtab *vt
+ ,int ac
+ ,sqlite3_value **av
+ ,sqlite3_int64 *id
+){
+#define V ((struct clpVtb *)vt)
+  char *s;
+  Fact *f;
+  Fact *g;
+  CLIPSValue v;
+  int i;
+  int j;
+  unsigned int k;
+
+  if (ac == 1) { /* delete */
+    if (!(s = sqlite3_mprintf("(find-fact((?f %s))(eq(fact-index ?f)%lld))", DeftemplateName(V->t), sqlite3_value_int64(*(av + 0)))))
+      return (SQLITE_NOMEM);
+    i = Eval(V->e, s, &v);
+    sqlite3_free(s);
+    if (!i && v.multifieldValue->length)
+      Retract(v.multifieldValue->contents->factValue);
+  } else {
+    if (sqlite3_value_type(*(av + 0)) == SQLITE_NULL) { /* insert */
+      FactBuilder *b;
+
+      if (sqlite3_value_type(*(av + 1)) != SQLITE_NULL)
+        return (SQLITE_CONSTRAINT);
+      if (V->u && !clpUsk(V, av + 2, 0) && (g = *clpUfd(V, V->u->v)))
+        switch (sqlite3_vtab_on_conflict(V->d)) {
+        case SQLITE_IGNORE:
+          return (SQLITE_OK);
+        case SQLITE_REPLACE: /* modify, keeping the fact */
+          return (clpFmd(V, g, ac, av, id));
+        default:
+          return (clpUer(V));
+        }
+      if (!(b = CreateFactBuilder(V->e, DeftemplateName(V->t))))
+        return (SQLITE_NOMEM);
+      for (j = 2, k = 0; j < ac && k < V->n; ++j, ++k) {
+        if ((V->s + k)->t & stMulti) { /* NULL for the default else CLIPS text of the fields */
+          Multifield *u;
+
+          if (sqlite3_value_type(*(av + j)) == SQLITE_NULL)
+            continue;
+          if (!(u = StringToMultifield(V->e, (const char *)sqlite3_value_text(*(av + j)))))
+            i = 1;
+          else
+            i = FBPutSlotMultifield(b, (V->s + k)->n, u);
+        } else if (sqlite3_value_type(*(av + j)) == SQLITE_NULL && (V->s + k)->t & stSymbol)
+          i = FBPutSlotSymbol(b, (V->s + k)->n, "nil");
+        else if (sqlite3_value_type(*(av + j)) == SQLITE_BLOB && (V->s + k)->t & stSymbol)
+          i = FBPutSlotSymbol(b, (V->s + k)->n, sqlite3_value_blob(*(av + j)));
+        else if (sqlite3_value_type(*(av + j)) == SQLITE_INTEGER && (V->s + k)->d)
+          i = !clpSlx(V->x, sqlite3_value_int64(*(av + j)))
+           || FBPutSlotSymbol(b, (V->s + k)->n, clpSlx(V->x, sqlite3_value_int64(*(av + j)))->contents);
+        else if (sqlite3_value_type(*(av + j)) == SQLITE_INTEGER && (V->s + k)->t & stInteger)
+          i = FBPutSlotInteger(b, (V->s + k)->n, sqlite3_value_int64(*(av + j)));
+        else if (sqlite3_value_type(*(av + j)) == SQLITE_FLOAT && (V->s + k)->t & stFloat)
+          i = FBPutSlotFloat(b, (V->s + k)->n, sqlite3_value_double(*(av + j)));
+        else if (sqlite3_value_type(*(av + j)) == SQLITE_TEXT && (V->s + k)->t & stString)
+          i = FBPutSlotString(b, (V->s + k)->n, (const char *)sqlite3_value_text(*(av + j)));
+        else
+          i = 1;
+        if (i) {
+          FBDispose(b);
+          return (SQLITE_CONSTRAINT);
+        }
+      }
+      f = FBAssert(b);
+      FBDispose(b);
+      if (!f)
+        return (SQLITE_CONSTRAINT);
+      *id = FactIndex(f);
+    } else { /* update */
+      if (sqlite3_value_int64(*(av + 0)) != sqlite3_value_int64(*(av + 1)))
+        return (SQLITE_CONSTRAINT);
+      if (!(s = sqlite3_mprintf("(find-fact((?f %s))(eq(fact-index ?f)%lld))", DeftemplateName(V->t), sqlite3_value_int64(*(av + 0)))))
+        return (SQLITE_NOMEM);
+      i = Eval(V->e, s, &v);
+      sqlite3_free(s);
+      if (i || !v.multifieldValue->length)
+        return (SQLITE_NOTFOUND);
+      f = v.multifieldValue->contents->factValue;
+      if (V->u && !clpUsk(V, av + 2, f) && (g = *clpUfd(V, V->u->v)) && g != f)
+        switch (sqlite3_vtab_on_conflict(V->d)) {
+        case SQLITE_IGNORE:
+          return (SQLITE_OK);
+        case SQLITE_REPLACE:
+          Retract(g);
+          break;
+        default:
+          return (clpUer(V));
+        }
+      return (clpFmd(V, f, ac, av, id));
+    }
+  }
+  return (SQLITE_OK);
+#undef V
+}
+
+/* regexp() when the application has none, REGEXP of CLIPS columns is then evaluated in the cursor alike */
+static void
+clpRgx(
+  sqlite3_context *sc
+ ,int ac
+ ,sqlite3_value **av
+){
+  sqlite3re_compiled *r;
+  const unsigned char *s;
+  const char *e;
+  int a;
+
+  (void)ac;
+  a = 0;
+  if (!(r = sqlite3_get_auxdata(sc, 0))) {
+    if (!(s = sqlite3_value_text(*(av + 0))))
+      return;
+    if ((e = sqlite3re_compile(&r, (const char *)s, 0))) {
+      sqlite3re_free(r);
+      sqlite3_result_error(sc, e, -1);
+      return;
+    }
+    if (!r) {
+      sqlite3_result_error_nomem(sc);
+      return;
+    }
+    a = 1;
+  }
+  if ((s = sqlite3_value_text(*(av + 1))))
+    sqlite3_result_int(sc, sqlite3re_match(r, s, -1));
+  if (a)
+    sqlite3_set_auxdata(sc, 0, r, (void(*)(void*))sqlite3re_free);
+}
+
+/* regexp() is no longer clpRgx, REGEXP is left to SQLite */
+static void
+clpRgd(
+  void *cx
+){
+  ((struct clpCtx *)cx)->f = 0;
+}
+
+static sqlite3_module clpMod = {
+  1,      /* iVersion */
+  clpCrt, /* xCreate */
+  clpCon, /* xConnect */
+  clpBst, /* xBestIndex */
+  clpDis, /* xDisconnect */
+  clpDis, /* xDestroy */
+  clpOpn, /* xOpen */
+  clpCls, /* xClose */
+  clpFlt, /* xFilter */
+  clpNxt, /* xNext */
+  clpEof, /* xEof */
+  clpClm, /* xColumn */
+  clpRid, /* xRowid */
+  clpUpd, /* xUpdate */
+  0,      /* xBegin */
+  0,      /* xSync */
+  0,      /* xCommit */
+  0,      /* xRollback */
+  0,      /* xFindFunction */
+  0,      /* xRename */
+/*iVersion=2*/
+  0,      /* xSavepoint */
+  0,      /* xRelease */
+  0,      /* xRollbackTo */
+/*iVersion=3*/
+  0       /* xShadowName */
+};
+
+/* SELECT * FROM clips_aggregates; */
+
+struct aggVtb {
+  sqlite3_vtab v;
+  struct clpCtx *x;
+};
+
+static int
+aggCon(
+  sqlite3 *db
+ ,void *cx
+ ,int ac
+ ,const char *const *av
+ ,sqlite3_vtab **vt
+ ,char **er
+){
+  struct aggVtb *v;
+  int i;
+
+  if ((i = sqlite3_declare_vtab(db, "CREATE TABLE \"x\"(\"table\" TEXT,\"slot\" TEXT,\"count\" INTEGER,\"sum\",\"min\",\"max\")")))
+    return (i);
+  if (!(v = sqlite3_malloc(sizeof (*v))))
+    return (SQLITE_NOMEM);
+  memset(&v->v, 0, sizeof (v->v));
+  v->x = cx;
+  *vt = &v->v;
+  return (SQLITE_OK);
+  (void)ac;
+  (void)av;
+  (void)er;
+}
+
+static int
+aggDis(
+  sqlite3_vtab *vt
+){
+  sqlite3_free(vt);
+  return (SQLITE_OK);
+}
+
+struct aggCsr {
+  sqlite3_vtab_cursor c;
+  struct clpVtb *t;
+  sqlite3_int64 r;
+  int k;          /* slot or -1 for COUNT(*) */
+};
+
+static int
+aggOpn(
+  sqlite3_vtab *vt
+ ,sqlite3_vtab_cursor **vc
+){
+  struct aggCsr *c;
+
+  if (!(c = sqlite3_malloc(sizeof (*c))))
+    return (SQLITE_NOMEM);
+  c->t = 0;
+  c->r = 0;
+  c->k = -1;
+  *vc = &c->c;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+static int
+aggCls(
+  sqlite3_vtab_cursor *vc
+){
+  sqlite3_free(vc);
+  return (SQLITE_OK);
+}
+
+static int
+aggBst(
+  sqlite3_vtab *vt
+ ,sqlite3_index_info *ii
+){
+  ii->estimatedCost = 100.0;
+  ii->estimatedRows = 100;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+static int
+aggFlt(
+  sqlite3_vtab_cursor *vc
+ ,int in
+ ,const char *is
+ ,int ac
+ ,sqlite3_value **av
+){
+#define V ((struct aggCsr *)vc)
+  V->t = ((struct aggVtb *)V->c.pVtab)->x->v;
+  V->r = 0;
+  V->k = -1;
+  return (SQLITE_OK);
+  (void)in;
+  (void)is;
+  (void)ac;
+  (void)av;
+#undef V
+}
+
+static int
+aggNxt(
+  sqlite3_vtab_cursor *vc
+){
+#define V ((struct aggCsr *)vc)
+  ++V->r;
+  for (++V->k; (unsigned int)V->k < V->t->n && !(V->t->s + V->k)->a; ++V->k);
+  if ((unsigned int)V->k == V->t->n) {
+    V->t = V->t->l;
+    V->k = -1;
+  }
+  return (SQLITE_OK);
+#undef V
+}
+
+static int
+aggEof(
+  sqlite3_vtab_cursor *vc
+){
+  return (!((struct aggCsr *)vc)->t);
+}
+
+static int
+aggRid(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_int64 *id
+){
+  *id = ((struct aggCsr *)vc)->r;
+  return (SQLITE_OK);
+}
+
+static void
+aggNum(
+  sqlite3_context *sc
+ ,const struct clpNum *n
+){
+  if (n->t == INTEGER_TYPE)
+    sqlite3_result_int64(sc, n->i);
+  else
+    sqlite3_result_double(sc, n->r);
+}
+
+static int
+aggClm(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_context *sc
+ ,int cn
+){
+#define V ((struct aggCsr *)vc)
+  struct clpAgg *a;
+
+  if (V->k < 0) {
+    switch (cn) {
+    case 0: /* table */
+      sqlite3_result_text(sc, V->t->m, -1, SQLITE_STATIC);
+      break;
+    case 2: /* count */
+      sqlite3_result_int64(sc, V->t->c);
+      break;
+    default:
+      break;
+    }
+    return (SQLITE_OK);
+  }
+  a = (V->t->s + V->k)->a;
+  if (a->d && cn >= 4)
+    clpAgr(V->t, V->k);
+  switch (cn) {
+  case 0: /* table */
+    sqlite3_result_text(sc, V->t->m, -1, SQLITE_STATIC);
+    break;
+  case 1: /* slot */
+    sqlite3_result_text(sc, (V->t->s + V->k)->n, -1, SQLITE_STATIC);
+    break;
+  case 2: /* count */
+    sqlite3_result_int64(sc, a->n);
+    break;
+  case 3: /* sum */
+    if (!a->n)
+      break;
+    if (a->f || a->o)
+      sqlite3_result_double(sc, a->r);
+    else
+      sqlite3_result_int64(sc, a->i);
+    break;
+  case 4: /* min */
+    if (a->n)
+      aggNum(sc, &a->l);
+    break;
+  case 5: /* max */
+    if (a->n)
+      aggNum(sc, &a->h);
+    break;
+  default:
+    break;
+  }
+  return (SQLITE_OK);
+#undef V
+}
+
+static sqlite3_module aggMod = {
+  0,      /* iVersion */
+  0,      /* xCreate */
+  aggCon, /* xConnect */
+  aggBst, /* xBestIndex */
+  aggDis, /* xDisconnect */
+  0,      /* xDestroy */
+  aggOpn, /* xOpen */
+  aggCls, /* xClose */
+  aggFlt, /* xFilter */
+  aggNxt, /* xNext */
+  aggEof, /* xEof */
+  aggClm, /* xColumn */
+  aggRid, /* xRowid */
+  0,      /* xUpdate */
+  0,      /* xBegin */
+  0,      /* xSync */
+  0,      /* xCommit */
+  0,      /* xRollback */
+  0,      /* xFindFunction */
+  0,      /* xRename */
+  0,      /* xSavepoint */
+  0,      /* xRelease */
+  0,      /* xRollbackTo */
+  0       /* xShadowName */
+};
+
+/* SELECT * FROM clips_matches("ruleName"); */
+
+struct mchVtb {
+  sqlite3_vtab v;
+  struct clpCtx *x;
+};
+
+static int
+mchCon(
+  sqlite3 *db
+ ,void *cx
+ ,int ac
+ ,const char *const *av
+ ,sqlite3_vtab **vt
+ ,char **er
+){
+  struct mchVtb *v;
+  int i;
+
+  if ((i = sqlite3_declare_vtab(db, "CREATE TABLE \"x\"(\"activation\" INTEGER,\"ce\" INTEGER,\"fact\" INTEGER,\"salience\" INTEGER,\"rule\" TEXT HIDDEN)")))
+    return (i);
+  if (!(v = sqlite3_malloc(sizeof (*v))))
+    return (SQLITE_NOMEM);
+  memset(&v->v, 0, sizeof (v->v));
+  v->x = cx;
+  *vt = &v->v;
+  return (SQLITE_OK);
+  (void)ac;
+  (void)av;
+  (void)er;
+}
+
+static int
+mchDis(
+  sqlite3_vtab *vt
+){
+  sqlite3_free(vt);
+  return (SQLITE_OK);
+}
+
+struct mchCsr {
+  sqlite3_vtab_cursor c;
+  struct mchRow { /* a CE of an activation, read by the filter */
+    CLIPSLexeme *n; /* rule name, retained */
+    Fact *f;      /* retained, 0 for not and exists CEs and objects */
+    sqlite3_int64 a; /* activation */
+    int s;        /* salience */
+    unsigned int i; /* CE */
+  } *w;
+  unsigned long n; /* rows in w */
+  unsigned long o; /* row */
+  unsigned long y; /* allocated w */
+};
+
+static int
+mchOpn(
+  sqlite3_vtab *vt
+ ,sqlite3_vtab_cursor **vc
+){
+  struct mchCsr *c;
+
+  if (!(c = sqlite3_malloc(sizeof (*c))))
+    return (SQLITE_NOMEM);
+  c->w = 0;
+  c->n = c->o = c->y = 0;
+  *vc = &c->c;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+/* release the rows */
+static void
+mchRel(
+  struct mchCsr *c
+){
+  Environment *e;
+
+  e = ((struct mchVtb *)c->c.pVtab)->x->e;
+  while (c->n) {
+    --c->n;
+    Release(e, &(c->w + c->n)->n->header);
+    if ((c->w + c->n)->f)
+      ReleaseFact((c->w + c->n)->f);
+  }
+  c->o = 0;
+}
+
+static int
+mchCls(
+  sqlite3_vtab_cursor *vc
+){
+  mchRel((struct mchCsr *)vc);
+  sqlite3_free(((struct mchCsr *)vc)->w);
+  sqlite3_free(vc);
+  return (SQLITE_OK);
+}
+
+static int
+mchBst(
+  sqlite3_vtab *vt
+ ,sqlite3_index_info *ii
+){
+  int i;
+
+  ii->estimatedCost = 100000.0;
+  for (i = 0; i < ii->nConstraint; ++i)
+    if ((ii->aConstraint + i)->usable
+     && (ii->aConstraint + i)->iColumn == 4
+     && (ii->aConstraint + i)->op == SQLITE_INDEX_CONSTRAINT_EQ) {
+      (ii->aConstraintUsage + i)->argvIndex = 1;
+      (ii->aConstraintUsage + i)->omit = 1;
+      ii->idxNum = 1;
+      ii->estimatedCost = 1000.0;
+      break;
+    }
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+/* the CEs of the activations, of the rule if named, with a partial match, in the agenda of module m then the next
+ * modules, retaining their facts so firing or retracting while stepping leaves the rows alone */
+static int
+mchAct(
+  struct mchCsr *c
+ ,Defmodule *m
+ ,const char *n
+){
+  Environment *e;
+  Activation *a;
+  Defmodule *o;
+  sqlite3_int64 k;
+  unsigned int i;
+  struct alphaMatch *h;
+  void *t;
+
+  e = ((struct mchVtb *)c->c.pVtab)->x->e;
+  for (k = 0; m; m = n ? 0 : GetNextDefmodule(e, m)) {
+    o = SetCurrentModule(e, m); /* GetNextActivation reads the current module's agenda */
+    for (a = 0; (a = GetNextActivation(e, a));) {
+      if (!a->basis || !a->basis->bcount
+       || (n ? strcmp(ActivationRuleName(a), n) : !strncmp(ActivationRuleName(a), CLP_QRY, sizeof (CLP_QRY) - 1)))
+        continue;
+      ++k;
+      for (i = 0; i < a->basis->bcount; ++i) {
+        if (c->n == c->y) {
+          if (!(t = sqlite3_realloc64(c->w, (c->y ? 2 * c->y : 64) * sizeof (*c->w)))) {
+            SetCurrentModule(e, o);
+            return (SQLITE_NOMEM);
+          }
+          c->w = t;
+          c->y = c->y ? 2 * c->y : 64;
+        }
+        Retain(e, &((c->w + c->n)->n = a->theRule->header.name)->header);
+        if ((h = (a->basis->binds + i)->gm.theMatch)
+         && h->matchingItem
+         && h->matchingItem->header.type == FACT_ADDRESS_TYPE)
+          RetainFact(((c->w + c->n)->f = (Fact *)h->matchingItem));
+        else
+          (c->w + c->n)->f = 0;
+        (c->w + c->n)->a = k;
+        (c->w + c->n)->s = ActivationGetSalience(a);
+        (c->w + c->n)->i = i + 1;
+        ++c->n;
+      }
+    }
+    SetCurrentModule(e, o);
+  }
+  return (SQLITE_OK);
+}
+
+static int
+mchFlt(
+  sqlite3_vtab_cursor *vc
+ ,int in
+ ,const char *is
+ ,int ac
+ ,sqlite3_value **av
+){
+#define V ((struct mchCsr *)vc)
+  Defrule *d;
+  const char *n;
+
+  mchRel(V);
+  if (in) {
+    if (!(n = (const char *)sqlite3_value_text(*(av + 0)))
+     || !(d = FindDefrule(((struct mchVtb *)V->c.pVtab)->x->e, n)))
+      return (SQLITE_OK);
+    return (mchAct(V, FindDefmodule(((struct mchVtb *)V->c.pVtab)->x->e, DefruleModule(d)), DefruleName(d)));
+  }
+  return (mchAct(V, GetNextDefmodule(((struct mchVtb *)V->c.pVtab)->x->e, 0), 0));
+  (void)is;
+  (void)ac;
+#undef V
+}
+
+static int
+mchNxt(
+  sqlite3_vtab_cursor *vc
+){
+  ++((struct mchCsr *)vc)->o;
+  return (SQLITE_OK);
+}
+
+static int
+mchEof(
+  sqlite3_vtab_cursor *vc
+){
+  return (((struct mchCsr *)vc)->o >= ((struct mchCsr *)vc)->n);
+}
+
+static int
+mchRid(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_int64 *id
+){
+  *id = ((struct mchCsr *)vc)->o;
+  return (SQLITE_OK);
+}
+
+static int
+mchClm(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_context *sc
+ ,int cn
+){
+#define V ((struct mchCsr *)vc)
+  switch (cn) {
+  case 0: /* activation */
+    sqlite3_result_int64(sc, (V->w + V->o)->a);
+    break;
+  case 1: /* ce */
+    sqlite3_result_int(sc, (V->w + V->o)->i);
+    break;
+  case 2: /* fact, NULL for not and exists CEs and objects */
+    if ((V->w + V->o)->f)
+      sqlite3_result_int64(sc, FactIndex((V->w + V->o)->f));
+    break;
+  case 3: /* salience */
+    sqlite3_result_int(sc, (V->w + V->o)->s);
+    break;
+  case 4: /* rule */
+    sqlite3_result_text(sc, (V->w + V->o)->n->contents, -1, SQLITE_TRANSIENT);
+    break;
+  default:
+    break;
+  }
+  return (SQLITE_OK);
+#undef V
+}
+
+static sqlite3_module mchMod = {
+  0,      /* iVersion */
+  0,      /* xCreate */
+  mchCon, /* xConnect */
+  mchBst, /* xBestIndex */
+  mchDis, /* xDisconnect */
+  0,      /* xDestroy */
+  mchOpn, /* xOpen */
+  mchCls, /* xClose */
+  mchFlt, /* xFilter */
+  mchNxt, /* xNext */
+  mchEof, /* xEof */
+  mchClm, /* xColumn */
+  mchRid, /* xRowid */
+  0,      /* xUpdate */
+  0,      /* xBegin */
+  0,      /* xSync */
+  0,      /* xCommit */
+  0,      /* xRollback */
+  0,      /* xFindFunction */
+  0,      /* xRename */
+  0,      /* xSavepoint */
+  0,      /* xRelease */
+  0,      /* xRollbackTo */
+  0       /* xShadowName */
+};
+
+/* SELECT * FROM clips_rules; */
+
+struct rulVtb {
+  sqlite3_vtab v;
+  struct clpCtx *x;
+};
+
+static int
+rulCon(
+  sqlite3 *db
+ ,void *cx
+ ,int ac
+ ,const char *const *av
+ ,sqlite3_vtab **vt
+ ,char **er
+){
+  struct rulVtb *v;
+  int i;
+
+  if ((i = sqlite3_declare_vtab(db, "CREATE TABLE \"x\"(\"rule\" TEXT,\"module\" TEXT,\"fires\" INTEGER,\"seconds\" REAL"
+   ",\"alpha\" INTEGER,\"partial\" INTEGER,\"activations\" INTEGER,\"compares\" INTEGER,\"adds\" INTEGER,\"deletes\" INTEGER)")))
+    return (i);
+  if (!(v = sqlite3_malloc(sizeof (*v))))
+    return (SQLITE_NOMEM);
+  memset(&v->v, 0, sizeof (v->v));
+  v->x = cx;
+  *vt = &v->v;
+  return (SQLITE_OK);
+  (void)ac;
+  (void)av;
+  (void)er;
+}
+
+static int
+rulDis(
+  sqlite3_vtab *vt
+){
+  sqlite3_free(vt);
+  return (SQLITE_OK);
+}
+
+struct rulCsr {
+  sqlite3_vtab_cursor c;
+  Defrule *r;
+  sqlite3_int64 i;
+  sqlite3_int64 m[6]; /* matches and join-activity */
+  char k[6];      /* m valid */
+  char v;         /* m read */
+};
+
+static int
+rulOpn(
+  sqlite3_vtab *vt
+ ,sqlite3_vtab_cursor **vc
+){
+  struct rulCsr *c;
+
+  if (!(c = sqlite3_malloc(sizeof (*c))))
+    return (SQLITE_NOMEM);
+  c->r = 0;
+  c->i = 0;
+  c->v = 0;
+  *vc = &c->c;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+static int
+rulCls(
+  sqlite3_vtab_cursor *vc
+){
+  sqlite3_free(vc);
+  return (SQLITE_OK);
+}
+
+static int
+rulBst(
+  sqlite3_vtab *vt
+ ,sqlite3_index_info *ii
+){
+  ii->estimatedCost = 10000.0;
+  ii->estimatedRows = 100;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+static int
+rulFlt(
+  sqlite3_vtab_cursor *vc
+ ,int in
+ ,const char *is
+ ,int ac
+ ,sqlite3_value **av
+){
+#define V ((struct rulCsr *)vc)
+  V->r = GetNextDefrule(((struct rulVtb *)V->c.pVtab)->x->e, 0);
+  while (V->r && !strncmp(DefruleName(V->r), CLP_QRY, sizeof (CLP_QRY) - 1)) /* standing queries are hidden */
+    V->r = GetNextDefrule(((struct rulVtb *)V->c.pVtab)->x->e, V->r);
+  V->i = 1;
+  V->v = 0;
+  return (SQLITE_OK);
+  (void)in;
+  (void)is;
+  (void)ac;
+  (void)av;
+#undef V
+}
+
+static int
+rulNxt(
+  sqlite3_vtab_cursor *vc
+){
+#define V ((struct rulCsr *)vc)
+  while ((V->r = GetNextDefrule(((struct rulVtb *)V->c.pVtab)->x->e, V->r))
+   && !strncmp(DefruleName(V->r), CLP_QRY, sizeof (CLP_QRY) - 1));
+  ++V->i;
+  V->v = 0;
+  return (SQLITE_OK);
+#undef V
+}
+
+static int
+rulEof(
+  sqlite3_vtab_cursor *vc
+){
+  return (!((struct rulCsr *)vc)->r);
+}
+
+static int
+rulRid(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_int64 *id
+){
+  *id = ((struct rulCsr *)vc)->i;
+  return (SQLITE_OK);
+}
+
+static int
+rulClm(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_context *sc
+ ,int cn
+){
+#define V ((struct rulCsr *)vc)
+  struct clpCtx *x;
+  struct clpRul *t;
+  CLIPSValue v;
+  Defrule *d;
+  sqlite3_int64 f;
+  sqlite3_int64 n;
+  unsigned int i;
+  unsigned int j;
+  char *s;
+
+  x = ((struct rulVtb *)V->c.pVtab)->x;
+  switch (cn) {
+  case 0: /* rule */
+    sqlite3_result_text(sc, DefruleName(V->r), -1, SQLITE_TRANSIENT);
+    return (SQLITE_OK);
+  case 1: /* module */
+    sqlite3_result_text(sc, DefruleModule(V->r), -1, SQLITE_TRANSIENT);
+    return (SQLITE_OK);
+  case 2: /* fires */
+  case 3: /* seconds */
+    for (f = n = 0, d = V->r; d; d = d->disjunct)
+      if ((t = clpRlu(x, d, 0))) {
+        f += t->f;
+        n += t->t;
+      }
+    if (cn == 2)
+      sqlite3_result_int64(sc, f);
+    else
+      sqlite3_result_double(sc, n / 1e9);
+    return (SQLITE_OK);
+  default:
+    break;
+  }
+  if (!V->v) { /* both return 3 integers, terse prints nothing */
+    for (i = 0; i < 6; i += 3) {
+      if (!(s = sqlite3_mprintf(i ? "(join-activity %s::%s terse)" : "(matches %s::%s terse)", DefruleModule(V->r), DefruleName(V->r))))
+        return (SQLITE_NOMEM);
+      j = !Eval(x->e, s, &v) && v.header->type == MULTIFIELD_TYPE && v.multifieldValue->length >= 3;
+      sqlite3_free(s);
+      for (n = 0; n < 3; ++n)
+        if ((V->k[i + n] = j && (v.multifieldValue->contents + n)->header->type == INTEGER_TYPE))
+          V->m[i + n] = (v.multifieldValue->contents + n)->integerValue->contents;
+    }
+    V->v = 1;
+  }
+  if (V->k[cn - 4])
+    sqlite3_result_int64(sc, V->m[cn - 4]);
+  return (SQLITE_OK);
+#undef V
+}
+
+static sqlite3_module rulMod = {
+  0,      /* iVersion */
+  0,      /* xCreate */
+  rulCon, /* xConnect */
+  rulBst, /* xBestIndex */
+  rulDis, /* xDisconnect */
+  0,      /* xDestroy */
+  rulOpn, /* xOpen */
+  rulCls, /* xClose */
+  rulFlt, /* xFilter */
+  rulNxt, /* xNext */
+  rulEof, /* xEof */
+  rulClm, /* xColumn */
+  rulRid, /* xRowid */
+  0,      /* xUpdate */
+  0,      /* xBegin */
+  0,      /* xSync */
+  0,      /* xCommit */
+  0,      /* xRollback */
+  0,      /* xFindFunction */
+  0,      /* xRename */
+  0,      /* xSavepoint */
+  0,      /* xRelease */
+  0,      /* xRollbackTo */
+  0       /* xShadowName */
+};
+
+/* SELECT * FROM clips_agenda; */
+
+struct agnVtb {
+  sqlite3_vtab v;
+  struct clpCtx *x;
+};
+
+static int
+agnCon(
+  sqlite3 *db
+ ,void *cx
+ ,int ac
+ ,const char *const *av
+ ,sqlite3_vtab **vt
+ ,char **er
+){
+  struct agnVtb *v;
+  int i;
+
+  if ((i = sqlite3_declare_vtab(db, "CREATE TABLE \"x\"(\"rule\" TEXT,\"salience\" INTEGER,\"facts\" TEXT,\"module\" TEXT)")))
+    return (i);
+  if (!(v = sqlite3_malloc(sizeof (*v))))
+    return (SQLITE_NOMEM);
+  memset(&v->v, 0, sizeof (v->v));
+  v->x = cx;
+  *vt = &v->v;
+  return (SQLITE_OK);
+  (void)ac;
+  (void)av;
+  (void)er;
+}
+
+static int
+agnDis(
+  sqlite3_vtab *vt
+){
+  sqlite3_free(vt);
+  return (SQLITE_OK);
+}
+
+struct agnCsr {
+  sqlite3_vtab_cursor c;
+  struct agnRow { /* an activation, read by the filter */
+    CLIPSLexeme *n; /* rule name, retained */
+    CLIPSLexeme *m; /* module name, retained */
+    char *f;      /* facts, 0 without a partial match */
+    int s;        /* salience */
+  } *w;
+  unsigned long n; /* rows in w */
+  unsigned long o; /* row */
+  unsigned long y; /* allocated w */
+};
+
+static int
+agnOpn(
+  sqlite3_vtab *vt
+ ,sqlite3_vtab_cursor **vc
+){
+  struct agnCsr *c;
+
+  if (!(c = sqlite3_malloc(sizeof (*c))))
+    return (SQLITE_NOMEM);
+  c->w = 0;
+  c->n = c->o = c->y = 0;
+  *vc = &c->c;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+/* release the rows */
+static void
+agnRel(
+  struct agnCsr *c
+){
+  while (c->n) {
+    --c->n;
+    Release(((struct agnVtb *)c->c.pVtab)->x->e, &(c->w + c->n)->n->header);
+    Release(((struct agnVtb *)c->c.pVtab)->x->e, &(c->w + c->n)->m->header);
+    sqlite3_free((c->w + c->n)->f);
+  }
+  c->o = 0;
+}
+
+static int
+agnCls(
+  sqlite3_vtab_cursor *vc
+){
+  agnRel((struct agnCsr *)vc);
+  sqlite3_free(((struct agnCsr *)vc)->w);
+  sqlite3_free(vc);
+  return (SQLITE_OK);
+}
+
+static int
+agnBst(
+  sqlite3_vtab *vt
+ ,sqlite3_index_info *ii
+){
+  ii->estimatedCost = 1000.0;
+  ii->estimatedRows = 100;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+/* the facts of an activation with a partial match as in (agenda), 0 when out of memory */
+static char *
+agnFct(
+  Activation *a
+){
+  struct alphaMatch *m;
+  sqlite3_str *s;
+  unsigned int i;
+
+  if (!(s = sqlite3_str_new(0)))
+    return (0);
+  for (i = 0; i < a->basis->bcount; ++i) {
+    if (i)
+      sqlite3_str_appendchar(s, 1, ',');
+    if ((m = (a->basis->binds + i)->gm.theMatch)
+     && m->matchingItem
+     && m->matchingItem->header.type == FACT_ADDRESS_TYPE)
+      sqlite3_str_appendf(s, "f-%lld", FactIndex((Fact *)m->matchingItem));
+    else
+      sqlite3_str_appendchar(s, 1, '*');
+  }
+  if (sqlite3_str_errcode(s)) {
+    sqlite3_free(sqlite3_str_finish(s));
+    return (0);
+  }
+  if (!sqlite3_str_length(s)) {
+    sqlite3_free(sqlite3_str_finish(s));
+    return (sqlite3_mprintf("%s", ""));
+  }
+  return (sqlite3_str_finish(s));
+}
+
+static int
+agnFlt(
+  sqlite3_vtab_cursor *vc
+ ,int in
+ ,const char *is
+ ,int ac
+ ,sqlite3_value **av
+){
+#define V ((struct agnCsr *)vc)
+  Environment *e;
+  Activation *a;
+  Defmodule *m;
+  Defmodule *o;
+  void *t;
+
+  agnRel(V);
+  e = ((struct agnVtb *)V->c.pVtab)->x->e;
+  for (m = GetNextDefmodule(e, 0); m; m = GetNextDefmodule(e, m)) {
+    o = SetCurrentModule(e, m); /* GetNextActivation reads the current module's agenda */
+    for (a = 0; (a = GetNextActivation(e, a));) {
+      if (!strncmp(ActivationRuleName(a), CLP_QRY, sizeof (CLP_QRY) - 1)) /* standing queries are hidden */
+        continue;
+      if (V->n == V->y) {
+        if (!(t = sqlite3_realloc64(V->w, (V->y ? 2 * V->y : 64) * sizeof (*V->w)))) {
+          SetCurrentModule(e, o);
+          return (SQLITE_NOMEM);
+        }
+        V->w = t;
+        V->y = V->y ? 2 * V->y : 64;
+      }
+      (V->w + V->n)->f = 0;
+      if (a->basis && !((V->w + V->n)->f = agnFct(a))) {
+        SetCurrentModule(e, o);
+        return (SQLITE_NOMEM);
+      }
+      Retain(e, &((V->w + V->n)->n = a->theRule->header.name)->header);
+      Retain(e, &((V->w + V->n)->m = m->header.name)->header);
+      (V->w + V->n)->s = ActivationGetSalience(a);
+      ++V->n;
+    }
+    SetCurrentModule(e, o);
+  }
+  return (SQLITE_OK);
+  (void)in;
+  (void)is;
+  (void)ac;
+  (void)av;
+#undef V
+}
+
+static int
+agnNxt(
+  sqlite3_vtab_cursor *vc
+){
+  ++((struct agnCsr *)vc)->o;
+  return (SQLITE_OK);
+}
+
+static int
+agnEof(
+  sqlite3_vtab_cursor *vc
+){
+  return (((struct agnCsr *)vc)->o >= ((struct agnCsr *)vc)->n);
+}
+
+static int
+agnRid(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_int64 *id
+){
+  *id = ((struct agnCsr *)vc)->o + 1;
+  return (SQLITE_OK);
+}
+
+static int
+agnClm(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_context *sc
+ ,int cn
+){
+#define V ((struct agnCsr *)vc)
+  switch (cn) {
+  case 0: /* rule */
+    sqlite3_result_text(sc, (V->w + V->o)->n->contents, -1, SQLITE_TRANSIENT);
+    break;
+  case 1: /* salience */
+    sqlite3_result_int(sc, (V->w + V->o)->s);
+    break;
+  case 2: /* facts, as in (agenda) */
+    if ((V->w + V->o)->f)
+      sqlite3_result_text(sc, (V->w + V->o)->f, -1, SQLITE_TRANSIENT);
+    break;
+  case 3: /* module */
+    sqlite3_result_text(sc, (V->w + V->o)->m->contents, -1, SQLITE_TRANSIENT);
+    break;
+  default:
+    break;
+  }
+  return (SQLITE_OK);
+#undef V
+}
+
+static sqlite3_module agnMod = {
+  0,      /* iVersion */
+  0,      /* xCreate */
+  agnCon, /* xConnect */
+  agnBst, /* xBestIndex */
+  agnDis, /* xDisconnect */
+  0,      /* xDestroy */
+  agnOpn, /* xOpen */
+  agnCls, /* xClose */
+  agnFlt, /* xFilter */
+  agnNxt, /* xNext */
+  agnEof, /* xEof */
+  agnClm, /* xColumn */
+  agnRid, /* xRowid */
+  0,      /* xUpdate */
+  0,      /* xBegin */
+  0,      /* xSync */
+  0,      /* xCommit */
+  0,      /* xRollback */
+  0,      /* xFindFunction */
+  0,      /* xRename */
+  0,      /* xSavepoint */
+  0,      /* xRelease */
+  0,      /* xRollbackTo */
+  0       /* xShadowName */
+};
+
+/* log a change of a standing query's template with its values, dropping the older half when the log outgrows the facts */
+static void
+clpQlg(
+  struct clpQry *q
+ ,Fact *f
+ ,char o
+){
+  unsigned int j;
+
+  if (q->n == q->a) {
+    void *t;
+
+    if (q->n > 1024 && q->n > 2 * (unsigned long)q->c) {
+      clpQrl(q, q->n / 2);
+      memmove(q->g, q->g + q->n / 2, (q->n - q->n / 2) * sizeof (*q->g));
+      memmove(q->v, q->v + q->n / 2 * q->k, (q->n - q->n / 2) * q->k * sizeof (*q->v));
+      q->n -= q->n / 2;
+    } else {
+      if ((t = sqlite3_realloc64(q->g, (q->a ? q->a * 2 : 64) * sizeof (*q->g))))
+        q->g = t;
+      if (t && q->k && (t = sqlite3_realloc64(q->v, (q->a ? q->a * 2 : 64) * q->k * sizeof (*q->v))))
+        q->v = t;
+      if (t)
+        q->a = q->a ? q->a * 2 : 64;
+      else { /* forget all, clips_query will report since as expired */
+        clpQrl(q, q->n);
+        q->n = 0;
+      }
+    }
+  }
+  ++q->s;
+  if (q->n < q->a) {
+    (q->g + q->n)->f = FactIndex(f);
+    (q->g + q->n)->o = o;
+    for (j = 0; j < q->k; ++j)
+      Retain(q->e, (*(q->v + q->n * q->k + j) = (f->theProposition.contents + j)->header));
+    ++q->n;
+  }
+}
+
+static void
+clpQas(
+  Environment *e
+ ,void *f
+ ,void *cq
+){
+  if (FactDeftemplate(f) != ((struct clpQry *)cq)->t)
+    return;
+  ++((struct clpQry *)cq)->c;
+  clpQlg(cq, f, '+');
+  (void)e;
+}
+
+static void
+clpQrt(
+  Environment *e
+ ,void *f
+ ,void *cq
+){
+  if (FactDeftemplate(f) != ((struct clpQry *)cq)->t)
+    return;
+  --((struct clpQry *)cq)->c;
+  clpQlg(cq, f, '-');
+  (void)e;
+}
+
+static struct clpQry *
+clpQfn(
+  struct clpCtx *x
+ ,const char *n
+){
+  struct clpQry *q;
+
+  for (q = x->q; q && strcmp(q->m, n); q = q->l);
+  return (q);
+}
+
+/* length of the CLIPS symbol of letters, digits, '-' and '_' starting with a letter at p */
+static int
+clpQsy(
+  const char *p
+){
+  int i;
+
+  if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z')))
+    return (0);
+  for (i = 1; (*(p + i) >= 'a' && *(p + i) <= 'z') || (*(p + i) >= 'A' && *(p + i) <= 'Z')
+   || (*(p + i) >= '0' && *(p + i) <= '9') || *(p + i) == '-' || *(p + i) == '_'; ++i);
+  return (i);
+}
+
+/* 1 when the LHS is balanced CEs, so it can't close the rule and build other constructs */
+static int
+clpQlh(
+  const char *p
+){
+  int d;
+
+  for (d = 0; *p; ++p)
+    switch (*p) {
+    case '(':
+      ++d;
+      break;
+    case ')':
+      if (--d < 0)
+        return (0);
+      break;
+    case '"':
+      for (++p; *p && *p != '"'; ++p)
+        if (*p == '\\' && !*++p)
+          return (0);
+      if (!*p)
+        return (0);
+      break;
+    case ';': /* a comment would hide the rest of the rule */
+      return (0);
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\r':
+      break;
+    default: /* only CEs, ?f <- (pattern) binding their facts */
+      if (!d && *p != '?' && *p != '<' && *p != '-' && !clpQsy(p) && !(*p >= '0' && *p <= '9') && *p != '_')
+        return (0);
+      break;
+    }
+  return (!d);
+}
+
+/* clips_query_register(name, LHS, variables) */
+static void
+clpQrg(
+  sqlite3_context *sc
+ ,int ac
+ ,sqlite3_value **av
+){
+  struct clpCtx *x;
+  struct clpQry *q;
+  const char *n;
+  const char *l;
+  const char *v;
+  const char *p;
+  sqlite3_str *t;
+  sqlite3_str *r;
+  char *s;
+  unsigned int k;
+  int i;
+
+  (void)ac;
+  x = sqlite3_user_data(sc);
+  if (!(n = (const char *)sqlite3_value_text(*(av + 0)))
+   || !(l = (const char *)sqlite3_value_text(*(av + 1)))
+   || !(v = (const char *)sqlite3_value_text(*(av + 2)))) {
+    sqlite3_result_error(sc, "clips_query_register: NULL argument", -1);
+    return;
+  }
+  if (!(i = clpQsy(n)) || *(n + i)) {
+    sqlite3_result_error(sc, "clips_query_register: name is not a symbol", -1);
+    return;
+  }
+  if (!clpQlh(l)) {
+    sqlite3_result_error(sc, "clips_query_register: LHS is not balanced CEs", -1);
+    return;
+  }
+  if (clpQfn(x, n)) {
+    sqlite3_result_error(sc, "clips_query_register: name exists", -1);
+    return;
+  }
+  if (!(t = sqlite3_str_new(0))
+   || !(r = sqlite3_str_new(0))) {
+    sqlite3_free(sqlite3_str_finish(t));
+    sqlite3_result_error_nomem(sc);
+    return;
+  }
+  sqlite3_str_appendf(t, "(deftemplate " CLP_QRY "%s"/*)*/, n);
+  sqlite3_str_appendf(r, "(defrule " CLP_QRY "%s(declare(salience 10000))(logical %s)=>(assert(" CLP_QRY "%s"/*)))*/, n, l, n);
+  for (k = 0, p = v; *p; ++k) {
+    for (; *p == ' ' || *p == '\t' || *p == '\n'; ++p);
+    if (!*p)
+      break;
+    if (*p != '?' || !(i = clpQsy(p + 1))
+     || (*(p + 1 + i) && *(p + 1 + i) != ' ' && *(p + 1 + i) != '\t' && *(p + 1 + i) != '\n')) {
+      sqlite3_free(sqlite3_str_finish(t));
+      sqlite3_free(sqlite3_str_finish(r));
+      sqlite3_result_error(sc, "clips_query_register: variables are ?name", -1);
+      return;
+    }
+    l = ++p;
+    p += i;
+    sqlite3_str_appendf(t, "(slot %.*s)", i, l);
+    sqlite3_str_appendf(r, "(%.*s(if(fact-addressp ?%.*s)then(fact-index ?%.*s)else ?%.*s))", i, l, i, l, i, l, i, l);
+  }
+  sqlite3_str_appendchar(t, 1, /*(*/')');
+  sqlite3_str_appendall(r, /*(((*/")))");
+  if (!(s = sqlite3_str_finish(t))) {
+    sqlite3_free(sqlite3_str_finish(r));
+    sqlite3_result_error_nomem(sc);
+    return;
+  }
+  i = Build(x->e, s);
+  sqlite3_free(s);
+  if (i) {
+    sqlite3_free(sqlite3_str_finish(r));
+    sqlite3_result_error(sc, "clips_query_register: deftemplate", -1);
+    return;
+  }
+  if (!(q = sqlite3_malloc(sizeof (*q)))) {
+    sqlite3_free(sqlite3_str_finish(r));
+    sqlite3_result_error_nomem(sc);
+    return;
+  }
+  q->e = x->e;
+  q->m = sqlite3_mprintf("%s", n);
+  q->t = (s = sqlite3_mprintf(CLP_QRY "%s", n)) ? FindDeftemplate(x->e, s) : 0;
+  sqlite3_free(s);
+  q->h = sqlite3_mprintf("SQLiteCLIPS %p", (void *)q);
+  q->g = 0;
+  q->v = 0;
+  q->s = q->c = 0;
+  q->n = 0;
+  q->a = 0;
+  q->k = k;
+  if (!q->t || !q->m || !q->h
+   || !AddAssertFunction(x->e, q->h, clpQas, 0, q)
+   || !AddRetractFunction(x->e, q->h, clpQrt, 0, q)) {
+    sqlite3_free(sqlite3_str_finish(r));
+    clpQfr(q);
+    sqlite3_result_error(sc, "clips_query_register: assert / retract function", -1);
+    return;
+  }
+  if (!(s = sqlite3_str_finish(r))) {
+    clpQfr(q);
+    sqlite3_result_error_nomem(sc);
+    return;
+  }
+  i = Build(x->e, s);
+  sqlite3_free(s);
+  if (i) {
+    CLIPSValue u;
+
+    clpQfr(q);
+    if ((s = sqlite3_mprintf("(undeftemplate " CLP_QRY "%s)", n))) {
+      Eval(x->e, s, &u);
+      sqlite3_free(s);
+    }
+    sqlite3_result_error(sc, "clips_query_register: defrule", -1);
+    return;
+  }
+  q->l = x->q;
+  x->q = q;
+}
+
+/* clips_query_drop(name) */
+static void
+clpQdr(
+  sqlite3_context *sc
+ ,int ac
+ ,sqlite3_value **av
+){
+  struct clpCtx *x;
+  struct clpQry **p;
+  struct clpQry *q;
+  const char *n;
+
+  (void)ac;
+  x = sqlite3_user_data(sc);
+  if (!(n = (const char *)sqlite3_value_text(*(av + 0)))
+   || !(q = clpQfn(x, n))) {
+    sqlite3_result_error(sc, "clips_query_drop: name not found", -1);
+    return;
+  }
+  for (p = &x->q; *p != q; p = &(*p)->l);
+  *p = q->l;
+  clpQud(q);
+  clpQfr(q);
+}
+
+/* fire the standing queries' activations leading the agenda (run) would start with, so results do not wait for it */
+static void
+clpQrn(
+  Environment *e
+){
+  Activation *a;
+  Defmodule *m;
+  Defmodule *o;
+  long long k;
+
+  if (!(m = GetFocus(e)) && !(m = FindDefmodule(e, "MAIN")))
+    return;
+  o = SetCurrentModule(e, m); /* GetNextActivation reads the current module's agenda */
+  for (k = 0, a = 0; (a = GetNextActivation(e, a))
+   && !strncmp(ActivationRuleName(a), CLP_QRY, sizeof (CLP_QRY) - 1); ++k);
+  SetCurrentModule(e, o);
+  if (k)
+    Run(e, k);
+}
+
+/* SELECT * FROM clips_query("name"[, since]); */
+
+struct qryVtb {
+  sqlite3_vtab v;
+  struct clpCtx *x;
+  char *n;        /* query of CREATE VIRTUAL TABLE, 0 as a table-valued function */
+  unsigned int k; /* variable columns, after "fact" */
+};
+
+static int
+qryCon(
+  sqlite3 *db
+ ,void *cx
+ ,int ac
+ ,const char *const *av
+ ,sqlite3_vtab **vt
+ ,char **er
+){
+  struct qryVtb *v;
+  struct clpQry *q;
+  sqlite3_str *t;
+  CLIPSValue n;
+  char *s;
+  int i;
+
+  if (!(v = sqlite3_malloc(sizeof (*v))))
+    return (SQLITE_NOMEM);
+  memset(&v->v, 0, sizeof (v->v));
+  v->x = cx;
+  v->n = 0;
+  v->k = 0;
+  if (!(t = sqlite3_str_new(db))) {
+    sqlite3_free(v);
+    return (SQLITE_NOMEM);
+  }
+  sqlite3_str_appendall(t, "CREATE TABLE \"x\"(\"seq\" INTEGER,\"op\" TEXT,\"fact\" INTEGER"/*)*/);
+  if (ac > 3) { /* a column per variable of the query */
+    if (!(v->n = sqlite3_mprintf("%s", *(av + 3)))) {
+      sqlite3_free(sqlite3_str_finish(t));
+      sqlite3_free(v);
+      return (SQLITE_NOMEM);
+    }
+    clpDeq(v->n);
+    if (!(q = clpQfn(cx, v->n))) {
+      *er = sqlite3_mprintf("query not found %s", v->n);
+      sqlite3_free(sqlite3_str_finish(t));
+      sqlite3_free(v->n);
+      sqlite3_free(v);
+      return (SQLITE_ERROR);
+    }
+    DeftemplateSlotNames(q->t, &n);
+    for (v->k = 0; v->k < n.multifieldValue->length; ++v->k)
+      sqlite3_str_appendf(t, ",\"%w\"", (n.multifieldValue->contents + v->k)->lexemeValue->contents);
+  }
+  sqlite3_str_appendall(t, /*(*/",\"query\" TEXT HIDDEN,\"since\" INTEGER HIDDEN)");
+  if (!(s = sqlite3_str_finish(t))) {
+    sqlite3_free(v->n);
+    sqlite3_free(v);
+    return (SQLITE_NOMEM);
+  }
+  i = sqlite3_declare_vtab(db, s);
+  sqlite3_free(s);
+  if (i) {
+    sqlite3_free(v->n);
+    sqlite3_free(v);
+    return (i);
+  }
+  *vt = &v->v;
+  return (SQLITE_OK);
+}
+
+static int
+qryDis(
+  sqlite3_vtab *vt
+){
+  sqlite3_free(((struct qryVtb *)vt)->n);
+  sqlite3_free(vt);
+  return (SQLITE_OK);
+}
+
+struct qryCsr {
+  sqlite3_vtab_cursor c;
+  struct clpQry *q;
+  Fact *f;        /* snapshot */
+  sqlite3_int64 s; /* seq of snapshot */
+  unsigned long o; /* changes from q->g + o */
+  char d;         /* changes */
+};
+
+static int
+qryOpn(
+  sqlite3_vtab *vt
+ ,sqlite3_vtab_cursor **vc
+){
+  struct qryCsr *c;
+
+  if (!(c = sqlite3_malloc(sizeof (*c))))
+    return (SQLITE_NOMEM);
+  c->q = 0;
+  c->f = 0;
+  c->s = 0;
+  c->o = 0;
+  c->d = 0;
+  *vc = &c->c;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+static int
+qryCls(
+  sqlite3_vtab_cursor *vc
+){
+  if (((struct qryCsr *)vc)->f)
+    ReleaseFact(((struct qryCsr *)vc)->f);
+  sqlite3_free(vc);
+  return (SQLITE_OK);
+}
+
+static int
+qryBst(
+  sqlite3_vtab *vt
+ ,sqlite3_index_info *ii
+){
+  int i;
+  int q;
+  int s;
+
+  for (q = s = -1, i = 0; i < ii->nConstraint; ++i)
+    if ((ii->aConstraint + i)->usable
+     && (ii->aConstraint + i)->op == SQLITE_INDEX_CONSTRAINT_EQ) {
+      if ((ii->aConstraint + i)->iColumn == 3 + (int)((struct qryVtb *)vt)->k)
+        q = i;
+      else if ((ii->aConstraint + i)->iColumn == 4 + (int)((struct qryVtb *)vt)->k)
+        s = i;
+    }
+  if (q < 0 && !((struct qryVtb *)vt)->n)
+    return (SQLITE_CONSTRAINT);
+  ii->idxNum = 0; /* 1 query, 2 since, in that order */
+  ii->estimatedCost = 10000.0;
+  if (q >= 0) {
+    (ii->aConstraintUsage + q)->argvIndex = 1;
+    (ii->aConstraintUsage + q)->omit = 1;
+    ii->idxNum |= 1;
+  }
+  if (s >= 0) {
+    (ii->aConstraintUsage + s)->argvIndex = 1 + (ii->idxNum & 1);
+    (ii->aConstraintUsage + s)->omit = 1;
+    ii->idxNum |= 2;
+    ii->estimatedCost = 100.0;
+  }
+  return (SQLITE_OK);
+}
+
+static int
+qryFlt(
+  sqlite3_vtab_cursor *vc
+ ,int in
+ ,const char *is
+ ,int ac
+ ,sqlite3_value **av
+){
+#define V ((struct qryCsr *)vc)
+  const char *n;
+  sqlite3_int64 s;
+
+  if (V->f)
+    ReleaseFact(V->f);
+  V->f = 0;
+  V->q = 0;
+  clpQrn(((struct qryVtb *)V->c.pVtab)->x->e);
+  if (!(n = in & 1 ? (const char *)sqlite3_value_text(*(av + 0)) : ((struct qryVtb *)V->c.pVtab)->n)
+   || !(V->q = clpQfn(((struct qryVtb *)V->c.pVtab)->x, n)))
+    return (SQLITE_OK);
+  V->s = V->q->s;
+  if ((V->d = (in & 2) != 0)) {
+    s = sqlite3_value_int64(*(av + (in & 1)));
+    if (s < V->q->s - (sqlite3_int64)V->q->n) {
+      sqlite3_free(V->c.pVtab->zErrMsg);
+      V->c.pVtab->zErrMsg = sqlite3_mprintf("clips_query: since %lld expired, read the snapshot", s);
+      return (SQLITE_ERROR);
+    }
+    V->o = s >= V->q->s ? V->q->n : V->q->n - (unsigned long)(V->q->s - s);
+    return (SQLITE_OK);
+  }
+  if ((V->f = GetNextFactInTemplate(V->q->t, 0)))
+    RetainFact(V->f);
+  return (SQLITE_OK);
+  (void)is;
+  (void)ac;
+#undef V
+}
+
+static int
+qryNxt(
+  sqlite3_vtab_cursor *vc
+){
+#define V ((struct qryCsr *)vc)
+  Fact *f;
+
+  if (V->d)
+    ++V->o;
+  else {
+    f = V->f;
+    if ((V->f = GetNextFactInTemplate(V->q->t, V->f)))
+      RetainFact(V->f);
+    ReleaseFact(f);
+  }
+  return (SQLITE_OK);
+#undef V
+}
+
+static int
+qryEof(
+  sqlite3_vtab_cursor *vc
+){
+#define V ((struct qryCsr *)vc)
+  if (!V->q)
+    return (1);
+  if (V->d)
+    return (V->o >= V->q->n);
+  return (!V->f);
+#undef V
+}
+
+static int
+qryRid(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_int64 *id
+){
+#define V ((struct qryCsr *)vc)
+  if (V->d)
+    *id = V->q->s - (sqlite3_int64)(V->q->n - V->o) + 1;
+  else
+    *id = FactIndex(V->f);
+  return (SQLITE_OK);
+#undef V
+}
+
+static int
+qryClm(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_context *sc
+ ,int cn
+){
+#define V ((struct qryCsr *)vc)
+  switch (cn) {
+  case 0: /* seq */
+    if (V->d)
+      sqlite3_result_int64(sc, V->q->s - (sqlite3_int64)(V->q->n - V->o) + 1);
+    else
+      sqlite3_result_int64(sc, V->s);
+    break;
+  case 1: /* op */
+    sqlite3_result_text(sc, V->d && (V->q->g + V->o)->o == '-' ? "-" : "+", 1, SQLITE_STATIC);
+    break;
+  case 2: /* fact */
+    if (V->d)
+      sqlite3_result_int64(sc, (V->q->g + V->o)->f);
+    else
+      sqlite3_result_int64(sc, FactIndex(V->f));
+    break;
+  default:
+    if ((unsigned int)cn - 3 < ((struct qryVtb *)V->c.pVtab)->k && (unsigned int)cn - 3 < V->q->k) { /* variable */
+      CLIPSValue v;
+
+      if (V->d)
+        v.header = *(V->q->v + V->o * V->q->k + cn - 3);
+      else
+        v = *(V->f->theProposition.contents + cn - 3);
+      clpVal(sc, &v);
+    }
+    break;
+  }
+  return (SQLITE_OK);
+#undef V
+}
+
+static sqlite3_module qryMod = {
+  0,      /* iVersion */
+  qryCon, /* xCreate */
+  qryCon, /* xConnect */
+  qryBst, /* xBestIndex */
+  qryDis, /* xDisconnect */
+  qryDis, /* xDestroy */
+  qryOpn, /* xOpen */
+  qryCls, /* xClose */
+  qryFlt, /* xFilter */
+  qryNxt, /* xNext */
+  qryEof, /* xEof */
+  qryClm, /* xColumn */
+  qryRid, /* xRowid */
+  0,      /* xUpdate */
+  0,      /* xBegin */
+  0,      /* xSync */
+  0,      /* xCommit */
+  0,      /* xRollback */
+  0,      /* xFindFunction */
+  0,      /* xRename */
+  0,      /* xSavepoint */
+  0,      /* xRelease */
+  0,      /* xRollbackTo */
+  0       /* xShadowName */
+};
+
+/* SELECT * FROM clips_multifield(rowid, 'slot'); */
+
+struct mfdVtb {
+  sqlite3_vtab v;
+  struct clpCtx *x;
+};
+
+static int
+mfdCon(
+  sqlite3 *db
+ ,void *cx
+ ,int ac
+ ,const char *const *av
+ ,sqlite3_vtab **vt
+ ,char **er
+){
+  struct mfdVtb *v;
+  int i;
+
+  if ((i = sqlite3_declare_vtab(db, "CREATE TABLE \"x\"(\"position\" INTEGER,\"value\",\"fact\" INTEGER HIDDEN,\"slot\" TEXT HIDDEN)")))
+    return (i);
+  if (!(v = sqlite3_malloc(sizeof (*v))))
+    return (SQLITE_NOMEM);
+  memset(&v->v, 0, sizeof (v->v));
+  v->x = cx;
+  *vt = &v->v;
+  return (SQLITE_OK);
+  (void)ac;
+  (void)av;
+  (void)er;
+}
+
+static int
+mfdDis(
+  sqlite3_vtab *vt
+){
+  sqlite3_free(vt);
+  return (SQLITE_OK);
+}
+
+struct mfdCsr {
+  sqlite3_vtab_cursor c;
+  Fact *f;        /* retained, keeps m */
+  Multifield *m;  /* read in place */
+  sqlite3_value *v; /* value = v */
+  char *s;        /* slot */
+  size_t o;       /* position - 1 */
+  size_t n;       /* end */
+};
+
+static int
+mfdOpn(
+  sqlite3_vtab *vt
+ ,sqlite3_vtab_cursor **vc
+){
+  struct mfdCsr *c;
+
+  if (!(c = sqlite3_malloc(sizeof (*c))))
+    return (SQLITE_NOMEM);
+  c->f = 0;
+  c->m = 0;
+  c->v = 0;
+  c->s = 0;
+  c->o = c->n = 0;
+  *vc = &c->c;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+static void
+mfdRst(
+  struct mfdCsr *c
+){
+  if (c->f)
+    ReleaseFact(c->f);
+  c->f = 0;
+  c->m = 0;
+  sqlite3_value_free(c->v);
+  c->v = 0;
+  sqlite3_free(c->s);
+  c->s = 0;
+  c->o = c->n = 0;
+}
+
+static int
+mfdCls(
+  sqlite3_vtab_cursor *vc
+){
+  mfdRst((struct mfdCsr *)vc);
+  sqlite3_free(vc);
+  return (SQLITE_OK);
+}
+
+/* bit 1 position =, bit 2 value = */
+static int
+mfdBst(
+  sqlite3_vtab *vt
+ ,sqlite3_index_info *ii
+){
+  int c[4];
+  int i;
+  int n;
+
+  for (c[0] = c[1] = c[2] = c[3] = -1, i = 0; i < ii->nConstraint; ++i)
+    if ((ii->aConstraint + i)->usable
+     && (ii->aConstraint + i)->op == SQLITE_INDEX_CONSTRAINT_EQ
+     && (ii->aConstraint + i)->iColumn >= 0)
+      c[(ii->aConstraint + i)->iColumn] = i;
+  if (c[2] < 0 || c[3] < 0)
+    return (SQLITE_CONSTRAINT);
+  (ii->aConstraintUsage + c[2])->argvIndex = 1;
+  (ii->aConstraintUsage + c[2])->omit = 1;
+  (ii->aConstraintUsage + c[3])->argvIndex = 2;
+  (ii->aConstraintUsage + c[3])->omit = 1;
+  n = 2;
+  ii->idxNum = 0;
+  ii->estimatedCost = 100.0;
+  ii->estimatedRows = 10;
+  if (c[0] >= 0) {
+    (ii->aConstraintUsage + c[0])->argvIndex = ++n;
+    (ii->aConstraintUsage + c[0])->omit = 1;
+    ii->idxNum |= 1;
+    ii->estimatedCost = 10.0;
+    ii->estimatedRows = 1;
+    ii->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+  }
+  if (c[1] >= 0) {
+    (ii->aConstraintUsage + c[1])->argvIndex = ++n;
+    (ii->aConstraintUsage + c[1])->omit = 1;
+    ii->idxNum |= 2;
+    ii->estimatedCost /= 2;
+    ii->estimatedRows = 1;
+  }
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+/* SQL value = CLIPS field, SYMBOL as BLOB */
+static int
+mfdEq(
+  sqlite3_value *s
+ ,CLIPSValue *v
+){
+  switch (v->header->type) {
+  case INTEGER_TYPE:
+    if (sqlite3_value_type(s) == SQLITE_INTEGER)
+      return (sqlite3_value_int64(s) == v->integerValue->contents);
+    return (sqlite3_value_type(s) == SQLITE_FLOAT
+     && sqlite3_value_double(s) == (double)v->integerValue->contents);
+  case FLOAT_TYPE:
+    return ((sqlite3_value_type(s) == SQLITE_FLOAT || sqlite3_value_type(s) == SQLITE_INTEGER)
+     && sqlite3_value_double(s) == v->floatValue->contents);
+  case STRING_TYPE:
+    return (sqlite3_value_type(s) == SQLITE_TEXT
+     && !strcmp((const char *)sqlite3_value_text(s), v->lexemeValue->contents));
+  case SYMBOL_TYPE:
+    if (sqlite3_value_type(s) == SQLITE_BLOB) {
+      const char *b;
+      int n;
+
+      b = sqlite3_value_blob(s);
+      if ((n = sqlite3_value_bytes(s)) && !*(b + n - 1))
+        --n;
+      return ((size_t)n == strlen(v->lexemeValue->contents)
+       && !memcmp(b, v->lexemeValue->contents, n));
+    }
+    return (0);
+  default:
+    return (0);
+  }
+}
+
+static int
+mfdFlt(
+  sqlite3_vtab_cursor *vc
+ ,int in
+ ,const char *is
+ ,int ac
+ ,sqlite3_value **av
+){
+#define V ((struct mfdCsr *)vc)
+  CLIPSValue v;
+  sqlite3_int64 p;
+  int i;
+
+  mfdRst(V);
+  if (sqlite3_value_type(*(av + 1)) == SQLITE_NULL
+   || !((V->f = sqlite3_value_pointer(*(av + 0), CLP_FPT)) /* name.fact, no lookup */
+    || (sqlite3_value_type(*(av + 0)) == SQLITE_INTEGER
+     && (V->f = FindIndexedFact(((struct mfdVtb *)V->c.pVtab)->x->e, sqlite3_value_int64(*(av + 0))))))
+   || !FactExistp(V->f)) {
+    V->f = 0;
+    return (SQLITE_OK);
+  }
+  RetainFact(V->f);
+  if (!(V->s = sqlite3_mprintf("%s", sqlite3_value_text(*(av + 1)))))
+    return (SQLITE_NOMEM);
+  if (GetFactSlot(V->f, V->s, &v) || v.header->type != MULTIFIELD_TYPE)
+    return (SQLITE_OK);
+  V->m = v.multifieldValue;
+  V->n = V->m->length;
+  i = 2;
+  if (in & 1) {
+    p = sqlite3_value_int64(*(av + i++));
+    if (p < 1 || (sqlite3_uint64)p > V->n)
+      V->o = V->n;
+    else {
+      V->o = p - 1;
+      V->n = p;
+    }
+  }
+  if (in & 2) {
+    if (!(V->v = sqlite3_value_dup(*(av + i++))))
+      return (SQLITE_NOMEM);
+    for (; V->o < V->n && !mfdEq(V->v, V->m->contents + V->o); ++V->o);
+  }
+  return (SQLITE_OK);
+  (void)is;
+  (void)ac;
+#undef V
+}
+
+static int
+mfdNxt(
+  sqlite3_vtab_cursor *vc
+){
+#define V ((struct mfdCsr *)vc)
+  for (++V->o; V->v && V->o < V->n && !mfdEq(V->v, V->m->contents + V->o); ++V->o);
+  return (SQLITE_OK);
+#undef V
+}
+
+static int
+mfdEof(
+  sqlite3_vtab_cursor *vc
+){
+  return (((struct mfdCsr *)vc)->o >= ((struct mfdCsr *)vc)->n);
+}
+
+static int
+mfdRid(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_int64 *id
+){
+  *id = ((struct mfdCsr *)vc)->o + 1;
+  return (SQLITE_OK);
+}
+
+static int
+mfdClm(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_context *sc
+ ,int cn
+){
+#define V ((struct mfdCsr *)vc)
+  switch (cn) {
+  case 0: /* position */
+    sqlite3_result_int64(sc, V->o + 1);
+    break;
+  case 1: /* value */
+    clpVal(sc, V->m->contents + V->o);
+    break;
+  case 2: /* fact */
+    sqlite3_result_int64(sc, FactIndex(V->f));
+    break;
+  case 3: /* slot */
+    sqlite3_result_text(sc, V->s, -1, SQLITE_TRANSIENT);
+    break;
+  default:
+    break;
+  }
+  return (SQLITE_OK);
+#undef V
+}
+
+static sqlite3_module mfdMod = {
+  0,      /* iVersion */
+  0,      /* xCreate */
+  mfdCon, /* xConnect */
+  mfdBst, /* xBestIndex */
+  mfdDis, /* xDisconnect */
+  0,      /* xDestroy */
+  mfdOpn, /* xOpen */
+  mfdCls, /* xClose */
+  mfdFlt, /* xFilter */
+  mfdNxt, /* xNext */
+  mfdEof, /* xEof */
+  mfdClm, /* xColumn */
+  mfdRid, /* xRowid */
+  0,      /* xUpdate */
+  0,      /* xBegin */
+  0,      /* xSync */
+  0,      /* xCommit */
+  0,      /* xRollback */
+  0,      /* xFindFunction */
+  0,      /* xRename */
+  0,      /* xSavepoint */
+  0,      /* xRelease */
+  0,      /* xRollbackTo */
+  0       /* xShadowName */
+};
+
+/* SELECT * FROM clips_join('template', 'slot', 'template', 'slot'[, 'template', 'slot']...); */
+
+#define CLP_JON 4       /* templates of clips_join */
+
+struct jonVtb {
+  sqlite3_vtab v;
+  struct clpCtx *x;
+};
+
+static int
+jonCon(
+  sqlite3 *db
+ ,void *cx
+ ,int ac
+ ,const char *const *av
+ ,sqlite3_vtab **vt
+ ,char **er
+){
+  struct jonVtb *v;
+  int i;
+
+  if ((i = sqlite3_declare_vtab(db, "CREATE TABLE \"x\"(\"key\",\"fact1\" INTEGER,\"fact2\" INTEGER,\"fact3\" INTEGER,\"fact4\" INTEGER"
+   ",\"template1\" TEXT HIDDEN,\"slot1\" TEXT HIDDEN,\"template2\" TEXT HIDDEN,\"slot2\" TEXT HIDDEN"
+   ",\"template3\" TEXT HIDDEN,\"slot3\" TEXT HIDDEN,\"template4\" TEXT HIDDEN,\"slot4\" TEXT HIDDEN)")))
+    return (i);
+  if (!(v = sqlite3_malloc(sizeof (*v))))
+    return (SQLITE_NOMEM);
+  memset(&v->v, 0, sizeof (v->v));
+  v->x = cx;
+  *vt = &v->v;
+  return (SQLITE_OK);
+  (void)ac;
+  (void)av;
+  (void)er;
+}
+
+static int
+jonDis(
+  sqlite3_vtab *vt
+){
+  sqlite3_free(vt);
+  return (SQLITE_OK);
+}
+
+struct jonCsr {
+  sqlite3_vtab_cursor c;
+  struct jonSet {   /* facts of a template */
+    Fact **f;       /* retained, of the inner templates grouped by value */
+    struct jonGrp { /* facts of a value of an inner template, open addressing */
+      TypeHeader *v;
+      unsigned long b; /* first in f */
+      unsigned long n; /* facts */
+    } *h;
+    unsigned long n; /* facts */
+    unsigned long z; /* size of h, a power of 2 */
+    unsigned long i; /* position in f */
+    unsigned long e; /* end of the group of the outer fact */
+    unsigned long b; /* start of it */
+    unsigned int p; /* slot position in the fact */
+  } s[CLP_JON];
+  sqlite3_int64 r;
+  unsigned int k;   /* templates */
+};
+
+static int
+jonOpn(
+  sqlite3_vtab *vt
+ ,sqlite3_vtab_cursor **vc
+){
+  struct jonCsr *c;
+
+  if (!(c = sqlite3_malloc(sizeof (*c))))
+    return (SQLITE_NOMEM);
+  memset(c, 0, sizeof (*c));
+  *vc = &c->c;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+static void
+jonRst(
+  struct jonCsr *c
+){
+  while (c->k) {
+    --c->k;
+    while ((c->s + c->k)->n)
+      ReleaseFact(*((c->s + c->k)->f + --(c->s + c->k)->n));
+    sqlite3_free((c->s + c->k)->f);
+    sqlite3_free((c->s + c->k)->h);
+  }
+  memset(c->s, 0, sizeof (c->s));
+  c->r = 0;
+}
+
+static int
+jonCls(
+  sqlite3_vtab_cursor *vc
+){
+  jonRst((struct jonCsr *)vc);
+  sqlite3_free(vc);
+  return (SQLITE_OK);
+}
+
+/* the template and slot pairs given, the first two are needed */
+static int
+jonBst(
+  sqlite3_vtab *vt
+ ,sqlite3_index_info *ii
+){
+  int c[2 * CLP_JON];
+  int i;
+  int n;
+
+  for (i = 0; i < 2 * CLP_JON; ++i)
+    c[i] = -1;
+  for (i = 0; i < ii->nConstraint; ++i)
+    if ((ii->aConstraint + i)->usable
+     && (ii->aConstraint + i)->op == SQLITE_INDEX_CONSTRAINT_EQ
+     && (ii->aConstraint + i)->iColumn > CLP_JON)
+      c[(ii->aConstraint + i)->iColumn - CLP_JON - 1] = i;
+  for (n = 0; n < CLP_JON && c[2 * n] >= 0 && c[2 * n + 1] >= 0; ++n) {
+    (ii->aConstraintUsage + c[2 * n])->argvIndex = 2 * n + 1;
+    (ii->aConstraintUsage + c[2 * n])->omit = 1;
+    (ii->aConstraintUsage + c[2 * n + 1])->argvIndex = 2 * n + 2;
+    (ii->aConstraintUsage + c[2 * n + 1])->omit = 1;
+  }
+  if (n < 2)
+    return (SQLITE_CONSTRAINT);
+  ii->idxNum = n;
+  ii->estimatedCost = 1000.0 * n;
+  ii->estimatedRows = 1000;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+/* the group of a value in an inner template, empty when missing */
+static struct jonGrp *
+jonFnd(
+  struct jonSet *s
+ ,TypeHeader *v
+){
+  unsigned long i;
+
+  for (i = (unsigned long)(((sqlite3_uint64)(size_t)v >> 4) * 2654435761u) & (s->z - 1);
+   (s->h + i)->v && (s->h + i)->v != v; i = (i + 1) & (s->z - 1));
+  return (s->h + i);
+}
+
+/* retain the facts of template t, grouped by the value of slot p when g */
+static int
+jonSet(
+  struct jonSet *s
+ ,Deftemplate *t
+ ,int g
+){
+  struct jonGrp *h;
+  Fact **f;
+  Fact *a;
+  unsigned long n;
+  unsigned long i;
+
+  for (n = 0, a = 0; (a = GetNextFactInTemplate(t, a)); ++n);
+  if (!(f = sqlite3_malloc64((n ? n : 1) * sizeof (*f))))
+    return (SQLITE_NOMEM);
+  for (s->n = 0, a = 0; s->n < n && (a = GetNextFactInTemplate(t, a));)
+    RetainFact((*(f + s->n++) = a));
+  if (!g) {
+    s->f = f;
+    return (SQLITE_OK);
+  }
+  for (s->z = 16; s->z < 2 * s->n; s->z *= 2);
+  if (!(s->h = sqlite3_malloc64(s->z * sizeof (*s->h)))
+   || !(s->f = sqlite3_malloc64((s->n ? s->n : 1) * sizeof (*s->f)))) {
+    while (s->n)
+      ReleaseFact(*(f + --s->n));
+    sqlite3_free(f);
+    return (SQLITE_NOMEM);
+  }
+  memset(s->h, 0, s->z * sizeof (*s->h));
+  for (i = 0; i < s->n; ++i) { /* count */
+    h = jonFnd(s, ((*(f + i))->theProposition.contents + s->p)->header);
+    h->v = ((*(f + i))->theProposition.contents + s->p)->header;
+    ++h->n;
+  }
+  for (n = i = 0; i < s->z; ++i) /* starts */
+    if ((s->h + i)->v) {
+      (s->h + i)->b = n;
+      n += (s->h + i)->n;
+      (s->h + i)->n = 0;
+    }
+  for (i = 0; i < s->n; ++i) { /* scatter, keeping the facts' order in each group */
+    h = jonFnd(s, ((*(f + i))->theProposition.contents + s->p)->header);
+    *(s->f + h->b + h->n++) = *(f + i);
+  }
+  sqlite3_free(f);
+  return (SQLITE_OK);
+}
+
+/* from outer fact s[0].i to the next one whose value every inner template has */
+static void
+jonOut(
+  struct jonCsr *c
+){
+  struct jonGrp *h;
+  unsigned int k;
+
+  for (; c->s->i < c->s->n; ++c->s->i) {
+    for (k = 1; k < c->k; ++k) {
+      h = jonFnd(c->s + k, ((*(c->s->f + c->s->i))->theProposition.contents + c->s->p)->header);
+      if (!h->v)
+        break;
+      (c->s + k)->i = (c->s + k)->b = h->b;
+      (c->s + k)->e = h->b + h->n;
+    }
+    if (k == c->k)
+      return;
+  }
+}
+
+static int
+jonFlt(
+  sqlite3_vtab_cursor *vc
+ ,int in
+ ,const char *is
+ ,int ac
+ ,sqlite3_value **av
+){
+#define V ((struct jonCsr *)vc)
+  Deftemplate *t;
+  const char *n;
+  CLIPSValue v;
+  unsigned long j;
+  int i;
+
+  jonRst(V);
+  for (i = 0; i < in; ++i) {
+    n = (const char *)sqlite3_value_text(*(av + 2 * i + 1));
+    if (!(t = FindDeftemplate(((struct jonVtb *)V->c.pVtab)->x->e, (const char *)sqlite3_value_text(*(av + 2 * i))))
+     || !n || !DeftemplateSlotSingleP(t, n)) {
+      sqlite3_free(V->c.pVtab->zErrMsg);
+      V->c.pVtab->zErrMsg = sqlite3_mprintf("clips_join: template %d %s not found or slot %s not single", i + 1, sqlite3_value_text(*(av + 2 * i)), n ? n : "NULL");
+      return (SQLITE_ERROR);
+    }
+    DeftemplateSlotNames(t, &v);
+    for (j = 0; j < v.multifieldValue->length && strcmp((v.multifieldValue->contents + j)->lexemeValue->contents, n); ++j);
+    (V->s + i)->p = j;
+    ++V->k;
+    if (jonSet(V->s + i, t, i > 0))
+      return (SQLITE_NOMEM);
+  }
+  V->r = 1;
+  jonOut(V);
+  return (SQLITE_OK);
+  (void)is;
+  (void)ac;
+#undef V
+}
+
+static int
+jonNxt(
+  sqlite3_vtab_cursor *vc
+){
+#define V ((struct jonCsr *)vc)
+  unsigned int k;
+
+  ++V->r;
+  for (k = V->k - 1; k > 0; --k) { /* the odometer of the inner groups */
+    if (++(V->s + k)->i < (V->s + k)->e)
+      return (SQLITE_OK);
+    (V->s + k)->i = (V->s + k)->b;
+  }
+  ++V->s->i;
+  jonOut(V);
+  return (SQLITE_OK);
+#undef V
+}
+
+static int
+jonEof(
+  sqlite3_vtab_cursor *vc
+){
+  return (((struct jonCsr *)vc)->s->i >= ((struct jonCsr *)vc)->s->n);
+}
+
+static int
+jonRid(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_int64 *id
+){
+  *id = ((struct jonCsr *)vc)->r;
+  return (SQLITE_OK);
+}
+
+static int
+jonClm(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_context *sc
+ ,int cn
+){
+#define V ((struct jonCsr *)vc)
+  if (!cn)
+    clpVal(sc, (*(V->s->f + V->s->i))->theProposition.contents + V->s->p);
+  else if (cn <= CLP_JON && (unsigned int)cn <= V->k)
+    sqlite3_result_int64(sc, FactIndex(*((V->s + cn - 1)->f + (V->s + cn - 1)->i)));
+  return (SQLITE_OK);
+#undef V
+}
+
+static sqlite3_module jonMod = {
+  0,      /* iVersion */
+  0,      /* xCreate */
+  jonCon, /* xConnect */
+  jonBst, /* xBestIndex */
+  jonDis, /* xDisconnect */
+  0,      /* xDestroy */
+  jonOpn, /* xOpen */
+  jonCls, /* xClose */
+  jonFlt, /* xFilter */
+  jonNxt, /* xNext */
+  jonEof, /* xEof */
+  jonClm, /* xColumn */
+  jonRid, /* xRowid */
+  0,      /* xUpdate */
+  0,      /* xBegin */
+  0,      /* xSync */
+  0,      /* xCommit */
+  0,      /* xRollback */
+  0,      /* xFindFunction */
+  0,      /* xRename */
+  0,      /* xSavepoint */
+  0,      /* xRelease */
+  0,      /* xRollbackTo */
+  0       /* xShadowName */
+};
+
+/* SELECT * FROM clips_aggregate('template', 'function'[, 'slot'][, 'group_slot'][, threads]); */
+
+#define CLP_AGT 8       /* clips_aggregate threads by default, at most the processors */
+#define CLP_AGP 16384   /* facts of a clips_aggregate partition at least */
+
+struct agpVtb {
+  sqlite3_vtab v;
+  struct clpCtx *x;
+};
+
+static int
+agpCon(
+  sqlite3 *db
+ ,void *cx
+ ,int ac
+ ,const char *const *av
+ ,sqlite3_vtab **vt
+ ,char **er
+){
+  struct agpVtb *v;
+  int i;
+
+  if ((i = sqlite3_declare_vtab(db, "CREATE TABLE \"x\"(\"group\",\"facts\" INTEGER,\"value\""
+   ",\"template\" TEXT HIDDEN,\"function\" TEXT HIDDEN,\"slot\" TEXT HIDDEN,\"group_slot\" TEXT HIDDEN,\"threads\" INTEGER HIDDEN)")))
+    return (i);
+  if (!(v = sqlite3_malloc(sizeof (*v))))
+    return (SQLITE_NOMEM);
+  memset(&v->v, 0, sizeof (v->v));
+  v->x = cx;
+  *vt = &v->v;
+  return (SQLITE_OK);
+  (void)ac;
+  (void)av;
+  (void)er;
+}
+
+static int
+agpDis(
+  sqlite3_vtab *vt
+){
+  sqlite3_free(vt);
+  return (SQLITE_OK);
+}
+
+struct agpGrp {   /* partial aggregate of a group */
+  TypeHeader *v;  /* group slot value, interned */
+  unsigned long b; /* its first fact in the snapshot */
+  sqlite3_int64 n; /* facts, 0 when unused */
+  sqlite3_int64 c; /* slot values not nil */
+  struct clpAgg a;
+};
+
+struct agpPrt {   /* partition of the snapshot, aggregated by a thread */
+  Fact **f;       /* its first fact */
+  struct agpGrp *h; /* open addressing */
+  unsigned long o; /* position of f in the snapshot */
+  unsigned long n; /* facts */
+  unsigned long z; /* size of h, a power of 2 */
+  unsigned long g; /* groups */
+  int p;          /* value slot position, -1 none */
+  int q;          /* group slot position, -1 none */
+  int e;          /* SQLITE_NOMEM */
+};
+
+struct agpCsr {
+  sqlite3_vtab_cursor c;
+  Fact **f;       /* retained snapshot of the template's facts */
+  struct agpGrp *g; /* merged, in the order of their first fact */
+  unsigned long n; /* facts */
+  unsigned long m; /* groups */
+  unsigned long i; /* position in g */
+  char t;         /* 'c'ount, 's'um, 'a'vg, 'l' min, 'h' max */
+  char s;         /* a value slot given */
+};
+
+static int
+agpOpn(
+  sqlite3_vtab *vt
+ ,sqlite3_vtab_cursor **vc
+){
+  struct agpCsr *c;
+
+  if (!(c = sqlite3_malloc(sizeof (*c))))
+    return (SQLITE_NOMEM);
+  memset(c, 0, sizeof (*c));
+  *vc = &c->c;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+static void
+agpRst(
+  struct agpCsr *c
+){
+  while (c->n)
+    ReleaseFact(*(c->f + --c->n));
+  sqlite3_free(c->f);
+  sqlite3_free(c->g);
+  c->f = 0;
+  c->g = 0;
+  c->m = c->i = 0;
+}
+
+static int
+agpCls(
+  sqlite3_vtab_cursor *vc
+){
+  agpRst((struct agpCsr *)vc);
+  sqlite3_free(vc);
+  return (SQLITE_OK);
+}
+
+/* template and function are needed, slot, group_slot and threads are bits of idxNum */
+static int
+agpBst(
+  sqlite3_vtab *vt
+ ,sqlite3_index_info *ii
+){
+  int c[5];
+  int i;
+  int n;
+
+  for (i = 0; i < 5; ++i)
+    c[i] = -1;
+  for (i = 0; i < ii->nConstraint; ++i)
+    if ((ii->aConstraint + i)->usable
+     && (ii->aConstraint + i)->op == SQLITE_INDEX_CONSTRAINT_EQ
+     && (ii->aConstraint + i)->iColumn >= 3)
+      c[(ii->aConstraint + i)->iColumn - 3] = i;
+  if (c[0] < 0 || c[1] < 0)
+    return (SQLITE_CONSTRAINT);
+  ii->idxNum = 0;
+  for (n = i = 0; i < 5; ++i)
+    if (c[i] >= 0) {
+      (ii->aConstraintUsage + c[i])->argvIndex = ++n;
+      (ii->aConstraintUsage + c[i])->omit = 1;
+      if (i >= 2)
+        ii->idxNum |= 1 << (i - 2);
+    }
+  ii->estimatedCost = 100000.0;
+  ii->estimatedRows = ii->idxNum & 2 ? 100 : 1;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+/* the group of a value, unused when missing */
+static struct agpGrp *
+agpFnd(
+  struct agpGrp *h
+ ,unsigned long z
+ ,TypeHeader *v
+){
+  unsigned long i;
+
+  for (i = (unsigned long)(((sqlite3_uint64)(size_t)v >> 4) * 2654435761u) & (z - 1);
+   (h + i)->n && (h + i)->v != v; i = (i + 1) & (z - 1));
+  return (h + i);
+}
+
+/* the group of a value, added to partition p, 0 on NOMEM */
+static struct agpGrp *
+agpAdd(
+  struct agpPrt *p
+ ,TypeHeader *v
+ ,unsigned long b
+){
+  struct agpGrp *h;
+  struct agpGrp *g;
+  unsigned long i;
+
+  if ((g = agpFnd(p->h, p->z, v))->n)
+    return (g);
+  if (2 * (p->g + 1) > p->z) {
+    if (!(h = sqlite3_malloc64(2 * p->z * sizeof (*h))))
+      return (0);
+    memset(h, 0, 2 * p->z * sizeof (*h));
+    for (i = 0; i < p->z; ++i)
+      if ((p->h + i)->n)
+        *agpFnd(h, 2 * p->z, (p->h + i)->v) = *(p->h + i);
+    sqlite3_free(p->h);
+    p->h = h;
+    p->z *= 2;
+    g = agpFnd(p->h, p->z, v);
+  }
+  memset(g, 0, sizeof (*g));
+  g->v = v;
+  g->b = b;
+  ++p->g;
+  return (g);
+}
+
+/* aggregate a partition, reading the retained facts only, no CLIPS calls */
+static void *
+agpRun(
+  void *a
+){
+#define P ((struct agpPrt *)a)
+  struct agpGrp *g;
+  CLIPSValue *v;
+  Fact *f;
+  unsigned long i;
+
+  P->z = 16;
+  if (!(P->h = sqlite3_malloc64(P->z * sizeof (*P->h)))) {
+    P->e = SQLITE_NOMEM;
+    return (0);
+  }
+  memset(P->h, 0, P->z * sizeof (*P->h));
+  for (i = 0; i < P->n; ++i) {
+    f = *(P->f + i);
+    if (!(g = agpAdd(P, P->q >= 0 ? (f->theProposition.contents + P->q)->header : 0, P->o + i))) {
+      P->e = SQLITE_NOMEM;
+      return (0);
+    }
+    ++g->n;
+    if (P->p >= 0) {
+      v = f->theProposition.contents + P->p;
+      if (v->header->type != SYMBOL_TYPE || strcmp(v->lexemeValue->contents, "nil"))
+        ++g->c;
+      clpAgv(&g->a, v, 1);
+    }
+  }
+  return (0);
+#undef P
+}
+
+/* merge aggregate b into a */
+static void
+clpAgm(
+  struct clpAgg *a
+ ,const struct clpAgg *b
+){
+  if (!b->n)
+    return;
+  a->f += b->f;
+  if (b->o)
+    a->o = 1;
+  else if (!a->o) {
+    if ((b->i > 0 && a->i > (sqlite3_int64)(~(sqlite3_uint64)0 >> 1) - b->i)
+     || (b->i < 0 && a->i < -(sqlite3_int64)(~(sqlite3_uint64)0 >> 1) - 1 - b->i))
+      a->o = 1;
+    else
+      a->i += b->i;
+  }
+  a->r += b->r;
+  if (!a->n) {
+    a->l = b->l;
+    a->h = b->h;
+  } else {
+    if (clpNcm(&b->l, &a->l) < 0)
+      a->l = b->l;
+    if (clpNcm(&b->h, &a->h) > 0)
+      a->h = b->h;
+  }
+  a->n += b->n;
+}
+
+static int
+agpCmp(
+  const void *a
+ ,const void *b
+){
+  return (((const struct agpGrp *)a)->b < ((const struct agpGrp *)b)->b ? -1
+   : ((const struct agpGrp *)a)->b > ((const struct agpGrp *)b)->b);
+}
+
+/* partition the snapshot to t threads, the first is the caller's, merge in partition order */
+static int
+agpPar(
+  struct agpCsr *c
+ ,int p
+ ,int q
+ ,int t
+){
+  struct agpPrt r[CLP_AGT];
+  pthread_t d[CLP_AGT];
+  struct agpPrt m;
+  struct agpGrp *g;
+  unsigned long i;
+  int e;
+  int k;
+
+  if ((unsigned long)t > (c->n + CLP_AGP - 1) / CLP_AGP)
+    t = (int)((c->n + CLP_AGP - 1) / CLP_AGP);
+  if (t < 1 || !sqlite3_threadsafe())
+    t = 1;
+  memset(r, 0, sizeof (r));
+  for (k = 0; k < t; ++k) {
+    (r + k)->o = c->n / t * k;
+    (r + k)->n = k < t - 1 ? c->n / t : c->n - (r + k)->o;
+    (r + k)->f = c->f + (r + k)->o;
+    (r + k)->p = p;
+    (r + k)->q = q;
+    if (k && pthread_create(d + k, 0, agpRun, r + k))
+      (r + k)->e = -1; /* run by the caller */
+  }
+  agpRun(r);
+  for (k = 1; k < t; ++k)
+    if ((r + k)->e < 0) {
+      (r + k)->e = 0;
+      agpRun(r + k);
+    } else
+      pthread_join(*(d + k), 0);
+  memset(&m, 0, sizeof (m));
+  m.z = 16;
+  for (e = k = 0; k < t; ++k)
+    if ((r + k)->e)
+      e = (r + k)->e;
+  if (!e && !(m.h = sqlite3_malloc64(m.z * sizeof (*m.h))))
+    e = SQLITE_NOMEM;
+  else if (!e)
+    memset(m.h, 0, m.z * sizeof (*m.h));
+  for (k = 0; !e && k < t; ++k)
+    for (i = 0; i < (r + k)->z; ++i) {
+      if (!((r + k)->h + i)->n)
+        continue;
+      if (!(g = agpAdd(&m, ((r + k)->h + i)->v, ((r + k)->h + i)->b))) {
+        e = SQLITE_NOMEM;
+        break;
+      }
+      g->n += ((r + k)->h + i)->n;
+      g->c += ((r + k)->h + i)->c;
+      clpAgm(&g->a, &((r + k)->h + i)->a);
+    }
+  for (k = 0; k < t; ++k)
+    sqlite3_free((r + k)->h);
+  if (e) {
+    sqlite3_free(m.h);
+    return (SQLITE_NOMEM);
+  }
+  for (c->m = i = 0; i < m.z; ++i) /* compact */
+    if ((m.h + i)->n)
+      *(m.h + c->m++) = *(m.h + i);
+  qsort(m.h, c->m, sizeof (*m.h), agpCmp);
+  c->g = m.h;
+  return (SQLITE_OK);
+}
+
+/* the position of single slot n of t, -1 when missing, -2 when u and it allows more than INTEGER and FLOAT */
+static int
+agpSlt(
+  Deftemplate *t
+ ,const char *n
+ ,int u
+){
+  CLIPSValue v;
+  size_t j;
+
+  if (!n || !DeftemplateSlotSingleP(t, n))
+    return (-1);
+  if (u && DeftemplateSlotTypes(t, n, &v))
+    for (j = 0; j < v.multifieldValue->length; ++j)
+      if (strcmp((v.multifieldValue->contents + j)->lexemeValue->contents, "INTEGER")
+       && strcmp((v.multifieldValue->contents + j)->lexemeValue->contents, "FLOAT"))
+        return (-2);
+  DeftemplateSlotNames(t, &v);
+  for (j = 0; j < v.multifieldValue->length && strcmp((v.multifieldValue->contents + j)->lexemeValue->contents, n); ++j);
+  return (j < v.multifieldValue->length ? (int)j : -1);
+}
+
+static int
+agpFlt(
+  sqlite3_vtab_cursor *vc
+ ,int in
+ ,const char *is
+ ,int ac
+ ,sqlite3_value **av
+){
+#define V ((struct agpCsr *)vc)
+  static const char *fn[] = {"count", "sum", "avg", "min", "max", 0};
+  Deftemplate *t;
+  const char *s;
+  const char *n;
+  Fact *f;
+  unsigned long j;
+  int p;
+  int q;
+  int h;
+  int i;
+  long k;
+
+  agpRst(V);
+  p = q = -1;
+  h = CLP_AGT;
+  if ((k = sysconf(_SC_NPROCESSORS_ONLN)) > 0 && k < h)
+    h = (int)k;
+  V->s = 0;
+  s = (const char *)sqlite3_value_text(*av);
+  if (!(t = FindDeftemplate(((struct agpVtb *)V->c.pVtab)->x->e, s ? s : ""))) {
+    sqlite3_free(V->c.pVtab->zErrMsg);
+    V->c.pVtab->zErrMsg = sqlite3_mprintf("clips_aggregate: template %s not found", s ? s : "NULL");
+    return (SQLITE_ERROR);
+  }
+  n = (const char *)sqlite3_value_text(*(av + 1));
+  for (i = 0; *(fn + i) && (!n || sqlite3_stricmp(*(fn + i), n)); ++i);
+  if (!*(fn + i)) {
+    sqlite3_free(V->c.pVtab->zErrMsg);
+    V->c.pVtab->zErrMsg = sqlite3_mprintf("clips_aggregate: function %s not count, sum, avg, min or max", n ? n : "NULL");
+    return (SQLITE_ERROR);
+  }
+  V->t = "csalh"[i];
+  i = 2;
+  if (in & 1) {
+    if ((n = (const char *)sqlite3_value_text(*(av + i++))) && *n) {
+      if ((p = agpSlt(t, n, V->t != 'c')) < 0) {
+        sqlite3_free(V->c.pVtab->zErrMsg);
+        V->c.pVtab->zErrMsg = p == -1 ? sqlite3_mprintf("clips_aggregate: slot %s not found or not single", n)
+         : sqlite3_mprintf("clips_aggregate: slot %s not INTEGER or FLOAT", n);
+        return (SQLITE_ERROR);
+      }
+      V->s = 1;
+    }
+  }
+  if (V->t != 'c' && p < 0) {
+    sqlite3_free(V->c.pVtab->zErrMsg);
+    V->c.pVtab->zErrMsg = sqlite3_mprintf("clips_aggregate: %s needs a slot", sqlite3_value_text(*(av + 1)));
+    return (SQLITE_ERROR);
+  }
+  if (in & 2) {
+    if ((n = (const char *)sqlite3_value_text(*(av + i++))) && *n && (q = agpSlt(t, n, 0)) < 0) {
+      sqlite3_free(V->c.pVtab->zErrMsg);
+      V->c.pVtab->zErrMsg = sqlite3_mprintf("clips_aggregate: group_slot %s not found or not single", n);
+      return (SQLITE_ERROR);
+    }
+  }
+  if (in & 4)
+    h = sqlite3_value_int(*(av + i++));
+  if (h > CLP_AGT)
+    h = CLP_AGT;
+  for (j = 0, f = 0; (f = GetNextFactInTemplate(t, f)); ++j);
+  if (!(V->f = sqlite3_malloc64((j ? j : 1) * sizeof (*V->f))))
+    return (SQLITE_NOMEM);
+  for (f = 0; V->n < j && (f = GetNextFactInTemplate(t, f));)
+    RetainFact((*(V->f + V->n++) = f));
+  if ((i = agpPar(V, p, q, h)))
+    return (i);
+  if (!V->m && q < 0) { /* like SQL, no GROUP BY is one row */
+    if (!(V->g = sqlite3_realloc64(V->g, sizeof (*V->g))))
+      return (SQLITE_NOMEM);
+    memset(V->g, 0, sizeof (*V->g));
+    V->m = 1;
+  }
+  return (SQLITE_OK);
+  (void)is;
+  (void)ac;
+#undef V
+}
+
+static int
+agpNxt(
+  sqlite3_vtab_cursor *vc
+){
+  ++((struct agpCsr *)vc)->i;
+  return (SQLITE_OK);
+}
+
+static int
+agpEof(
+  sqlite3_vtab_cursor *vc
+){
+  return (((struct agpCsr *)vc)->i >= ((struct agpCsr *)vc)->m);
+}
+
+static int
+agpRid(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_int64 *id
+){
+  *id = ((struct agpCsr *)vc)->i + 1;
+  return (SQLITE_OK);
+}
+
+static int
+agpClm(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_context *sc
+ ,int cn
+){
+#define V ((struct agpCsr *)vc)
+  struct agpGrp *g;
+  CLIPSValue v;
+
+  g = V->g + V->i;
+  switch (cn) {
+  case 0: /* group */
+    if (g->v) {
+      v.header = g->v;
+      clpVal(sc, &v);
+    }
+    break;
+  case 1: /* facts */
+    sqlite3_result_int64(sc, g->n);
+    break;
+  case 2: /* value */
+    switch (V->t) {
+    case 'c':
+      sqlite3_result_int64(sc, V->s ? g->c : g->n);
+      break;
+    case 's':
+      if (!g->a.n)
+        break;
+      if (g->a.f || g->a.o)
+        sqlite3_result_double(sc, g->a.r);
+      else
+        sqlite3_result_int64(sc, g->a.i);
+      break;
+    case 'a':
+      if (g->a.n)
+        sqlite3_result_double(sc, g->a.r / g->a.n);
+      break;
+    case 'l':
+      if (g->a.n)
+        aggNum(sc, &g->a.l);
+      break;
+    case 'h':
+      if (g->a.n)
+        aggNum(sc, &g->a.h);
+      break;
+    default:
+      break;
+    }
+    break;
+  default:
+    break;
+  }
+  return (SQLITE_OK);
+#undef V
+}
+
+static sqlite3_module agpMod = {
+  0,      /* iVersion */
+  0,      /* xCreate */
+  agpCon, /* xConnect */
+  agpBst, /* xBestIndex */
+  agpDis, /* xDisconnect */
+  0,      /* xDestroy */
+  agpOpn, /* xOpen */
+  agpCls, /* xClose */
+  agpFlt, /* xFilter */
+  agpNxt, /* xNext */
+  agpEof, /* xEof */
+  agpClm, /* xColumn */
+  agpRid, /* xRowid */
+  0,      /* xUpdate */
+  0,      /* xBegin */
+  0,      /* xSync */
+  0,      /* xCommit */
+  0,      /* xRollback */
+  0,      /* xFindFunction */
+  0,      /* xRename */
+  0,      /* xSavepoint */
+  0,      /* xRelease */
+  0,      /* xRollbackTo */
+  0       /* xShadowName */
+};
+
+/* SELECT * FROM clips_explain('sql'); */
+
+struct xplVtb {
+  sqlite3_vtab v;
+  struct clpCtx *x;
+};
+
+static int
+xplCon(
+  sqlite3 *db
+ ,void *cx
+ ,int ac
+ ,const char *const *av
+ ,sqlite3_vtab **vt
+ ,char **er
+){
+  struct xplVtb *v;
+  int i;
+
+  if ((i = sqlite3_declare_vtab(db, "CREATE TABLE \"x\"(\"table\" TEXT,\"plan\" TEXT,\"pushed\" TEXT,\"unpushed\" TEXT"
+   ",\"estimated\" INTEGER,\"cost\" REAL,\"filters\" INTEGER,\"rows\" INTEGER,\"filter\" TEXT,\"sql\" TEXT HIDDEN)")))
+    return (i);
+  if (!(v = sqlite3_malloc(sizeof (*v))))
+    return (SQLITE_NOMEM);
+  memset(&v->v, 0, sizeof (v->v));
+  v->x = cx;
+  *vt = &v->v;
+  return (SQLITE_OK);
+  (void)ac;
+  (void)av;
+  (void)er;
+}
+
+static int
+xplDis(
+  sqlite3_vtab *vt
+){
+  sqlite3_free(vt);
+  return (SQLITE_OK);
+}
+
+struct xplCsr {
+  sqlite3_vtab_cursor c;
+  struct clpPln *k; /* plans recorded */
+  unsigned int n; /* number of k */
+  unsigned int i; /* position in k */
+  char r;         /* the statement ran, filters and rows are known */
+};
+
+static int
+xplOpn(
+  sqlite3_vtab *vt
+ ,sqlite3_vtab_cursor **vc
+){
+  struct xplCsr *c;
+
+  if (!(c = sqlite3_malloc(sizeof (*c))))
+    return (SQLITE_NOMEM);
+  memset(c, 0, sizeof (*c));
+  *vc = &c->c;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+static int
+xplCls(
+  sqlite3_vtab_cursor *vc
+){
+  clpPlf(((struct xplCsr *)vc)->k, ((struct xplCsr *)vc)->n);
+  sqlite3_free(vc);
+  return (SQLITE_OK);
+}
+
+/* the sql is needed */
+static int
+xplBst(
+  sqlite3_vtab *vt
+ ,sqlite3_index_info *ii
+){
+  int i;
+
+  for (i = 0; i < ii->nConstraint; ++i)
+    if ((ii->aConstraint + i)->usable
+     && (ii->aConstraint + i)->op == SQLITE_INDEX_CONSTRAINT_EQ
+     && (ii->aConstraint + i)->iColumn == 9) {
+      (ii->aConstraintUsage + i)->argvIndex = 1;
+      (ii->aConstraintUsage + i)->omit = 1;
+      ii->estimatedCost = 1000.0;
+      ii->estimatedRows = 10;
+      return (SQLITE_OK);
+    }
+  return (SQLITE_CONSTRAINT);
+  (void)vt;
+}
+
+/* prepare the sql recording the plans of CLIPS tables, run it when read only for filters and rows */
+static int
+xplFlt(
+  sqlite3_vtab_cursor *vc
+ ,int in
+ ,const char *is
+ ,int ac
+ ,sqlite3_value **av
+){
+#define V ((struct xplCsr *)vc)
+  struct clpCtx *x;
+  sqlite3_stmt *s;
+  char *e;
+  int i;
+
+  x = ((struct xplVtb *)V->c.pVtab)->x;
+  clpPlf(V->k, V->n);
+  V->k = 0;
+  V->n = V->i = 0;
+  V->r = 0;
+  if (x->o) {
+    sqlite3_free(V->c.pVtab->zErrMsg);
+    V->c.pVtab->zErrMsg = sqlite3_mprintf("clips_explain: already explaining");
+    return (SQLITE_ERROR);
+  }
+  x->o = 1;
+  e = 0;
+  s = 0;
+  if (!(i = sqlite3_prepare_v2(x->d, (const char *)sqlite3_value_text(*av), -1, &s, 0))
+   && s && sqlite3_stmt_readonly(s)) {
+    while ((i = sqlite3_step(s)) == SQLITE_ROW);
+    if (i == SQLITE_DONE)
+      i = SQLITE_OK;
+    V->r = 1;
+  }
+  if (i)
+    e = sqlite3_mprintf("clips_explain: %s", sqlite3_errmsg(x->d));
+  sqlite3_finalize(s);
+  x->o = 0;
+  V->k = x->k;
+  V->n = x->i;
+  x->k = 0;
+  x->i = x->j = 0;
+  if (i) {
+    sqlite3_free(V->c.pVtab->zErrMsg);
+    V->c.pVtab->zErrMsg = e;
+    return (i == SQLITE_NOMEM ? i : SQLITE_ERROR);
+  }
+  return (SQLITE_OK);
+  (void)in;
+  (void)is;
+  (void)ac;
+#undef V
+}
+
+static int
+xplNxt(
+  sqlite3_vtab_cursor *vc
+){
+  ++((struct xplCsr *)vc)->i;
+  return (SQLITE_OK);
+}
+
+static int
+xplEof(
+  sqlite3_vtab_cursor *vc
+){
+  return (((struct xplCsr *)vc)->i >= ((struct xplCsr *)vc)->n);
+}
+
+static int
+xplRid(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_int64 *id
+){
+  *id = ((struct xplCsr *)vc)->i + 1;
+  return (SQLITE_OK);
+}
+
+static int
+xplClm(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_context *sc
+ ,int cn
+){
+#define V ((struct xplCsr *)vc)
+  struct clpPln *k;
+
+  k = V->k + V->i;
+  switch (cn) {
+  case 0: /* table */
+    sqlite3_result_text(sc, k->m, -1, SQLITE_TRANSIENT);
+    break;
+  case 1: /* plan */
+    if (k->s)
+      sqlite3_result_text(sc, k->s, -1, SQLITE_TRANSIENT);
+    break;
+  case 2: /* pushed */
+    if (k->p)
+      sqlite3_result_text(sc, k->p, -1, SQLITE_TRANSIENT);
+    break;
+  case 3: /* unpushed */
+    if (k->u)
+      sqlite3_result_text(sc, k->u, -1, SQLITE_TRANSIENT);
+    break;
+  case 4: /* estimated */
+    sqlite3_result_int64(sc, k->r);
+    break;
+  case 5: /* cost */
+    sqlite3_result_double(sc, k->c);
+    break;
+  case 6: /* filters */
+    if (V->r)
+      sqlite3_result_int64(sc, k->f);
+    break;
+  case 7: /* rows */
+    if (V->r)
+      sqlite3_result_int64(sc, k->a);
+    break;
+  case 8: /* filter */
+    if (k->e)
+      sqlite3_result_text(sc, k->e, -1, SQLITE_TRANSIENT);
+    break;
+  default:
+    break;
+  }
+  return (SQLITE_OK);
+#undef V
+}
+
+static sqlite3_module xplMod = {
+  0,      /* iVersion */
+  0,      /* xCreate */
+  xplCon, /* xConnect */
+  xplBst, /* xBestIndex */
+  xplDis, /* xDisconnect */
+  0,      /* xDestroy */
+  xplOpn, /* xOpen */
+  xplCls, /* xClose */
+  xplFlt, /* xFilter */
+  xplNxt, /* xNext */
+  xplEof, /* xEof */
+  xplClm, /* xColumn */
+  xplRid, /* xRowid */
+  0,      /* xUpdate */
+  0,      /* xBegin */
+  0,      /* xSync */
+  0,      /* xCommit */
+  0,      /* xRollback */
+  0,      /* xFindFunction */
+  0,      /* xRename */
+  0,      /* xSavepoint */
+  0,      /* xRelease */
+  0,      /* xRollbackTo */
+  0       /* xShadowName */
+};
+
+/* SELECT * FROM clips_all_facts; */
+
+struct alfVtb {
+  sqlite3_vtab v;
+  struct clpCtx *x;
+};
+
+static int
+alfCon(
+  sqlite3 *db
+ ,void *cx
+ ,int ac
+ ,const char *const *av
+ ,sqlite3_vtab **vt
+ ,char **er
+){
+  struct alfVtb *v;
+  int i;
+
+  if ((i = sqlite3_declare_vtab(db, "CREATE TABLE \"x\"(\"fact\" INTEGER,\"relation\" TEXT,\"arity\" INTEGER,\"fields\" TEXT)")))
+    return (i);
+  if (!(v = sqlite3_malloc(sizeof (*v))))
+    return (SQLITE_NOMEM);
+  memset(&v->v, 0, sizeof (v->v));
+  v->x = cx;
+  *vt = &v->v;
+  return (SQLITE_OK);
+  (void)ac;
+  (void)av;
+  (void)er;
+}
+
+static int
+alfDis(
+  sqlite3_vtab *vt
+){
+  sqlite3_free(vt);
+  return (SQLITE_OK);
+}
+
+struct alfCsr {
+  sqlite3_vtab_cursor c;
+  Deftemplate *t; /* relation, 0 all */
+  Fact *f;        /* retained */
+  char o;         /* one fact by its index */
+};
+
+static int
+alfOpn(
+  sqlite3_vtab *vt
+ ,sqlite3_vtab_cursor **vc
+){
+  struct alfCsr *c;
+
+  if (!(c = sqlite3_malloc(sizeof (*c))))
+    return (SQLITE_NOMEM);
+  memset(c, 0, sizeof (*c));
+  *vc = &c->c;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+static int
+alfCls(
+  sqlite3_vtab_cursor *vc
+){
+  if (((struct alfCsr *)vc)->f)
+    ReleaseFact(((struct alfCsr *)vc)->f);
+  sqlite3_free(vc);
+  return (SQLITE_OK);
+}
+
+/* relation = reads the facts of its (implied) deftemplate, fact = (or rowid =) one fact */
+static int
+alfBst(
+  sqlite3_vtab *vt
+ ,sqlite3_index_info *ii
+){
+  int c[2];
+  int i;
+  int n;
+
+  for (c[0] = c[1] = -1, i = 0; i < ii->nConstraint; ++i)
+    if ((ii->aConstraint + i)->usable
+     && (ii->aConstraint + i)->op == SQLITE_INDEX_CONSTRAINT_EQ
+     && (ii->aConstraint + i)->iColumn <= 1)
+      c[(ii->aConstraint + i)->iColumn == 1] = i;
+  n = 0;
+  ii->idxNum = 0;
+  ii->estimatedCost = 100000.0;
+  ii->estimatedRows = 100000;
+  if (c[1] >= 0) {
+    (ii->aConstraintUsage + c[1])->argvIndex = ++n;
+    (ii->aConstraintUsage + c[1])->omit = 1;
+    ii->idxNum |= 1;
+    ii->estimatedCost = 1000.0;
+    ii->estimatedRows = 1000;
+  }
+  if (c[0] >= 0) {
+    (ii->aConstraintUsage + c[0])->argvIndex = ++n;
+    (ii->aConstraintUsage + c[0])->omit = 1;
+    ii->idxNum |= 2;
+    ii->estimatedCost = 10.0;
+    ii->estimatedRows = 1;
+    ii->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+  }
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+/* move to fact f, retaining it */
+static void
+alfMov(
+  struct alfCsr *c
+ ,Fact *f
+){
+  if (c->f)
+    ReleaseFact(c->f);
+  if ((c->f = f))
+    RetainFact(f);
+}
+
+static int
+alfFlt(
+  sqlite3_vtab_cursor *vc
+ ,int in
+ ,const char *is
+ ,int ac
+ ,sqlite3_value **av
+){
+#define V ((struct alfCsr *)vc)
+  Environment *e;
+  const char *n;
+  Fact *f;
+
+  e = ((struct alfVtb *)V->c.pVtab)->x->e;
+  V->t = 0;
+  V->o = 0;
+  if (in & 1) {
+    if (!(n = (const char *)sqlite3_value_text(*av)) || !(V->t = FindDeftemplate(e, n))) {
+      alfMov(V, 0);
+      return (SQLITE_OK);
+    }
+    ++av;
+  }
+  if (in & 2) {
+    V->o = 1;
+    if (sqlite3_value_type(*av) != SQLITE_INTEGER
+     || ((f = FindIndexedFact(e, sqlite3_value_int64(*av))) && V->t && f->whichDeftemplate != V->t))
+      f = 0;
+  } else if (V->t)
+    f = GetNextFactInTemplate(V->t, 0);
+  else
+    f = GetNextFact(e, 0);
+  alfMov(V, f);
+  return (SQLITE_OK);
+  (void)is;
+  (void)ac;
+#undef V
+}
+
+static int
+alfNxt(
+  sqlite3_vtab_cursor *vc
+){
+#define V ((struct alfCsr *)vc)
+  if (V->o)
+    alfMov(V, 0);
+  else if (V->t)
+    alfMov(V, GetNextFactInTemplate(V->t, V->f));
+  else
+    alfMov(V, GetNextFact(((struct alfVtb *)V->c.pVtab)->x->e, V->f));
+  return (SQLITE_OK);
+#undef V
+}
+
+static int
+alfEof(
+  sqlite3_vtab_cursor *vc
+){
+  return (!((struct alfCsr *)vc)->f);
+}
+
+static int
+alfRid(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_int64 *id
+){
+  *id = FactIndex(((struct alfCsr *)vc)->f);
+  return (SQLITE_OK);
+}
+
+/* append the CLIPS text of a field, fields of a multifield separated by a space,
+** nonzero if the text doesn't read back as the field (an address or an instance name) */
+static int
+clpTxt(
+  sqlite3_str *s
+ ,CLIPSValue *v
+){
+  const char *p;
+  size_t i;
+  int r;
+
+  r = 0;
+  switch (v->header->type) {
+  case SYMBOL_TYPE:
+    sqlite3_str_appendall(s, v->lexemeValue->contents);
+    break;
+  case STRING_TYPE:
+    sqlite3_str_appendchar(s, 1, '"');
+    for (p = v->lexemeValue->contents; *p; ++p) {
+      if (*p == '"' || *p == '\\')
+        sqlite3_str_appendchar(s, 1, '\\');
+      sqlite3_str_appendchar(s, 1, *p);
+    }
+    sqlite3_str_appendchar(s, 1, '"');
+    break;
+  case INSTANCE_NAME_TYPE:
+    sqlite3_str_appendf(s, "[%s]", v->lexemeValue->contents);
+    r = 1;
+    break;
+  case INTEGER_TYPE:
+    sqlite3_str_appendf(s, "%lld", v->integerValue->contents);
+    break;
+  case FLOAT_TYPE:
+    sqlite3_str_appendf(s, "%!.17g", v->floatValue->contents);
+    break;
+  case FACT_ADDRESS_TYPE:
+    sqlite3_str_appendf(s, "<Fact-%lld>", FactIndex(v->factValue));
+    r = 1;
+    break;
+  case MULTIFIELD_TYPE:
+    for (i = 0; i < v->multifieldValue->length; ++i) {
+      if (i)
+        sqlite3_str_appendchar(s, 1, ' ');
+      r |= clpTxt(s, v->multifieldValue->contents + i);
+    }
+    break;
+  default:
+    sqlite3_str_appendf(s, "<Pointer-%p>", (void *)v->header);
+    r = 1;
+    break;
+  }
+  return (r);
+}
+
+static int
+alfClm(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_context *sc
+ ,int cn
+){
+#define V ((struct alfCsr *)vc)
+  struct templateSlot *t;
+  sqlite3_str *s;
+  unsigned int i;
+  int n;
+
+  switch (cn) {
+  case 0: /* fact */
+    sqlite3_result_int64(sc, FactIndex(V->f));
+    break;
+  case 1: /* relation */
+    sqlite3_result_text(sc, DeftemplateName(V->f->whichDeftemplate), -1, SQLITE_TRANSIENT);
+    break;
+  case 2: /* arity, the fields of an ordered fact or the slots */
+    if (V->f->whichDeftemplate->implied)
+      sqlite3_result_int64(sc, V->f->theProposition.contents->multifieldValue->length);
+    else
+      sqlite3_result_int64(sc, V->f->whichDeftemplate->numberOfSlots);
+    break;
+  case 3: /* fields, CLIPS text of the ordered fields or (slot value...) of each slot */
+    if (!(s = sqlite3_str_new(0))) {
+      sqlite3_result_error_nomem(sc);
+      break;
+    }
+    if (V->f->whichDeftemplate->implied)
+      clpTxt(s, V->f->theProposition.contents);
+    else
+      for (i = 0, t = V->f->whichDeftemplate->slotList; t; t = t->next, ++i) {
+        sqlite3_str_appendf(s, "%s(%s", i ? " " : "", t->slotName->contents);
+        if (!t->multislot || (V->f->theProposition.contents + i)->multifieldValue->length)
+          sqlite3_str_appendchar(s, 1, ' ');
+        clpTxt(s, V->f->theProposition.contents + i);
+        sqlite3_str_appendchar(s, 1, ')');
+      }
+    if ((n = sqlite3_str_errcode(s))) {
+      sqlite3_free(sqlite3_str_finish(s));
+      sqlite3_result_error_code(sc, n);
+    } else {
+      n = sqlite3_str_length(s);
+      sqlite3_result_text(sc, sqlite3_str_finish(s), n, sqlite3_free);
+    }
+    break;
+  default:
+    break;
+  }
+  return (SQLITE_OK);
+#undef V
+}
+
+static sqlite3_module alfMod = {
+  0,      /* iVersion */
+  0,      /* xCreate */
+  alfCon, /* xConnect */
+  alfBst, /* xBestIndex */
+  alfDis, /* xDisconnect */
+  0,      /* xDestroy */
+  alfOpn, /* xOpen */
+  alfCls, /* xClose */
+  alfFlt, /* xFilter */
+  alfNxt, /* xNext */
+  alfEof, /* xEof */
+  alfClm, /* xColumn */
+  alfRid, /* xRowid */
+  0,      /* xUpdate */
+  0,      /* xBegin */
+  0,      /* xSync */
+  0,      /* xCommit */
+  0,      /* xRollback */
+  0,      /* xFindFunction */
+  0,      /* xRename */
+  0,      /* xSavepoint */
+  0,      /* xRelease */
+  0,      /* xRollbackTo */
+  0       /* xShadowName */
+};
+
+/* SELECT clips_snapshot_save('path'); SELECT clips_snapshot_load('path'); */
+
+/*
+** native byte order, 8 byte aligned:
+** header, then per template: block, name, words (NUL terminated), then per slot:
+** column, name, values, NULL bitmap, CLIPS types when the slot allows more than one
+*/
+struct clpSnh {
+  char m[8];      /* "SQLCLIPS" */
+  unsigned int v; /* version */
+  unsigned int o; /* 0x01020304 */
+  unsigned int b; /* blocks */
+  unsigned int p;
+};
+#define CLP_SNV 1
+
+struct clpSnb {
+  sqlite3_uint64 r; /* rows */
+  sqlite3_uint64 w; /* bytes of words */
+  unsigned int m; /* words */
+  unsigned int c; /* columns */
+  unsigned int l; /* bytes of name */
+  unsigned int p;
+};
+
+struct clpSnc {
+  unsigned int l; /* bytes of name */
+  unsigned int t; /* enum st */
+};
+
+/* pad n bytes to 8, nonzero on error */
+static int
+clpSpd(
+  FILE *f
+ ,sqlite3_uint64 n
+){
+  static const char z[8];
+
+  return (n % 8 && fwrite(z, 8 - n % 8, 1, f) != 1);
+}
+
+/* write n bytes padded to 8, nonzero on error */
+static int
+clpSwr(
+  FILE *f
+ ,const void *p
+ ,sqlite3_uint64 n
+){
+  return ((n && fwrite(p, n, 1, f) != 1) || clpSpd(f, n));
+}
+
+#define CLP_SPD(n) (((n) + 7) & ~(sqlite3_uint64)7)
+
+/* CLIPS text of a multifield, 0 with *e SQLITE_NOMEM or SQLITE_MISMATCH for a value text can't restore */
+static char *
+clpImp(
+  Multifield *m
+ ,int *e
+){
+  sqlite3_str *s;
+  size_t i;
+  int r;
+
+  *e = SQLITE_NOMEM;
+  if (!(s = sqlite3_str_new(0)))
+    return (0);
+  for (r = 0, i = 0; !r && i < m->length; ++i) {
+    if (i)
+      sqlite3_str_appendchar(s, 1, ' ');
+    r = clpTxt(s, m->contents + i);
+  }
+  if (r) { /* fact or instance address, instance name, external address */
+    sqlite3_free(sqlite3_str_finish(s));
+    *e = SQLITE_MISMATCH;
+    return (0);
+  }
+  return (sqlite3_str_finish(s));
+}
+
+/* write the facts of a table's template, multislots as CLIPS text */
+static int
+clpSbk(
+  FILE *o
+ ,struct clpVtb *v
+){
+  struct clpCol *h;
+  struct clpSnb b;
+  struct clpSnc c;
+  const char *n;
+  Fact *f;
+  char *s;
+  sqlite3_uint64 j;
+  unsigned int k;
+  long d;
+  int i;
+
+  if (!(h = clpCnw(v)))
+    return (SQLITE_NOMEM);
+  for (k = 0; k < v->n; ++k)
+    if ((v->s + k)->t & stMulti)
+      for (f = 0, j = 0; j < h->n && (f = GetNextFactInTemplate(v->t, f)); ++j) {
+        if (!(s = clpImp((f->theProposition.contents + (v->s + k)->p)->multifieldValue, &i))
+         || (d = clpCid(h, s)) < 0) {
+          if (s)
+            i = SQLITE_NOMEM;
+          sqlite3_free(s);
+          clpCfr(h, v->n);
+          return (i);
+        }
+        sqlite3_free(s);
+        ((h->c + k)->v + j)->d = (unsigned int)d;
+      }
+  n = DeftemplateName(v->t);
+  memset(&b, 0, sizeof (b));
+  b.r = h->n;
+  b.m = h->m;
+  b.c = v->n;
+  b.l = strlen(n) + 1;
+  for (b.w = 0, k = 0; k < h->m; ++k)
+    b.w += strlen(*(h->w + k)) + 1;
+  i = clpSwr(o, &b, sizeof (b)) || clpSwr(o, n, b.l);
+  for (k = 0; !i && k < h->m; ++k)
+    i = fwrite(*(h->w + k), strlen(*(h->w + k)) + 1, 1, o) != 1;
+  if (!i)
+    i = clpSpd(o, b.w);
+  for (k = 0; !i && k < v->n; ++k) {
+    c.l = strlen((v->s + k)->n) + 1;
+    c.t = (v->s + k)->t;
+    i = clpSwr(o, &c, sizeof (c))
+     || clpSwr(o, (v->s + k)->n, c.l)
+     || clpSwr(o, (h->c + k)->v, h->n * sizeof (*(h->c + k)->v))
+     || clpSwr(o, (h->c + k)->z, (h->n + 7) / 8)
+     || ((h->c + k)->t && clpSwr(o, (h->c + k)->t, h->n));
+  }
+  clpCfr(h, v->n);
+  return (i ? SQLITE_IOERR : SQLITE_OK);
+}
+
+static void
+clpSsv(
+  sqlite3_context *sc
+ ,int ac
+ ,sqlite3_value **av
+){
+  struct clpCtx *x;
+  struct clpVtb *v;
+  struct clpVtb *w;
+  struct clpSnh h;
+  const char *p;
+  FILE *o;
+  int i;
+
+  (void)ac;
+  x = sqlite3_user_data(sc);
+  if (!(p = (const char *)sqlite3_value_text(*(av + 0)))) {
+    sqlite3_result_error(sc, "clips_snapshot_save: NULL path", -1);
+    return;
+  }
+  if (!(o = fopen(p, "wb"))) {
+    sqlite3_result_error(sc, "clips_snapshot_save: can't open", -1);
+    return;
+  }
+  memset(&h, 0, sizeof (h));
+  memcpy(h.m, "SQLCLIPS", sizeof (h.m));
+  h.v = CLP_SNV;
+  h.o = 0x01020304;
+  for (v = x->v; v; v = v->l) { /* each template once */
+    for (w = x->v; w != v && w->t != v->t; w = w->l);
+    h.b += w == v;
+  }
+  i = clpSwr(o, &h, sizeof (h)) ? SQLITE_IOERR : SQLITE_OK;
+  for (v = x->v; !i && v; v = v->l) {
+    for (w = x->v; w != v && w->t != v->t; w = w->l);
+    if (w == v)
+      i = clpSbk(o, v);
+  }
+  if (fclose(o) && !i)
+    i = SQLITE_IOERR;
+  if (i) /* no partial snapshot */
+    remove(p);
+  if (i == SQLITE_NOMEM)
+    sqlite3_result_error_nomem(sc);
+  else if (i == SQLITE_MISMATCH)
+    sqlite3_result_error(sc, "clips_snapshot_save: a multislot holds a fact, instance or external address or an instance name", -1);
+  else if (i)
+    sqlite3_result_error(sc, "clips_snapshot_save: write", -1);
+  else
+    sqlite3_result_int(sc, h.b);
+}
+
+struct clpSla {   /* facts of a load */
+  Fact **f;       /* asserted, retained */
+  sqlite3_int64 n; /* asserted, duplicates included */
+  sqlite3_int64 m; /* number of f */
+  sqlite3_int64 y; /* allocated f */
+  long long j;    /* last fact index before the load */
+};
+
+/* assert the rows of a block, return its end else 0 */
+static const char *
+clpSlb(
+  Environment *e
+ ,const char *p
+ ,const char *z
+ ,struct clpSla *a
+ ,const char **er
+){
+  const struct clpSnb *b;
+  const struct clpSnc *c;
+  const char **w;
+  const char *q;
+  FactBuilder *f;
+  Fact *g;
+  sqlite3_uint64 r;
+  unsigned int k;
+  int o;
+  struct {
+    const struct clpSnc *c;
+    const char *n;
+    const sqlite3_int64 *v;
+    const unsigned char *u;
+    const char *t;
+  } *s;
+
+  if ((size_t)(z - p) < sizeof (*b)) {
+    *er = "truncated";
+    return (0);
+  }
+  b = (const struct clpSnb *)p;
+  p += sizeof (*b);
+  if (b->r > (sqlite3_uint64)(z - p) / 8 || b->w > (sqlite3_uint64)(z - p)
+   || (sqlite3_uint64)(z - p) < CLP_SPD(b->l) + CLP_SPD(b->w)) {
+    *er = "truncated";
+    return (0);
+  }
+  if (!b->l || *(p + b->l - 1)) {
+    *er = "bad name";
+    return (0);
+  }
+  if (!(f = CreateFactBuilder(e, p))) {
+    *er = "template not found";
+    return (0);
+  }
+  p += CLP_SPD(b->l);
+  if (!(w = sqlite3_malloc64((b->m ? b->m : 1) * sizeof (*w)))
+   || !(s = sqlite3_malloc64((b->c ? b->c : 1) * sizeof (*s)))) {
+    sqlite3_free(w);
+    FBDispose(f);
+    *er = 0;
+    return (0);
+  }
+  for (q = p, k = 0; k < b->m; ++k, q += strlen(q) + 1) /* words are read in place */
+    if (q >= p + b->w || !memchr(q, '\0', p + b->w - q))
+      break;
+    else
+      *(w + k) = q;
+  p += CLP_SPD(b->w);
+  if (k < b->m)
+    *er = "bad words";
+  for (k = 0; !*er && k < b->c; ++k) {
+    c = (const struct clpSnc *)p;
+    if ((size_t)(z - p) < sizeof (*c)
+     || (sqlite3_uint64)(z - p - sizeof (*c)) < CLP_SPD(c->l) + 8 * b->r + CLP_SPD((b->r + 7) / 8) + (clpCty(c->t) < 0 ? CLP_SPD(b->r) : 0)) {
+      *er = "truncated";
+      break;
+    }
+    if (!c->l || *(p + sizeof (*c) + c->l - 1)) {
+      *er = "bad name";
+      break;
+    }
+    (s + k)->c = c;
+    (s + k)->n = p + sizeof (*c);
+    p += sizeof (*c) + CLP_SPD(c->l);
+    (s + k)->v = (const sqlite3_int64 *)p;
+    p += 8 * b->r;
+    (s + k)->u = (const unsigned char *)p;
+    p += CLP_SPD((b->r + 7) / 8);
+    (s + k)->t = 0;
+    if (clpCty(c->t) < 0) {
+      (s + k)->t = p;
+      p += CLP_SPD(b->r);
+    }
+  }
+  for (o = 0, r = 0; !o && !*er && r < b->r; ++r) {
+    for (k = 0; !*er && k < b->c; ++k) {
+      const sqlite3_int64 *v;
+      int t;
+      int i;
+
+      v = (s + k)->v + r;
+      if (*((s + k)->u + r / 8) & 1 << (r % 8)) {
+        i = (s + k)->c->t & stSymbol ? FBPutSlotSymbol(f, (s + k)->n, "nil") : 0;
+        t = -1;
+      } else if ((s + k)->c->t & stMulti)
+        t = MULTIFIELD_TYPE;
+      else
+        t = (s + k)->t ? *((s + k)->t + r) : clpCty((s + k)->c->t);
+      switch (t) {
+      case -1:
+        break;
+      case INTEGER_TYPE:
+        i = FBPutSlotInteger(f, (s + k)->n, *v);
+        break;
+      case FLOAT_TYPE:
+        i = FBPutSlotFloat(f, (s + k)->n, *(const double *)v);
+        break;
+      case SYMBOL_TYPE:
+      case STRING_TYPE:
+      case MULTIFIELD_TYPE:
+        if (*(const unsigned int *)v >= b->m) {
+          *er = "bad word";
+          continue;
+        }
+        if (t == SYMBOL_TYPE)
+          i = FBPutSlotSymbol(f, (s + k)->n, *(w + *(const unsigned int *)v));
+        else if (t == STRING_TYPE)
+          i = FBPutSlotString(f, (s + k)->n, *(w + *(const unsigned int *)v));
+        else {
+          Multifield *m;
+
+          i = !(m = StringToMultifield(e, *(w + *(const unsigned int *)v)))
+           || FBPutSlotMultifield(f, (s + k)->n, m);
+        }
+        break;
+      default:
+        i = 1;
+        break;
+      }
+      if (i)
+        *er = "slot value";
+    }
+    if (*er || !(g = FBAssert(f)))
+      continue;
+    ++a->n;
+    if (FactIndex(g) <= a->j) /* a duplicate of an older fact */
+      continue;
+    if (a->m == a->y) {
+      Fact **h;
+
+      if (!(h = sqlite3_realloc64(a->f, (a->y ? 2 * a->y : 64) * sizeof (*h)))) {
+        Retract(g);
+        o = 1;
+        continue;
+      }
+      a->f = h;
+      a->y = a->y ? 2 * a->y : 64;
+    }
+    RetainFact(g);
+    *(a->f + a->m++) = g;
+  }
+  sqlite3_free(s);
+  sqlite3_free(w);
+  FBDispose(f);
+  return (o || *er ? 0 : p);
+}
+
+static void
+clpSld(
+  sqlite3_context *sc
+ ,int ac
+ ,sqlite3_value **av
+){
+  struct clpCtx *x;
+  const struct clpSnh *h;
+  const char *er;
+  const char *p;
+  const char *z;
+  struct clpSla a;
+  struct stat t;
+  Fact *f;
+  sqlite3_int64 i;
+  unsigned int b;
+  void *m;
+  int d;
+
+  (void)ac;
+  x = sqlite3_user_data(sc);
+  if (!(p = (const char *)sqlite3_value_text(*(av + 0)))) {
+    sqlite3_result_error(sc, "clips_snapshot_load: NULL path", -1);
+    return;
+  }
+  if ((d = open(p, O_RDONLY)) < 0) {
+    sqlite3_result_error(sc, "clips_snapshot_load: can't open", -1);
+    return;
+  }
+  if (fstat(d, &t) || (size_t)t.st_size < sizeof (*h)
+   || (m = mmap(0, t.st_size, PROT_READ, MAP_PRIVATE, d, 0)) == MAP_FAILED) {
+    close(d);
+    sqlite3_result_error(sc, "clips_snapshot_load: can't map", -1);
+    return;
+  }
+  close(d);
+  posix_madvise(m, t.st_size, POSIX_MADV_SEQUENTIAL);
+  h = m;
+  z = (const char *)m + t.st_size;
+  er = 0;
+  if (memcmp(h->m, "SQLCLIPS", sizeof (h->m)) || h->o != 0x01020304)
+    er = "not a snapshot of this byte order";
+  else if (h->v != CLP_SNV)
+    er = "version";
+  memset(&a, 0, sizeof (a));
+  for (f = 0; (f = GetNextFact(x->e, f)); a.j = FactIndex(f));
+  for (p = (const char *)(h + 1), b = 0, d = 0; !d && !er && b < h->b; ++b)
+    d = !(p = clpSlb(x->e, p, z, &a, &er)) && !er;
+  munmap(m, t.st_size);
+  for (i = 0; i < a.m; ++i) { /* a failed load retracts what it asserted */
+    if (d || er)
+      Retract(*(a.f + i));
+    ReleaseFact(*(a.f + i));
+  }
+  sqlite3_free(a.f);
+  if (d)
+    sqlite3_result_error_nomem(sc);
+  else if (er) {
+    char e[64];
+
+    sqlite3_snprintf(sizeof (e), e, "clips_snapshot_load: %s", er);
+    sqlite3_result_error(sc, e, -1);
+  } else
+    sqlite3_result_int64(sc, a.n);
+}
+
+/* SELECT * FROM clips_tables; */
+
+/* bytes allocated by a table */
+static sqlite3_int64
+clpVms(
+  struct clpVtb *v
+){
+  sqlite3_int64 z;
+  unsigned int i;
+
+  z = sqlite3_msize(v) + sqlite3_msize(v->m) + sqlite3_msize(v->h) + sqlite3_msize(v->s);
+  for (i = 0; i < v->n; ++i) {
+    z += sqlite3_msize((v->s + i)->n) + sqlite3_msize((v->s + i)->a) + sqlite3_msize((v->s + i)->l);
+    if ((v->s + i)->x)
+      z += sqlite3_msize((v->s + i)->x) + sqlite3_msize((v->s + i)->x->f);
+  }
+  if (v->k) {
+    z += sqlite3_msize(v->k) + sqlite3_msize(v->k->r) + sqlite3_msize(v->k->c)
+       + sqlite3_msize(v->k->w) + sqlite3_msize(v->k->x);
+    for (i = 0; i < v->n; ++i)
+      z += sqlite3_msize((v->k->c + i)->v) + sqlite3_msize((v->k->c + i)->z) + sqlite3_msize((v->k->c + i)->t);
+    for (i = 0; i < v->k->m; ++i)
+      z += sqlite3_msize(*(v->k->w + i));
+  }
+  if (v->u)
+    z += sqlite3_msize(v->u) + sqlite3_msize(v->u->s) + sqlite3_msize(v->u->v) + sqlite3_msize(v->u->f);
+  if (v->r) {
+    z += sqlite3_msize(v->r) + sqlite3_msize(v->r->e);
+    for (i = 0; i < v->r->n; ++i)
+      z += sqlite3_msize((v->r->e + i)->k) + sqlite3_msize((v->r->e + i)->f);
+  }
+  if (v->w)
+    z += sqlite3_msize(v->w) + sqlite3_msize(v->w->h);
+  return (z);
+}
+
+/* estimated bytes CLIPS uses for a template's facts, symbols and strings are shared so not counted */
+static sqlite3_int64
+clpFms(
+  struct clpVtb *v
+){
+  sqlite3_int64 z;
+  Fact *f;
+  unsigned int i;
+
+  for (z = 0, f = 0; (f = GetNextFactInTemplate(v->t, f));) {
+    z += sizeof (*f) + (f->theProposition.length ? f->theProposition.length - 1 : 0) * sizeof (CLIPSValue);
+    for (i = 0; i < v->n; ++i)
+      if ((v->s + i)->t & stMulti)
+        z += sizeof (Multifield) + ((f->theProposition.contents + (v->s + i)->p)->multifieldValue->length
+         ? (f->theProposition.contents + (v->s + i)->p)->multifieldValue->length - 1 : 0) * sizeof (CLIPSValue);
+  }
+  return (z);
+}
+
+struct tblVtb {
+  sqlite3_vtab v;
+  struct clpCtx *x;
+};
+
+static int
+tblCon(
+  sqlite3 *db
+ ,void *cx
+ ,int ac
+ ,const char *const *av
+ ,sqlite3_vtab **vt
+ ,char **er
+){
+  struct tblVtb *v;
+  int i;
+
+  if ((i = sqlite3_declare_vtab(db, "CREATE TABLE \"x\"(\"table\" TEXT,\"template\" TEXT,\"facts\" INTEGER,\"hits\" INTEGER,\"misses\" INTEGER,\"memory\" INTEGER,\"cursor_memory\" INTEGER,\"cursor_peak\" INTEGER,\"fact_memory\" INTEGER,\"clips_memory\" INTEGER,\"budget\" INTEGER,\"modifies\" INTEGER,\"unchanged\" INTEGER,\"slots_unchanged\" INTEGER)")))
+    return (i);
+  if (!(v = sqlite3_malloc(sizeof (*v))))
+    return (SQLITE_NOMEM);
+  memset(&v->v, 0, sizeof (v->v));
+  v->x = cx;
+  *vt = &v->v;
+  return (SQLITE_OK);
+  (void)ac;
+  (void)av;
+  (void)er;
+}
+
+static int
+tblDis(
+  sqlite3_vtab *vt
+){
+  sqlite3_free(vt);
+  return (SQLITE_OK);
+}
+
+struct tblCsr {
+  sqlite3_vtab_cursor c;
+  struct clpVtb *t;
+  sqlite3_int64 r;
+};
+
+static int
+tblOpn(
+  sqlite3_vtab *vt
+ ,sqlite3_vtab_cursor **vc
+){
+  struct tblCsr *c;
+
+  if (!(c = sqlite3_malloc(sizeof (*c))))
+    return (SQLITE_NOMEM);
+  c->t = 0;
+  c->r = 0;
+  *vc = &c->c;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+static int
+tblCls(
+  sqlite3_vtab_cursor *vc
+){
+  sqlite3_free(vc);
+  return (SQLITE_OK);
+}
+
+static int
+tblBst(
+  sqlite3_vtab *vt
+ ,sqlite3_index_info *ii
+){
+  ii->estimatedCost = 10.0;
+  ii->estimatedRows = 10;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+static int
+tblFlt(
+  sqlite3_vtab_cursor *vc
+ ,int in
+ ,const char *is
+ ,int ac
+ ,sqlite3_value **av
+){
+#define V ((struct tblCsr *)vc)
+  V->t = ((struct tblVtb *)V->c.pVtab)->x->v;
+  V->r = 1;
+  return (SQLITE_OK);
+  (void)in;
+  (void)is;
+  (void)ac;
+  (void)av;
+#undef V
+}
+
+static int
+tblNxt(
+  sqlite3_vtab_cursor *vc
+){
+  ((struct tblCsr *)vc)->t = ((struct tblCsr *)vc)->t->l;
+  ++((struct tblCsr *)vc)->r;
+  return (SQLITE_OK);
+}
+
+static int
+tblEof(
+  sqlite3_vtab_cursor *vc
+){
+  return (!((struct tblCsr *)vc)->t);
+}
+
+static int
+tblRid(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_int64 *id
+){
+  *id = ((struct tblCsr *)vc)->r;
+  return (SQLITE_OK);
+}
+
+static int
+tblClm(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_context *sc
+ ,int cn
+){
+#define V ((struct tblCsr *)vc)
+  switch (cn) {
+  case 0: /* table */
+    sqlite3_result_text(sc, V->t->m, -1, SQLITE_TRANSIENT);
+    break;
+  case 1: /* template */
+    sqlite3_result_text(sc, DeftemplateName(V->t->t), -1, SQLITE_TRANSIENT);
+    break;
+  case 2: /* facts */
+    sqlite3_result_int64(sc, V->t->c);
+    break;
+  case 3: /* hits */
+    if (V->t->r)
+      sqlite3_result_int64(sc, V->t->r->h);
+    break;
+  case 4: /* misses */
+    if (V->t->r)
+      sqlite3_result_int64(sc, V->t->r->m);
+    break;
+  case 5: /* memory */
+    sqlite3_result_int64(sc, clpVms(V->t));
+    break;
+  case 6: /* cursor_memory */
+    sqlite3_result_int64(sc, V->t->o);
+    break;
+  case 7: /* cursor_peak */
+    sqlite3_result_int64(sc, V->t->p);
+    break;
+  case 8: /* fact_memory */
+    sqlite3_result_int64(sc, clpFms(V->t));
+    break;
+  case 9: /* clips_memory */
+    sqlite3_result_int64(sc, MemUsed(V->t->e));
+    break;
+  case 10: /* budget */
+    if (V->t->b)
+      sqlite3_result_int64(sc, V->t->b);
+    break;
+  case 11: /* modifies */
+    sqlite3_result_int64(sc, V->t->i);
+    break;
+  case 12: /* unchanged */
+    sqlite3_result_int64(sc, V->t->q);
+    break;
+  case 13: /* slots_unchanged */
+    sqlite3_result_int64(sc, V->t->a);
+    break;
+  default:
+    break;
+  }
+  return (SQLITE_OK);
+#undef V
+}
+
+static sqlite3_module tblMod = {
+  0,      /* iVersion */
+  0,      /* xCreate */
+  tblCon, /* xConnect */
+  tblBst, /* xBestIndex */
+  tblDis, /* xDisconnect */
+  0,      /* xDestroy */
+  tblOpn, /* xOpen */
+  tblCls, /* xClose */
+  tblFlt, /* xFilter */
+  tblNxt, /* xNext */
+  tblEof, /* xEof */
+  tblClm, /* xColumn */
+  tblRid, /* xRowid */
+  0,      /* xUpdate */
+  0,      /* xBegin */
+  0,      /* xSync */
+  0,      /* xCommit */
+  0,      /* xRollback */
+  0,      /* xFindFunction */
+  0,      /* xRename */
+  0,      /* xSavepoint */
+  0,      /* xRelease */
+  0,      /* xRollbackTo */
+  0       /* xShadowName */
+};
+
+/* SELECT * FROM clips_indexes; */
+
+struct idxVtb {
+  sqlite3_vtab v;
+  struct clpCtx *x;
+};
+
+static int
+idxCon(
+  sqlite3 *db
+ ,void *cx
+ ,int ac
+ ,const char *const *av
+ ,sqlite3_vtab **vt
+ ,char **er
+){
+  struct idxVtb *v;
+  int i;
+
+  if ((i = sqlite3_declare_vtab(db, "CREATE TABLE \"x\"(\"table\" TEXT,\"slot\" TEXT,\"filters\" INTEGER,\"visited\" INTEGER,\"entries\" INTEGER,\"memory\" INTEGER,\"uses\" INTEGER,\"decision\" TEXT)")))
+    return (i);
+  if (!(v = sqlite3_malloc(sizeof (*v))))
+    return (SQLITE_NOMEM);
+  memset(&v->v, 0, sizeof (v->v));
+  v->x = cx;
+  *vt = &v->v;
+  return (SQLITE_OK);
+  (void)ac;
+  (void)av;
+  (void)er;
+}
+
+static int
+idxDis(
+  sqlite3_vtab *vt
+){
+  sqlite3_free(vt);
+  return (SQLITE_OK);
+}
+
+struct idxCsr {
+  sqlite3_vtab_cursor c;
+  struct clpVtb *t;
+  unsigned int k;   /* slot of t */
+  sqlite3_int64 r;
+};
+
+static int
+idxOpn(
+  sqlite3_vtab *vt
+ ,sqlite3_vtab_cursor **vc
+){
+  struct idxCsr *c;
+
+  if (!(c = sqlite3_malloc(sizeof (*c))))
+    return (SQLITE_NOMEM);
+  c->t = 0;
+  c->k = 0;
+  c->r = 0;
+  *vc = &c->c;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+static int
+idxCls(
+  sqlite3_vtab_cursor *vc
+){
+  sqlite3_free(vc);
+  return (SQLITE_OK);
+}
+
+static int
+idxBst(
+  sqlite3_vtab *vt
+ ,sqlite3_index_info *ii
+){
+  ii->estimatedCost = 10.0;
+  ii->estimatedRows = 10;
+  return (SQLITE_OK);
+  (void)vt;
+}
+
+/* from slot k of table t to the next slot with = filters or an index */
+static void
+idxAdv(
+  struct idxCsr *c
+){
+  for (; c->t; c->t = c->t->l, c->k = 0)
+    for (; c->k < c->t->n; ++c->k)
+      if ((c->t->s + c->k)->q || (c->t->s + c->k)->x || (c->t->s + c->k)->l)
+        return;
+}
+
+static int
+idxFlt(
+  sqlite3_vtab_cursor *vc
+ ,int in
+ ,const char *is
+ ,int ac
+ ,sqlite3_value **av
+){
+#define V ((struct idxCsr *)vc)
+  V->t = ((struct idxVtb *)V->c.pVtab)->x->v;
+  V->k = 0;
+  V->r = 1;
+  idxAdv(V);
+  return (SQLITE_OK);
+  (void)in;
+  (void)is;
+  (void)ac;
+  (void)av;
+#undef V
+}
+
+static int
+idxNxt(
+  sqlite3_vtab_cursor *vc
+){
+  ++((struct idxCsr *)vc)->k;
+  ++((struct idxCsr *)vc)->r;
+  idxAdv((struct idxCsr *)vc);
+  return (SQLITE_OK);
+}
+
+static int
+idxEof(
+  sqlite3_vtab_cursor *vc
+){
+  return (!((struct idxCsr *)vc)->t);
+}
+
+static int
+idxRid(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_int64 *id
+){
+  *id = ((struct idxCsr *)vc)->r;
+  return (SQLITE_OK);
+}
+
+static int
+idxClm(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_context *sc
+ ,int cn
+){
+#define V ((struct idxCsr *)vc)
+  switch (cn) {
+  case 0: /* table */
+    sqlite3_result_text(sc, V->t->m, -1, SQLITE_TRANSIENT);
+    break;
+  case 1: /* slot */
+    sqlite3_result_text(sc, (V->t->s + V->k)->n, -1, SQLITE_TRANSIENT);
+    break;
+  case 2: /* filters */
+    sqlite3_result_int64(sc, (V->t->s + V->k)->q);
+    break;
+  case 3: /* visited */
+    sqlite3_result_int64(sc, (V->t->s + V->k)->f);
+    break;
+  case 4: /* entries */
+    if ((V->t->s + V->k)->x)
+      sqlite3_result_int64(sc, (V->t->s + V->k)->x->n);
+    break;
+  case 5: /* memory */
+    if ((V->t->s + V->k)->x)
+      sqlite3_result_int64(sc, sqlite3_msize((V->t->s + V->k)->x) + sqlite3_msize((V->t->s + V->k)->x->f));
+    break;
+  case 6: /* uses */
+    if ((V->t->s + V->k)->x)
+      sqlite3_result_int64(sc, (V->t->s + V->k)->x->u);
+    break;
+  case 7: /* decision */
+    if ((V->t->s + V->k)->l)
+      sqlite3_result_text(sc, (V->t->s + V->k)->l, -1, SQLITE_TRANSIENT);
+    break;
+  default:
+    break;
+  }
   return (SQLITE_OK);
+#undef V
 }
 
+static sqlite3_module idxMod = {
+  0,      /* iVersion */
+  0,      /* xCreate */
+  idxCon, /* xConnect */
+  idxBst, /* xBestIndex */
+  idxDis, /* xDisconnect */
+  0,      /* xDestroy */
+  idxOpn, /* xOpen */
+  idxCls, /* xClose */
+  idxFlt, /* xFilter */
+  idxNxt, /* xNext */
+  idxEof, /* xEof */
+  idxClm, /* xColumn */
+  idxRid, /* xRowid */
+  0,      /* xUpdate */
+  0,      /* xBegin */
+  0,      /* xSync */
+  0,      /* xCommit */
+  0,      /* xRollback */
+  0,      /* xFindFunction */
+  0,      /* xRename */
+  0,      /* xSavepoint */
+  0,      /* xRelease */
+  0,      /* xRollbackTo */
+  0       /* xShadowName */
+};
+
+/* SELECT * FROM clips_symbols; */
+
+struct symVtb {
+  sqlite3_vtab v;
+  struct clpCtx *x;
+};
+
 static int
-clpCrt(
+symCon(
   sqlite3 *db
- ,void *ev
+ ,void *cx
  ,int ac
  ,const char *const *av
  ,sqlite3_vtab **vt
  ,char **er
 ){
-  return (clpCon(db, ev, ac, av, vt, er));
-}
+  struct symVtb *v;
+  int i;
 
-struct clpCsr {
-  sqlite3_vtab_cursor c;
-  struct clpVtb *t;
-  Fact *f;
-  Fact **a;
-  unsigned long n;
-  unsigned long o;
-};
+  if ((i = sqlite3_declare_vtab(db, "CREATE TABLE \"x\"(\"id\" INTEGER,\"symbol\" TEXT)")))
+    return (i);
+  if (!(v = sqlite3_malloc(sizeof (*v))))
+    return (SQLITE_NOMEM);
+  memset(&v->v, 0, sizeof (v->v));
+  v->x = cx;
+  *vt = &v->v;
+  return (SQLITE_OK);
+  (void)ac;
+  (void)av;
+  (void)er;
+}
 
 static int
-clpCls(
-  sqlite3_vtab_cursor *vc
+symDis(
+  sqlite3_vtab *vt
 ){
-#define V ((struct clpCsr *)vc)
-  if (!V->a) {
-    if (V->f)
-      ReleaseFact(V->f);
-  } else {
-    for (V->o = 0; V->o < V->n; ++V->o)
-      ReleaseFact(*(V->a + V->o));
-    sqlite3_free(V->a);
-  }
-  sqlite3_free(V);
+  sqlite3_free(vt);
   return (SQLITE_OK);
-#undef V
 }
 
+struct symCsr {
+  sqlite3_vtab_cursor c;
+  struct clpCtx *x;
+  unsigned int i;   /* id */
+  unsigned int n;   /* last id */
+};
+
 static int
-clpOpn(
+symOpn(
   sqlite3_vtab *vt
  ,sqlite3_vtab_cursor **vc
 ){
-#define V ((struct clpVtb *)vt)
-  struct clpCsr *c;
+  struct symCsr *c;
 
   if (!(c = sqlite3_malloc(sizeof (*c))))
     return (SQLITE_NOMEM);
-  c->t = V; 
-  c->f = 0;
-  c->a = 0;
-  c->n = c->o = 0;
+  c->x = ((struct symVtb *)vt)->x;
+  c->i = 1;
+  c->n = 0;
   *vc = &c->c;
   return (SQLITE_OK);
-#undef V
 }
 
 static int
-clpBst(
+symCls(
+  sqlite3_vtab_cursor *vc
+){
+  sqlite3_free(vc);
+  return (SQLITE_OK);
+}
+
+static int
+symBst(
   sqlite3_vtab *vt
  ,sqlite3_index_info *ii
 ){
-#define V ((struct clpVtb *)vt)
   int i;
-  char o;
 
-  for (i = 0; i < ii->nConstraint; ++i) {
-    if ((ii->aConstraint + i)->usable) {
-      switch ((ii->aConstraint + i)->op) {
-      case SQLITE_INDEX_CONSTRAINT_ISNULL:
-        o = 'n';
-        ii->estimatedCost /= 2;
-        break;
-      case SQLITE_INDEX_CONSTRAINT_ISNOTNULL:
-        o = 'N';
-        ii->estimatedCost /= 2;
-        break;
-      case SQLITE_INDEX_CONSTRAINT_IS:
-        o = 'i';
-        if ((ii->aConstraint + i)->iColumn < 0)
-          ii->estimatedCost /= 4;
-        else
-          ii->estimatedCost /= 5;
-        break;
-      case SQLITE_INDEX_CONSTRAINT_ISNOT:
-        o = 'I';
-        if ((ii->aConstraint + i)->iColumn < 0)
-          ii->estimatedCost /= 3;
-        else
-          ii->estimatedCost /= 4;
-        break;
-      case SQLITE_INDEX_CONSTRAINT_EQ:
-        o = 'e';
-        if ((ii->aConstraint + i)->iColumn < 0)
-          ii->estimatedCost /= 4;
-        else
-          ii->estimatedCost /= 5;
-        break;
-      case SQLITE_INDEX_CONSTRAINT_NE:
-        o = 'E';
-        if ((ii->aConstraint + i)->iColumn < 0)
-          ii->estimatedCost /= 3;
-        else
-          ii->estimatedCost /= 4;
-        break;
-      default:
-        continue;
-      }
-      if (!(ii->idxStr = sqlite3_mprintf("%z%c%d", ii->idxStr, o, (ii->aConstraint + i)->iColumn)))
-        return (SQLITE_NOMEM);
-      ++ii->idxNum;
-      (ii->aConstraintUsage + i)->argvIndex = ii->idxNum;
+  for (i = 0; i < ii->nConstraint; ++i)
+    if ((ii->aConstraint + i)->usable
+     && (ii->aConstraint + i)->op == SQLITE_INDEX_CONSTRAINT_EQ
+     && (ii->aConstraint + i)->iColumn <= 0) { /* id or ROWID */
+      (ii->aConstraintUsage + i)->argvIndex = 1;
       (ii->aConstraintUsage + i)->omit = 1;
-      if ((ii->aConstraint + i)->iColumn == -1)
-        ii->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+      ii->idxNum = 1;
+      ii->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+      ii->estimatedCost = 1.0;
+      ii->estimatedRows = 1;
+      return (SQLITE_OK);
     }
-  }
-  if (ii->idxNum)
-    ii->needToFreeIdxStr = 1;
+  ii->estimatedCost = 1000.0;
+  ii->estimatedRows = ((struct symVtb *)vt)->x->y.n;
   return (SQLITE_OK);
-  (void)vt;
-#undef V
 }
 
 static int
-clpFlt(
+symFlt(
   sqlite3_vtab_cursor *vc
  ,int in
  ,const char *is
  ,int ac
  ,sqlite3_value **av
 ){
-#define V ((struct clpCsr *)vc)
-  char *s;
-  CLIPSValue v;
-  unsigned long j;
-  int i;
+#define V ((struct symCsr *)vc)
+  sqlite3_int64 i;
+
+  V->i = 1;
+  V->n = V->x->y.n;
+  if (in) {
+    i = sqlite3_value_int64(*(av + 0));
+    if (sqlite3_value_numeric_type(*(av + 0)) != SQLITE_INTEGER || !clpSlx(V->x, i))
+      V->n = 0;
+    else
+      V->i = V->n = (unsigned int)i;
+  }
+  return (SQLITE_OK);
+  (void)is;
+  (void)ac;
+#undef V
+}
+
+static int
+symNxt(
+  sqlite3_vtab_cursor *vc
+){
+  ++((struct symCsr *)vc)->i;
+  return (SQLITE_OK);
+}
+
+static int
+symEof(
+  sqlite3_vtab_cursor *vc
+){
+  return (((struct symCsr *)vc)->i > ((struct symCsr *)vc)->n);
+}
+
+static int
+symRid(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_int64 *id
+){
+  *id = ((struct symCsr *)vc)->i;
+  return (SQLITE_OK);
+}
+
+static int
+symClm(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_context *sc
+ ,int cn
+){
+#define V ((struct symCsr *)vc)
+  switch (cn) {
+  case 0: /* id */
+    sqlite3_result_int64(sc, V->i);
+    break;
+  case 1: /* symbol */
+    sqlite3_result_text(sc, clpSlx(V->x, V->i)->contents, -1, SQLITE_TRANSIENT);
+    break;
+  default:
+    break;
+  }
+  return (SQLITE_OK);
+#undef V
+}
+
+static sqlite3_module symMod = {
+  0,      /* iVersion */
+  0,      /* xCreate */
+  symCon, /* xConnect */
+  symBst, /* xBestIndex */
+  symDis, /* xDisconnect */
+  0,      /* xDestroy */
+  symOpn, /* xOpen */
+  symCls, /* xClose */
+  symFlt, /* xFilter */
+  symNxt, /* xNext */
+  symEof, /* xEof */
+  symClm, /* xColumn */
+  symRid, /* xRowid */
+  0,      /* xUpdate */
+  0,      /* xBegin */
+  0,      /* xSync */
+  0,      /* xCommit */
+  0,      /* xRollback */
+  0,      /* xFindFunction */
+  0,      /* xRename */
+  0,      /* xSavepoint */
+  0,      /* xRelease */
+  0,      /* xRollbackTo */
+  0       /* xShadowName */
+};
+
+/* (sql-query "SELECT ..." ?arg ...) */
+
+/* a prepared statement of the cache, *c when it is not cached */
+static sqlite3_stmt *
+clpStm(
+  struct clpCtx *x
+ ,const char *q
+ ,int *c
+){
+  sqlite3_stmt *s;
+  unsigned int i;
+  unsigned int k;
+
+  *c = 1;
+  for (k = i = 0; i < CLP_STM; ++i) {
+    if ((x->p + i)->s && !strcmp(sqlite3_sql((x->p + i)->s), q)) {
+      if (sqlite3_stmt_busy((x->p + i)->s)) /* in use by an outer sql-query */
+        break;
+      ++(x->p + i)->n;
+      (x->p + i)->t = ++x->w;
+      return ((x->p + i)->s);
+    }
+    if ((x->p + i)->t < (x->p + k)->t)
+      k = i;
+  }
+  if (sqlite3_prepare_v3(x->d, q, -1, SQLITE_PREPARE_PERSISTENT, &s, 0) != SQLITE_OK)
+    return (0);
+  if (i < CLP_STM) {
+    *c = 0;
+    return (s);
+  }
+  sqlite3_finalize((x->p + k)->s);
+  (x->p + k)->s = s;
+  (x->p + k)->n = 1;
+  (x->p + k)->t = ++x->w;
+  return (s);
+}
+
+static void
+clpSqq(
+  Environment *e
+ ,UDFContext *uc
+ ,UDFValue *r
+){
+  struct clpCtx *x;
+  MultifieldBuilder *m;
+  sqlite3_stmt *s;
+  UDFValue a;
   int c;
-  char o;
+  int i;
+  int j;
 
-  if (!in) {
-    if ((V->f = GetNextFactInTemplate(V->t->t, V->f)))
-      RetainFact(V->f);
-    return (SQLITE_OK);
+  x = ((struct clpEnv *)uc->context)->x;
+  r->lexemeValue = FalseSymbol(e);
+  if (!UDFFirstArgument(uc, STRING_BIT, &a))
+    return;
+  if (!(s = clpStm(x, a.lexemeValue->contents, &c))) {
+    WriteString(e, STDERR, sqlite3_errmsg(x->d));
+    WriteString(e, STDERR, "\n");
+    UDFThrowError(uc);
+    return;
   }
-  --in;
-  if (!(s = sqlite3_mprintf("(find-all-facts((?f %s))%s"/*)*/, DeftemplateName(V->t->t), in ? "(and"/*)*/ : "")))
-    return (SQLITE_NOMEM);
-  for (i = 0; i < ac && (o = *is++); ++i) {
-    if (*is == '-') {
-      for (++is; *is >= '0' && *is <= '9'; ++is);
-      c = -1;
-    } else
-      for (c = 0; *is >= '0' && *is <= '9'; ++is)
-        c = c * 10 + (*is - '0');
-    switch (o) {
-    case 'n': /* SQLITE_INDEX_CONSTRAINT_ISNULL */
-      if (c < 0)
-        s = sqlite3_mprintf("%z(eq ?f nil)", s);
-      else
-        s = sqlite3_mprintf("%z(eq ?f:%s nil)", s, (V->t->s + c)->n);
+  for (i = 1, j = SQLITE_OK; !j && UDFHasNextArgument(uc); ++i) {
+    if (!UDFNextArgument(uc, ANY_TYPE_BITS, &a)) { /* reported by CLIPS */
+      j = SQLITE_MISMATCH;
       break;
-    case 'N': /* SQLITE_INDEX_CONSTRAINT_ISNOTNULL */
-      if (c < 0)
-        s = sqlite3_mprintf("%z(neq ?f nil)", s);
-      else
-        s = sqlite3_mprintf("%z(neq ?f:%s nil)", s, (V->t->s + c)->n);
+    }
+    switch (a.header->type) {
+    case INTEGER_TYPE:
+      j = sqlite3_bind_int64(s, i, a.integerValue->contents);
       break;
-    case 'i': /* SQLITE_INDEX_CONSTRAINT_IS */
-    case 'e': /* SQLITE_INDEX_CONSTRAINT_EQ */
-      if (c < 0)
-        s = sqlite3_mprintf("%z(eq(fact-index ?f)%s)", s, sqlite3_value_text(*(av + i)));
-      else if (sqlite3_value_type(*(av + i)) == SQLITE_NULL)
-        s = sqlite3_mprintf("%z(eq ?f:%s nil)", s, (V->t->s + c)->n);
-      else if (sqlite3_value_type(*(av + i)) == SQLITE_TEXT)
-        s = sqlite3_mprintf("%z(eq ?f:%s \"%s\")", s, (V->t->s + c)->n, sqlite3_value_text(*(av + i)));
-      else
-        s = sqlite3_mprintf("%z(eq ?f:%s %s)", s, (V->t->s + c)->n, sqlite3_value_text(*(av + i)));
+    case FLOAT_TYPE:
+      j = sqlite3_bind_double(s, i, a.floatValue->contents);
       break;
-    case 'I': /* SQLITE_INDEX_CONSTRAINT_ISNOT */
-    case 'E': /* SQLITE_INDEX_CONSTRAINT_NE */
-      if (c < 0)
-        s = sqlite3_mprintf("%z(neq(fact-index ?f)%s)", s, sqlite3_value_text(*(av + i)));
-      else if (sqlite3_value_type(*(av + i)) == SQLITE_NULL)
-        s = sqlite3_mprintf("%z(neq ?f:%s nil)", s, (V->t->s + c)->n);
-      else if (sqlite3_value_type(*(av + i)) == SQLITE_TEXT)
-        s = sqlite3_mprintf("%z(neq ?f:%s \"%s\")", s, (V->t->s + c)->n, sqlite3_value_text(*(av + i)));
+    case STRING_TYPE:
+      j = sqlite3_bind_text(s, i, a.lexemeValue->contents, -1, SQLITE_TRANSIENT);
+      break;
+    case SYMBOL_TYPE: /* as CLIPS tables, nil is NULL and others BLOB */
+      if (!strcmp(a.lexemeValue->contents, "nil"))
+        j = sqlite3_bind_null(s, i);
       else
-        s = sqlite3_mprintf("%z(neq ?f:%s %s)", s, (V->t->s + c)->n, sqlite3_value_text(*(av + i)));
+        j = sqlite3_bind_blob(s, i, a.lexemeValue->contents, strlen(a.lexemeValue->contents) + 1, SQLITE_TRANSIENT);
+      break;
+    case FACT_ADDRESS_TYPE: /* as the "fact" column of CLIPS tables */
+      RetainFact(a.factValue);
+      j = sqlite3_bind_pointer(s, i, a.factValue, CLP_FPT, clpFrl);
       break;
     default:
-      return (SQLITE_ERROR);
+      j = sqlite3_bind_null(s, i);
+      break;
     }
-    if (!s)
-      return (SQLITE_NOMEM);
+    if (j) { /* e.g. SQLITE_RANGE, more arguments than parameters */
+      WriteString(e, STDERR, sqlite3_errmsg(x->d));
+      WriteString(e, STDERR, "\n");
+      UDFThrowError(uc);
+    }
+  }
+  if (j) {
+    if (c) {
+      sqlite3_reset(s);
+      sqlite3_clear_bindings(s);
+    } else
+      sqlite3_finalize(s);
+    return;
+  }
+  m = CreateMultifieldBuilder(e, 0);
+  /* rows, column after column, sqlite3_column_count fields per row as a multifield can't nest */
+  while ((j = sqlite3_step(s)) == SQLITE_ROW)
+    for (i = 0; i < sqlite3_column_count(s); ++i)
+      switch (sqlite3_column_type(s, i)) {
+      case SQLITE_INTEGER:
+        MBAppendInteger(m, sqlite3_column_int64(s, i));
+        break;
+      case SQLITE_FLOAT:
+        MBAppendFloat(m, sqlite3_column_double(s, i));
+        break;
+      case SQLITE_TEXT:
+        MBAppendString(m, (const char *)sqlite3_column_text(s, i));
+        break;
+      case SQLITE_BLOB: {
+        char *b;
+
+        if ((b = sqlite3_mprintf("%.*s", sqlite3_column_bytes(s, i), sqlite3_column_blob(s, i)))) {
+          MBAppendSymbol(m, b);
+          sqlite3_free(b);
+        }
+        break;
+      }
+      default: {
+        Fact *f;
+
+        if ((f = sqlite3_value_pointer(sqlite3_column_value(s, i), CLP_FPT)))
+          MBAppendFact(m, f);
+        else
+          MBAppendSymbol(m, "nil");
+        break;
+      }
+      }
+  if (j == SQLITE_DONE)
+    r->multifieldValue = MBCreate(m);
+  else {
+    WriteString(e, STDERR, sqlite3_errmsg(x->d));
+    WriteString(e, STDERR, "\n");
+    UDFThrowError(uc);
   }
-  if (!(s = sqlite3_mprintf(/*(*/"%z%s)", s, in ? /*(*/")" : "")))
+  MBDispose(m);
+  if (c) {
+    sqlite3_reset(s);
+    sqlite3_clear_bindings(s);
+  } else
+    sqlite3_finalize(s);
+}
+
+/* SELECT * FROM clips_statements; connected by sqlite3_clips_init so its xDisconnect finalizes the cache before sqlite3_close checks for statements */
+
+struct stmVtb {
+  sqlite3_vtab v;
+  struct clpCtx *x;
+};
+
+static int
+stmCon(
+  sqlite3 *db
+ ,void *cx
+ ,int ac
+ ,const char *const *av
+ ,sqlite3_vtab **vt
+ ,char **er
+){
+  struct stmVtb *v;
+  int i;
+
+  if ((i = sqlite3_declare_vtab(db, "CREATE TABLE \"x\"(\"sql\" TEXT,\"uses\" INTEGER)")))
+    return (i);
+  if (!(v = sqlite3_malloc(sizeof (*v))))
     return (SQLITE_NOMEM);
-  i = Eval(V->t->e, s, &v);
-  sqlite3_free(s);
-  if (i)
-    return (SQLITE_ERROR);
-  V->n = v.multifieldValue->length;
-  if (!(V->a = sqlite3_malloc((V->n ? V->n : 1) * sizeof (*V->a))))
+  memset(&v->v, 0, sizeof (v->v));
+  v->x = cx;
+  *vt = &v->v;
+  return (SQLITE_OK);
+  (void)ac;
+  (void)av;
+  (void)er;
+}
+
+static int
+stmDis(
+  sqlite3_vtab *vt
+){
+  clpSfn(((struct stmVtb *)vt)->x);
+  sqlite3_free(vt);
+  return (SQLITE_OK);
+}
+
+struct stmCsr {
+  sqlite3_vtab_cursor c;
+  unsigned int i;
+};
+
+static int
+stmOpn(
+  sqlite3_vtab *vt
+ ,sqlite3_vtab_cursor **vc
+){
+  struct stmCsr *c;
+
+  if (!(c = sqlite3_malloc(sizeof (*c))))
     return (SQLITE_NOMEM);
-  for (j = 0; j < V->n; ++j)
-    RetainFact((*(V->a + j) = (v.multifieldValue->contents + j)->factValue));
+  c->i = 0;
+  *vc = &c->c;
   return (SQLITE_OK);
-#undef V
+  (void)vt;
 }
 
 static int
-clpNxt(
+stmCls(
   sqlite3_vtab_cursor *vc
 ){
-#define V ((struct clpCsr *)vc)
-  if (!V->a) {
-    if (V->f)
-      ReleaseFact(V->f);
-    if ((V->f = GetNextFactInTemplate(V->t->t, V->f)))
-      RetainFact(V->f);
-  } else
-    ++V->o;
+  sqlite3_free(vc);
   return (SQLITE_OK);
-#define V ((struct clpCsr *)vc)
 }
 
 static int
-clpEof(
-  sqlite3_vtab_cursor *vc
+stmBst(
+  sqlite3_vtab *vt
+ ,sqlite3_index_info *ii
 ){
-#define V ((struct clpCsr *)vc)
-  if (V->f || (V->a && V->o < V->n))
-    return (0);
-  else
-    return (1);
-#define V ((struct clpCsr *)vc)
+  ii->estimatedCost = 10.0;
+  ii->estimatedRows = CLP_STM;
+  return (SQLITE_OK);
+  (void)vt;
 }
 
 static int
-clpRid(
+stmNxt(
   sqlite3_vtab_cursor *vc
- ,sqlite3_int64 *id
 ){
-#define V ((struct clpCsr *)vc)
-  if (!V->a)
-    *id = FactIndex(V->f);
-  else
-    *id = FactIndex(*(V->a + V->o));
+#define V ((struct stmCsr *)vc)
+  struct clpCtx *x;
+
+  x = ((struct stmVtb *)V->c.pVtab)->x;
+  for (++V->i; V->i < CLP_STM && !(x->p + V->i)->s; ++V->i);
   return (SQLITE_OK);
 #undef V
 }
 
 static int
-clpClm(
+stmFlt(
   sqlite3_vtab_cursor *vc
- ,sqlite3_context *sc
- ,int cn
+ ,int in
+ ,const char *is
+ ,int ac
+ ,sqlite3_value **av
 ){
-#define V ((struct clpCsr *)vc)
-  CLIPSValue v;
-  int i;
+#define V ((struct stmCsr *)vc)
+  struct clpCtx *x;
 
-  if (sqlite3_vtab_nochange(sc))
-    return (SQLITE_OK);
-  if (!V->a)
-    i = GetFactSlot(V->f, (V->t->s + cn)->n, &v);
-  else
-    i = GetFactSlot(*(V->a + V->o), (V->t->s + cn)->n, &v);
-  if (i)
-    return (SQLITE_OK);
-  switch (v.header->type) {
-  case SYMBOL_TYPE:
-    if (*(v.lexemeValue->contents + 0) != 'n'
-     || *(v.lexemeValue->contents + 1) != 'i'
-     || *(v.lexemeValue->contents + 2) != 'l'
-     || *(v.lexemeValue->contents + 3) != '\0')
-      sqlite3_result_blob(sc, v.lexemeValue->contents, strlen(v.lexemeValue->contents) + 1, SQLITE_TRANSIENT);
-    break;
-  case INTEGER_TYPE:
-    sqlite3_result_int64(sc, v.integerValue->contents);
-    break;
-  case FLOAT_TYPE:
-    sqlite3_result_double(sc, v.floatValue->contents);
-    break;
-  case STRING_TYPE:
-    sqlite3_result_text(sc, v.lexemeValue->contents, -1, SQLITE_TRANSIENT);
-    break;
-  default:
-    break;
-  }
+  x = ((struct stmVtb *)V->c.pVtab)->x;
+  V->i = 0;
+  if (!(x->p + V->i)->s)
+    return (stmNxt(vc));
   return (SQLITE_OK);
+  (void)in;
+  (void)is;
+  (void)ac;
+  (void)av;
 #undef V
 }
 
 static int
-clpUpd(
-  sqlite3_vtab *vt
- ,int ac
- ,sqlite3_value **av
- ,sqlite3_int64 *id
+stmEof(
+  sqlite3_vtab_cursor *vc
 ){
-#define V ((struct clpVtb *)vt)
-  char *s;
-  Fact *f;
-  CLIPSValue v;
-  int i;
-  int j;
-  int k;
+  return (((struct stmCsr *)vc)->i >= CLP_STM);
+}
 
-  if (ac == 1) { /* delete */
-    if (!(s = sqlite3_mprintf("(find-fact((?f %s))(eq(fact-index ?f)%lld))", DeftemplateName(V->t), sqlite3_value_int64(*(av + 0)))))
-      return (SQLITE_NOMEM);
-    i = Eval(V->e, s, &v);
-    sqlite3_free(s);
-    if (!i && v.multifieldValue->length)
-      Retract(v.multifieldValue->contents->factValue);
-  } else {
-    if (sqlite3_value_type(*(av + 0)) == SQLITE_NULL) { /* insert */
-      FactBuilder *b;
+static int
+stmRid(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_int64 *id
+){
+  *id = ((struct stmCsr *)vc)->i;
+  return (SQLITE_OK);
+}
 
-      if (sqlite3_value_type(*(av + 1)) != SQLITE_NULL)
-        return (SQLITE_CONSTRAINT);
-      if (!(b = CreateFactBuilder(V->e, DeftemplateName(V->t))))
-        return (SQLITE_NOMEM);
-      for (j = 2, k = 0; j < ac; ++j, ++k) {
-        if (sqlite3_value_type(*(av + j)) == SQLITE_NULL && (V->s + k)->t & stSymbol)
-          i = FBPutSlotSymbol(b, (V->s + k)->n, "nil");
-        else if (sqlite3_value_type(*(av + j)) == SQLITE_BLOB && (V->s + k)->t & stSymbol)
-          i = FBPutSlotSymbol(b, (V->s + k)->n, sqlite3_value_blob(*(av + j)));
-        else if (sqlite3_value_type(*(av + j)) == SQLITE_INTEGER && (V->s + k)->t & stInteger)
-          i = FBPutSlotInteger(b, (V->s + k)->n, sqlite3_value_int64(*(av + j)));
-        else if (sqlite3_value_type(*(av + j)) == SQLITE_FLOAT && (V->s + k)->t & stFloat)
-          i = FBPutSlotFloat(b, (V->s + k)->n, sqlite3_value_double(*(av + j)));
-        else if (sqlite3_value_type(*(av + j)) == SQLITE_TEXT && (V->s + k)->t & stString)
-          i = FBPutSlotString(b, (V->s + k)->n, (const char *)sqlite3_value_text(*(av + j)));
-        else
-          i = 1;
-        if (i) {
-          FBDispose(b);
-          return (SQLITE_CONSTRAINT);
-        }
-      }
-      f = FBAssert(b);
-      FBDispose(b);
-      if (!f)
-        return (SQLITE_CONSTRAINT);
-      *id = FactIndex(f);
-    } else { /* update */
-      FactModifier *m;
+static int
+stmClm(
+  sqlite3_vtab_cursor *vc
+ ,sqlite3_context *sc
+ ,int cn
+){
+#define V ((struct stmCsr *)vc)
+  struct clpStm *p;
 
-      if (sqlite3_value_int64(*(av + 0)) != sqlite3_value_int64(*(av + 1)))
-        return (SQLITE_CONSTRAINT);
-      if (!(s = sqlite3_mprintf("(find-fact((?f %s))(eq(fact-index ?f)%lld))", DeftemplateName(V->t), sqlite3_value_int64(*(av + 0)))))
-        return (SQLITE_NOMEM);
-      i = Eval(V->e, s, &v);
-      sqlite3_free(s);
-      if (i || !v.multifieldValue->length)
-        return (SQLITE_NOTFOUND);
-      if (!(m = CreateFactModifier(V->e, v.multifieldValue->contents->factValue)))
-        return (SQLITE_NOMEM);
-      for (j = 2, k = 0; j < ac; ++j, ++k) {
-        if (sqlite3_value_nochange(*(av + j)))
-          continue;
-        if (sqlite3_value_type(*(av + j)) == SQLITE_NULL && (V->s + k)->t & stSymbol)
-          i = FMPutSlotSymbol(m, (V->s + k)->n, "nil");
-        else if (sqlite3_value_type(*(av + j)) == SQLITE_BLOB && (V->s + k)->t & stSymbol)
-          i = FMPutSlotSymbol(m, (V->s + k)->n, sqlite3_value_blob(*(av + j)));
-        else if (sqlite3_value_type(*(av + j)) == SQLITE_INTEGER && (V->s + k)->t & stInteger)
-          i = FMPutSlotInteger(m, (V->s + k)->n, sqlite3_value_int64(*(av + j)));
-        else if (sqlite3_value_type(*(av + j)) == SQLITE_FLOAT && (V->s + k)->t & stFloat)
-          i = FMPutSlotFloat(m, (V->s + k)->n, sqlite3_value_double(*(av + j)));
-        else if (sqlite3_value_type(*(av + j)) == SQLITE_TEXT && (V->s + k)->t & stString)
-          i = FMPutSlotString(m, (V->s + k)->n, (const char *)sqlite3_value_text(*(av + j)));
-        else
-          i = 1;
-        if (i) {
-          FMDispose(m);
-          return (SQLITE_CONSTRAINT);
-        }
-      }
-      f = FMModify(m);
-      FMDispose(m);
-      if (!f)
-        return (SQLITE_CONSTRAINT);
-      *id = FactIndex(f);
-    }
-  }
+  p = ((struct stmVtb *)V->c.pVtab)->x->p + V->i;
+  if (!cn)
+    sqlite3_result_text(sc, sqlite3_sql(p->s), -1, SQLITE_TRANSIENT);
+  else
+    sqlite3_result_int64(sc, p->n);
   return (SQLITE_OK);
 #undef V
 }
 
-static sqlite3_module clpMod = {
-  1,      /* iVersion */
-  clpCrt, /* xCreate */
-  clpCon, /* xConnect */
-  clpBst, /* xBestIndex */
-  clpDis, /* xDisconnect */
-  clpDis, /* xDestroy */
-  clpOpn, /* xOpen */
-  clpCls, /* xClose */
-  clpFlt, /* xFilter */
-  clpNxt, /* xNext */
-  clpEof, /* xEof */
-  clpClm, /* xColumn */
-  clpRid, /* xRowid */
-  clpUpd, /* xUpdate */
+static sqlite3_module stmMod = {
+  0,      /* iVersion */
+  0,      /* xCreate */
+  stmCon, /* xConnect */
+  stmBst, /* xBestIndex */
+  stmDis, /* xDisconnect */
+  0,      /* xDestroy */
+  stmOpn, /* xOpen */
+  stmCls, /* xClose */
+  stmFlt, /* xFilter */
+  stmNxt, /* xNext */
+  stmEof, /* xEof */
+  stmClm, /* xColumn */
+  stmRid, /* xRowid */
+  0,      /* xUpdate */
   0,      /* xBegin */
   0,      /* xSync */
   0,      /* xCommit */
   0,      /* xRollback */
   0,      /* xFindFunction */
   0,      /* xRename */
-/*iVersion=2*/
   0,      /* xSavepoint */
   0,      /* xRelease */
   0,      /* xRollbackTo */
-/*iVersion=3*/
   0       /* xShadowName */
 };
 
+/* (regexp-match "pattern" "string") and (regexp-matchi "pattern" "string") */
+
+/* a compiled pattern of the cache, 0 with e set on error */
+static sqlite3re_compiled *
+clpRxl(
+  struct clpEnv *x
+ ,const char *p
+ ,int i
+ ,const char **e
+){
+  sqlite3re_compiled *r;
+  const unsigned char *q;
+  unsigned int h;
+  unsigned int j;
+  unsigned int k;
+
+  for (h = 2166136261u, q = (const unsigned char *)p; *q; ++q)
+    h = (h ^ *q) * 16777619u;
+  for (k = j = 0; j < CLP_RXC; ++j) {
+    if ((x->g + j)->r && (x->g + j)->h == h && (x->g + j)->i == i && !strcmp((x->g + j)->p, p)) {
+      (x->g + j)->t = ++x->w;
+      return ((x->g + j)->r);
+    }
+    if ((x->g + j)->t < (x->g + k)->t)
+      k = j;
+  }
+  if ((*e = sqlite3re_compile(&r, p, i))) {
+    sqlite3re_free(r);
+    return (0);
+  }
+  if (!r) {
+    *e = "out of memory";
+    return (0);
+  }
+  sqlite3re_free((x->g + k)->r);
+  sqlite3_free((x->g + k)->p);
+  if (!((x->g + k)->p = sqlite3_mprintf("%s", p))) {
+    (x->g + k)->r = 0;
+    (x->g + k)->t = 0;
+    sqlite3re_free(r);
+    *e = "out of memory";
+    return (0);
+  }
+  (x->g + k)->r = r;
+  (x->g + k)->h = h;
+  (x->g + k)->i = i;
+  (x->g + k)->t = ++x->w;
+  return (r);
+}
+
+static void
+clpRxm(
+  Environment *e
+ ,UDFContext *uc
+ ,UDFValue *r
+ ,int i
+){
+  sqlite3re_compiled *c;
+  const char *m;
+  UDFValue p;
+  UDFValue s;
+
+  r->lexemeValue = FalseSymbol(e);
+  if (!UDFFirstArgument(uc, LEXEME_BITS, &p)
+   || !UDFNextArgument(uc, LEXEME_BITS, &s))
+    return;
+  if (!(c = clpRxl(uc->context, p.lexemeValue->contents, i, &m))) {
+    WriteString(e, STDERR, m);
+    WriteString(e, STDERR, "\n");
+    UDFThrowError(uc);
+    return;
+  }
+  if (sqlite3re_match(c, (const unsigned char *)s.lexemeValue->contents, -1))
+    r->lexemeValue = TrueSymbol(e);
+}
+
+static void
+clpRxs(
+  Environment *e
+ ,UDFContext *uc
+ ,UDFValue *r
+){
+  clpRxm(e, uc, r, 0);
+}
+
+static void
+clpRxi(
+  Environment *e
+ ,UDFContext *uc
+ ,UDFValue *r
+){
+  clpRxm(e, uc, r, 1);
+}
+
+/* SELECT clips_expire(now); retracts the facts of TTL tables expired at now */
+static void
+clpExp(
+  sqlite3_context *sc
+ ,int ac
+ ,sqlite3_value **av
+){
+  struct clpVtb *v;
+  struct clpTtl *w;
+  struct clpTte e;
+  sqlite3_int64 n;
+  double t;
+
+  (void)ac;
+  if (sqlite3_value_numeric_type(*(av + 0)) != SQLITE_INTEGER
+   && sqlite3_value_numeric_type(*(av + 0)) != SQLITE_FLOAT) {
+    sqlite3_result_error(sc, "clips_expire: now not a number", -1);
+    return;
+  }
+  t = sqlite3_value_double(*(av + 0));
+  for (n = 0, v = ((struct clpCtx *)sqlite3_user_data(sc))->v; v; v = v->l) {
+    if (!(w = v->w))
+      continue;
+    if (w->o && clpTrb(v)) {
+      sqlite3_result_error_nomem(sc);
+      return;
+    }
+    while (w->n && w->h->t <= t) {
+      e = *w->h;
+      *w->h = *(w->h + --w->n);
+      if (w->n)
+        clpTdn(w, 0);
+      if (FactExistp(e.f)) {
+        Retract(e.f);
+        ++n;
+      }
+      if (w->s) /* it was counted by the retract */
+        --w->s;
+      ReleaseFact(e.f);
+    }
+  }
+  sqlite3_result_int64(sc, n);
+}
+
+/* SELECT clips_timeout(ms); limits the scan of each following filter, 0 none, returns the previous */
+static void
+clpTmo(
+  sqlite3_context *sc
+ ,int ac
+ ,sqlite3_value **av
+){
+  struct clpCtx *x;
+
+  (void)ac;
+  x = sqlite3_user_data(sc);
+  sqlite3_result_int64(sc, x->m);
+  if (sqlite3_value_type(*(av + 0)) != SQLITE_NULL)
+    x->m = sqlite3_value_int64(*(av + 0)) > 0 ? sqlite3_value_int64(*(av + 0)) : 0;
+}
+
 int
 sqlite3_clips_init(
   sqlite3 *db
  ,Environment *ev
 ){
-  return (sqlite3_create_module(db, "CLIPS", &clpMod, ev));
+  struct clpCtx *x;
+  int i;
+
+  if (!(x = sqlite3_malloc(sizeof (*x))))
+    return (SQLITE_NOMEM);
+  x->d = db;
+  x->e = ev;
+  x->v = 0;
+  x->r = x->c = 0;
+  x->q = 0;
+  memset(x->p, 0, sizeof (x->p));
+  x->l = 0;
+  memset(&x->y, 0, sizeof (x->y));
+  x->w = 0;
+  x->m = 0;
+  x->n = x->u = 0;
+  x->k = 0;
+  x->i = x->j = 0;
+  x->o = 0;
+  x->f = 0;
+  if (!(x->h = sqlite3_mprintf("SQLiteCLIPS %p", (void *)x))) {
+    sqlite3_free(x);
+    return (SQLITE_NOMEM);
+  }
+  if (!AddBeforeRuleFiresFunction(ev, x->h, clpBrf, 0, x)
+   || !AddAfterRuleFiresFunction(ev, x->h, clpArf, 0, x)
+   || !AddClearFunction(ev, x->h, clpClr, 0, x)) {
+    clpCtf(x);
+    return (SQLITE_ERROR);
+  }
+  if ((i = sqlite3_create_module_v2(db, "CLIPS", &clpMod, x, clpCtf)))
+    return (i);
+  { /* regexp() unless the application has one, its destructor runs before clpCtf */
+    sqlite3_stmt *s;
+
+    if (sqlite3_prepare_v2(db, "SELECT regexp('','')", -1, &s, 0)) {
+      if ((i = sqlite3_create_function_v2(db, "regexp", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, x, clpRgx, 0, 0, clpRgd)))
+        return (i);
+      x->f = 1;
+    } else
+      sqlite3_finalize(s);
+  }
+  if ((i = sqlite3_create_module(db, "clips_aggregates", &aggMod, x)))
+    return (i);
+  if ((i = sqlite3_create_module(db, "clips_matches", &mchMod, x)))
+    return (i);
+  if ((i = sqlite3_create_module(db, "clips_rules", &rulMod, x)))
+    return (i);
+  if ((i = sqlite3_create_module(db, "clips_agenda", &agnMod, x))
+   || (i = sqlite3_create_function(db, "clips_query_register", 3, SQLITE_UTF8 | SQLITE_DIRECTONLY, x, clpQrg, 0, 0))
+   || (i = sqlite3_create_function(db, "clips_query_drop", 1, SQLITE_UTF8 | SQLITE_DIRECTONLY, x, clpQdr, 0, 0)))
+    return (i);
+  if ((i = sqlite3_create_module(db, "clips_query", &qryMod, x))
+   || (i = sqlite3_create_module(db, "clips_multifield", &mfdMod, x))
+   || (i = sqlite3_create_module(db, "clips_join", &jonMod, x))
+   || (i = sqlite3_create_module(db, "clips_aggregate", &agpMod, x))
+   || (i = sqlite3_create_module(db, "clips_explain", &xplMod, x))
+   || (i = sqlite3_create_module(db, "clips_all_facts", &alfMod, x))
+   || (i = sqlite3_create_function(db, "clips_snapshot_save", 1, SQLITE_UTF8 | SQLITE_DIRECTONLY, x, clpSsv, 0, 0))
+   || (i = sqlite3_create_module(db, "clips_tables", &tblMod, x))
+   || (i = sqlite3_create_function(db, "clips_snapshot_load", 1, SQLITE_UTF8 | SQLITE_DIRECTONLY, x, clpSld, 0, 0))
+   || (i = sqlite3_create_module(db, "clips_statements", &stmMod, x))
+   || (i = sqlite3_create_function(db, "clips_expire", 1, SQLITE_UTF8 | SQLITE_DIRECTONLY, x, clpExp, 0, 0))
+   || (i = sqlite3_create_module(db, "clips_indexes", &idxMod, x))
+   || (i = sqlite3_create_module(db, "clips_symbols", &symMod, x))
+   || (i = sqlite3_create_function(db, "clips_timeout", 1, SQLITE_UTF8 | SQLITE_DIRECTONLY, x, clpTmo, 0, 0)))
+    return (i);
+  { /* connect clips_statements */
+    sqlite3_stmt *s;
+
+    if ((i = sqlite3_prepare_v2(db, "SELECT 1 FROM clips_statements", -1, &s, 0)))
+      return (i);
+    sqlite3_finalize(s);
+  }
+  { /* the CLIPS functions are the Environment's, added by its first connection */
+    struct clpEnv *v;
+    struct clpCtx **p;
+
+    if (!(v = GetEnvironmentData(ev, CLP_ENV))
+     && (!AllocateEnvironmentData(ev, CLP_ENV, sizeof (*v), 0) || !(v = GetEnvironmentData(ev, CLP_ENV))))
+      return (SQLITE_ERROR);
+    if (!v->x
+     && (AddUDF(ev, "sql-query", "bm", 1, UNBOUNDED, "*;s", clpSqq, "clpSqq", v)
+      || AddUDF(ev, "regexp-match", "b", 2, 2, "sy", clpRxs, "clpRxs", v)
+      || AddUDF(ev, "regexp-matchi", "b", 2, 2, "sy", clpRxi, "clpRxi", v)
+      || AddUDF(ev, "sql-continue", "b", 0, 0, 0, clpScn, "clpScn", v))) {
+      RemoveUDF(ev, "sql-query");
+      RemoveUDF(ev, "regexp-match");
+      RemoveUDF(ev, "regexp-matchi");
+      return (SQLITE_ERROR);
+    }
+    for (p = &v->x; *p; p = &(*p)->l);
+    *p = x;
+  }
+  return (SQLITE_OK);
 }
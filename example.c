@@ -18,16 +18,63 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
+#include <string.h>
 #include "sqlite3.h"
 #include "clips.h"
 
+/* nonzero when the rows of sql (columns separated by a space, NULL as NULL) are not w, w 0 when sql must fail */
+static int
+chk(
+  sqlite3 *db
+ ,const char *sql
+ ,const char *w
+){
+  sqlite3_stmt *st;
+  sqlite3_str *s;
+  char *r;
+  int e;
+  int i;
+
+  s = sqlite3_str_new(db);
+  if (!(e = sqlite3_prepare_v2(db, sql, -1, &st, 0))) {
+    while (sqlite3_step(st) == SQLITE_ROW)
+      for (i = 0; i < sqlite3_column_count(st); ++i)
+        sqlite3_str_appendf(s, "%s%c"
+        ,sqlite3_column_type(st, i) == SQLITE_NULL ? "NULL" : (const char *)sqlite3_column_text(st, i)
+        ,i < sqlite3_column_count(st) - 1 ? ' ' : '\n');
+    e = sqlite3_finalize(st);
+  }
+  r = sqlite3_str_finish(s);
+  if ((i = w ? e || strcmp(r ? r : "", w) : !e))
+    fprintf(stderr, "%s\n%s%s", sql, e ? sqlite3_errmsg(db) : r ? r : "", e ? "\n" : "");
+  sqlite3_free(r);
+  return (i);
+}
+
+/* an application's regexp() matching everything */
+static void
+rgx(
+  sqlite3_context *sc
+ ,int ac
+ ,sqlite3_value **av
+){
+  (void)ac;
+  (void)av;
+  sqlite3_result_int(sc, 1);
+}
+
 int
 main(
 ){
   extern int sqlite3_clips_init(sqlite3 *, Environment *);
   Environment *ev;
   sqlite3 *db;
+  sqlite3 *d2;
   sqlite3_stmt *st;
+  CLIPSValue v;
+  int e;
+  int i;
 
   sqlite3_initialize();
 
@@ -113,13 +160,403 @@ main(
     );
   sqlite3_finalize(st);
 
+  if (!LoadFromString(ev
+  ,"(deftemplate MAIN::t2"
+    "(slot s1 (type INTEGER))"
+    "(slot s2 (type SYMBOL STRING))"
+   ")"
+   "(deftemplate MAIN::t3"
+    "(slot s1 (type INTEGER))"
+    "(slot s2 (type INTEGER FLOAT))"
+   ")"
+   "(deftemplate MAIN::t4"
+    "(slot s1 (type INTEGER))"
+    "(multislot s2)"
+   ")"
+   "(deftemplate MAIN::t5"
+    "(slot s1 (type INTEGER))"
+    "(slot s2 (type SYMBOL STRING))"
+    "(slot s3 (type FLOAT))"
+   ")"
+   "(deftemplate MAIN::t6"
+    "(slot s1 (type INTEGER))"
+    "(slot s2 (type SYMBOL STRING))"
+    "(slot s3 (type INTEGER))"
+   ")"
+   "(deftemplate MAIN::t8"
+    "(slot s1 (type INTEGER))"
+    "(slot s2 (type INTEGER FLOAT))"
+   ")"
+   "(deftemplate MAIN::t13"
+    "(slot s1 (type INTEGER))"
+    "(slot s2 (type SYMBOL))"
+   ")"
+   "(deftemplate MAIN::t15"
+    "(slot s1 (type INTEGER))"
+   ")"
+   "(defrule MAIN::r1"
+    "(t2 (s1 ?x))"
+    "(t3 (s1 ?x))"
+    "=>"
+   ")"
+  ,SIZE_MAX)) {
+    fprintf(stderr, "LoadFromString fail\n");
+    return (-1);
+  }
+  e = chk(db, "CREATE VIRTUAL TABLE \"t2\" USING CLIPS(\"MAIN::t2\");", "");
+  e |= chk(db, "INSERT INTO \"t2\" VALUES(1,'apple'),(2,'Apricot'),(3,'banana'),(4,CAST('avocado' AS BLOB));", "");
+
+  /* LIKE (without case), GLOB and REGEXP are evaluated in the cursor */
+  e |= chk(db, "SELECT group_concat(\"s1\") FROM(SELECT \"s1\" FROM \"t2\" WHERE \"s2\" LIKE 'a%' ORDER BY 1);", "1,2,4\n");
+  e |= chk(db, "SELECT group_concat(\"s1\") FROM(SELECT \"s1\" FROM \"t2\" WHERE \"s2\" GLOB 'A*' ORDER BY 1);", "2\n");
+  e |= chk(db, "SELECT group_concat(\"s1\") FROM(SELECT \"s1\" FROM \"t2\" WHERE \"s2\" REGEXP '^(b|av)' ORDER BY 1);", "3,4\n");
+  e |= chk(db, "PRAGMA case_sensitive_like=ON;", "");
+  e |= chk(db, "SELECT group_concat(\"s1\") FROM(SELECT \"s1\" FROM \"t2\" WHERE \"s2\" LIKE 'a%' ORDER BY 1);", "1,4\n");
+  e |= chk(db, "PRAGMA case_sensitive_like=OFF;", "");
+
+  /* AGGREGATE is maintained on assert and retract */
+  e |= chk(db, "CREATE VIRTUAL TABLE \"t3\" USING CLIPS(\"MAIN::t3\",AGGREGATE=s2);", "");
+  e |= chk(db, "CREATE VIRTUAL TABLE \"t3x\" USING CLIPS(\"MAIN::t2\",AGGREGATE=s2);", 0);
+  e |= chk(db, "INSERT INTO \"t3\" VALUES(1,2),(2,3.5),(3,-1);", "");
+  e |= chk(db, "SELECT \"count\",\"sum\",\"min\",\"max\" FROM \"clips_aggregates\" WHERE \"table\"='t3' AND \"slot\"='s2';", "3 4.5 -1 3.5\n");
+  e |= chk(db, "DELETE FROM \"t3\" WHERE \"s1\"=3;", "");
+  e |= chk(db, "SELECT \"count\",\"sum\",\"min\",\"max\" FROM \"clips_aggregates\" WHERE \"table\"='t3' AND \"slot\"='s2';", "2 5.5 2 3.5\n");
+  e |= chk(db, "SELECT \"count\" FROM \"clips_aggregates\" WHERE \"table\"='t3' AND \"slot\" IS NULL;", "2\n");
+  e |= chk(db, "SELECT COUNT(*) FROM \"t3\";", "2\n");
+
+  /* clips_matches reads the facts of each CE of the rule's activations */
+  e |= chk(db, "SELECT COUNT(*),COUNT(DISTINCT \"activation\") FROM \"clips_matches\"('r1');", "4 2\n");
+  e |= chk(db, "SELECT group_concat(\"s1\") FROM(SELECT \"t2\".\"s1\" FROM \"clips_matches\"('r1') AS \"m\",\"t2\""
+   " WHERE \"m\".\"ce\"=1 AND \"t2\".ROWID=\"m\".\"fact\" ORDER BY 1);", "1,2\n");
+  /* the filter reads the rows, firing the activations while stepping leaves them alone */
+  if (sqlite3_prepare_v2(db, "SELECT \"fact\" FROM \"clips_matches\"('r1');", -1, &st, 0)
+   || sqlite3_step(st) != SQLITE_ROW) {
+    fprintf(stderr, "clips_matches fail\n");
+    e = 1;
+  } else {
+    Run(ev, -1);
+    for (i = 1; sqlite3_step(st) == SQLITE_ROW; ++i);
+    if (i != 4) {
+      fprintf(stderr, "clips_matches rows %d fail\n", i);
+      e = 1;
+    }
+  }
+  sqlite3_finalize(st);
+  e |= chk(db, "SELECT COUNT(*) FROM \"clips_matches\"('r1');", "0\n");
+
+  /* clips_agenda lists the activations, clips_rules counts the fires */
+  e |= chk(db, "INSERT INTO \"t3\" VALUES(3,1);", "");
+  e |= chk(db, "SELECT \"rule\",\"salience\" FROM \"clips_agenda\";", "r1 0\n");
+  e |= chk(db, "SELECT \"fires\",\"activations\" FROM \"clips_rules\" WHERE \"rule\"='r1';", "2 1\n");
+  Run(ev, -1);
+  e |= chk(db, "SELECT \"fires\",\"activations\",\"seconds\">=0 FROM \"clips_rules\" WHERE \"rule\"='r1';", "3 0 1\n");
+  e |= chk(db, "SELECT COUNT(*) FROM \"clips_agenda\";", "0\n");
+  /* clips_agenda reads the agenda of every module */
+  if (!LoadFromString(ev
+  ,"(defmodule M2)"
+   "(deftemplate M2::t16"
+    "(slot s1 (type INTEGER))"
+   ")"
+   "(defrule M2::r2"
+    "(t16 (s1 ?x))"
+    "=>"
+   ")"
+  ,SIZE_MAX)
+   || Eval(ev, "(assert(t16(s1 1)))", &v)) { /* M2 is the current module */
+    fprintf(stderr, "M2 fail\n");
+    e = 1;
+  }
+  e |= chk(db, "SELECT \"module\",\"rule\",\"facts\" LIKE 'f-%' FROM \"clips_agenda\";", "M2 r2 1\n");
+  if (Eval(ev, "(undefrule r2)", &v)
+   || Eval(ev, "(do-for-all-facts((?f t16)) TRUE (retract ?f))", &v)) {
+    fprintf(stderr, "M2 fail\n");
+    e = 1;
+  }
+  SetCurrentModule(ev, FindDefmodule(ev, "MAIN"));
+  e |= chk(db, "SELECT COUNT(*) FROM \"clips_agenda\";", "0\n");
+
+  /* a standing query's results are facts of a hidden rule, clips_query reads them or their changes without (run) */
+  e |= chk(db, "SELECT clips_query_register('q1','(t3(s1 ?a)(s2 ?v&:(> ?v 2)))','?a ?v');", "NULL\n");
+  e |= chk(db, "SELECT clips_query_register('q2','(t3','?a');", 0);
+  e |= chk(db, "SELECT \"seq\",\"op\" FROM \"clips_query\"('q1');", "1 +\n");
+  e |= chk(db, "CREATE VIRTUAL TABLE \"q1\" USING clips_query(\"q1\");", "");
+  e |= chk(db, "SELECT \"op\",\"a\",\"v\" FROM \"q1\";", "+ 2 3.5\n");
+  e |= chk(db, "INSERT INTO \"t3\" VALUES(4,5);", "");
+  e |= chk(db, "SELECT COUNT(*) FROM \"clips_agenda\";", "0\n");
+  e |= chk(db, "SELECT \"seq\",\"op\",\"a\",\"v\" FROM \"q1\" WHERE \"since\"=1;", "2 + 4 5\n");
+  e |= chk(db, "DELETE FROM \"t3\" WHERE \"s1\"=4;", "");
+  e |= chk(db, "SELECT \"seq\",\"op\",\"a\",\"v\" FROM \"q1\" WHERE \"since\"=1;", "2 + 4 5\n3 - 4 5\n");
+  e |= chk(db, "SELECT \"seq\",\"op\" FROM \"clips_query\"('q1',1);", "2 +\n3 -\n");
+  e |= chk(db, "SELECT COUNT(*) FROM \"clips_rules\" WHERE \"rule\" LIKE '%q1';", "0\n");
+  e |= chk(db, "SELECT COUNT(*) FROM \"clips_query\"('q1');", "1\n");
+  e |= chk(db, "SELECT clips_query_drop('q1');", "NULL\n");
+  e |= chk(db, "SELECT COUNT(*) FROM \"q1\";", "0\n");
+  e |= chk(db, "DROP TABLE \"q1\";", "");
+
+  /* multislots are HIDDEN columns of their length, written as CLIPS text, read by clips_multifield */
+  e |= chk(db, "CREATE VIRTUAL TABLE \"t4\" USING CLIPS(\"MAIN::t4\");", "");
+  e |= chk(db, "INSERT INTO \"t4\"(\"s1\",\"s2\") VALUES(1,'a 2 \"x y\" 3.5'),(2,NULL);", "");
+  e |= chk(db, "SELECT \"s1\",\"s2\" FROM \"t4\" ORDER BY 1;", "1 4\n2 0\n");
+  e |= chk(db, "SELECT \"position\",\"value\" FROM \"t4\",\"clips_multifield\"(\"t4\".ROWID,'s2') WHERE \"t4\".\"s1\"=1;"
+   , "1 a\n2 2\n3 x y\n4 3.5\n");
+  e |= chk(db, "SELECT \"position\" FROM \"t4\",\"clips_multifield\"(\"t4\".ROWID,'s2') WHERE \"value\"=2;", "2\n");
+  e |= chk(db, "UPDATE \"t4\" SET \"s2\"='b c' WHERE \"s1\"=2;", "");
+  e |= chk(db, "SELECT \"s2\" FROM \"t4\" WHERE \"s1\"=2;", "2\n");
+  e |= chk(db, "UPDATE \"t4\" SET \"s2\"=7 WHERE \"s1\"=2;", "");
+  e |= chk(db, "SELECT \"value\" FROM \"t4\",\"clips_multifield\"(\"t4\".ROWID,'s2') WHERE \"t4\".\"s1\"=2;", "7\n");
+  e |= chk(db, "UPDATE \"t4\" SET \"s2\"='b c' WHERE \"s1\"=2;", "");
+
+  /* CACHE=COLUMNS scans column arrays, appended on assert, rebuilt after a retract */
+  e |= chk(db, "CREATE VIRTUAL TABLE \"t5\" USING CLIPS(\"MAIN::t5\",CACHE=COLUMNS);", "");
+  e |= chk(db, "INSERT INTO \"t5\" VALUES(1,'x',1.5),(2,CAST('y' AS BLOB),2.5),(3,NULL,0.5);", "");
+  e |= chk(db, "SELECT \"s1\",typeof(\"s2\"),\"s2\",\"s3\" FROM \"t5\";", "1 text x 1.5\n2 blob y 2.5\n3 null NULL 0.5\n");
+  e |= chk(db, "DELETE FROM \"t5\" WHERE \"s1\"=2;", "");
+  e |= chk(db, "SELECT \"s1\",typeof(\"s2\"),\"s2\",\"s3\" FROM \"t5\";", "1 text x 1.5\n3 null NULL 0.5\n");
+  e |= chk(db, "INSERT INTO \"t5\" VALUES(4,'w',4.0);", "");
+  e |= chk(db, "SELECT \"s1\",typeof(\"s2\"),\"s2\",\"s3\" FROM \"t5\";", "1 text x 1.5\n3 null NULL 0.5\n4 text w 4.0\n");
+
+  /* a snapshot saves the facts of the CLIPS tables' templates, loading asserts them again */
+  e |= chk(db, "SELECT clips_snapshot_save('example.snapshot');", "5\n");
+  e |= chk(db, "DELETE FROM \"t5\";", "");
+  { /* a load failing in its last block retracts the facts it asserted */
+    FILE *f;
+    char *b;
+    long n;
+
+    b = 0;
+    n = 0;
+    if ((f = fopen("example.snapshot", "rb"))) {
+      if (!fseek(f, 0, SEEK_END) && (n = ftell(f)) > 8 && !fseek(f, 0, SEEK_SET)
+       && (b = sqlite3_malloc64(n)) && fread(b, n, 1, f) != 1)
+        n = 0;
+      fclose(f);
+    }
+    if (!b || n <= 8 || !(f = fopen("example.truncated", "wb"))) {
+      fprintf(stderr, "example.truncated\n");
+      e = 1;
+    } else {
+      fwrite(b, n - 8, 1, f);
+      fclose(f);
+    }
+    sqlite3_free(b);
+  }
+  e |= chk(db, "SELECT clips_snapshot_load('example.truncated');", 0);
+  remove("example.truncated");
+  e |= chk(db, "SELECT COUNT(*) FROM \"t5\";", "0\n");
+  e |= chk(db, "SELECT \"s1\",\"s2\" FROM \"t4\" ORDER BY 1;", "1 4\n2 2\n");
+  e |= chk(db, "SELECT clips_snapshot_load('example.snapshot')>=3;", "1\n");
+  e |= chk(db, "SELECT \"s1\",\"s2\",\"s3\" FROM \"t5\" ORDER BY 1;", "1 x 1.5\n3 NULL 0.5\n4 w 4.0\n");
+  e |= chk(db, "SELECT \"s1\",\"s2\" FROM \"t4\" ORDER BY 1;", "1 4\n2 2\n");
+  remove("example.snapshot");
+  e |= chk(db, "SELECT clips_snapshot_load('example.snapshot');", 0);
+
+  /* an inner loop cursor filters again, restarting its scan */
+  e |= chk(db, "SELECT COUNT(*),SUM(\"a\".\"s1\"*\"b\".\"s1\") FROM \"t3\" AS \"a\",\"t3\" AS \"b\";", "9 36\n");
+  e |= chk(db, "SELECT group_concat(\"x\") FROM(SELECT \"a\".\"s1\"*10+\"b\".\"s1\" AS \"x\" FROM \"t2\" AS \"a\",\"t3\" AS \"b\""
+   " WHERE \"b\".\"s1\"=\"a\".\"s1\" ORDER BY 1);", "11,22,33\n");
+
+  /* UNIQUE keys s1 and s2, OR REPLACE modifies the fact */
+  e |= chk(db, "CREATE VIRTUAL TABLE \"t6\" USING CLIPS(\"MAIN::t6\",UNIQUE=s1,s2);", "");
+  e |= chk(db, "INSERT INTO \"t6\" VALUES(1,'a',1),(1,'b',2);", "");
+  e |= chk(db, "INSERT INTO \"t6\" VALUES(1,'a',3);", 0);
+  e |= chk(db, "INSERT OR IGNORE INTO \"t6\" VALUES(1,'a',4);", "");
+  e |= chk(db, "INSERT OR REPLACE INTO \"t6\" VALUES(1,'a',5);", "");
+  e |= chk(db, "UPDATE \"t6\" SET \"s2\"='a' WHERE \"s2\"='b';", 0);
+  e |= chk(db, "SELECT \"s1\",\"s2\",\"s3\" FROM \"t6\" ORDER BY 2;", "1 a 5\n1 b 2\n");
+
+  /* RESULTS keeps the facts of a filter until the template changes */
+  e |= chk(db, "CREATE VIRTUAL TABLE \"t7\" USING CLIPS(\"MAIN::t2\",RESULTS=2);", "");
+  e |= chk(db, "SELECT \"s1\" FROM \"t7\" WHERE \"s2\"='banana';", "3\n");
+  e |= chk(db, "SELECT \"s1\" FROM \"t7\" WHERE \"s2\"='banana';", "3\n");
+  e |= chk(db, "SELECT \"hits\",\"misses\" FROM \"clips_tables\" WHERE \"table\"='t7';", "1 1\n");
+  e |= chk(db, "INSERT INTO \"t7\" VALUES(5,'banana');", "");
+  e |= chk(db, "SELECT \"s1\" FROM \"t7\" WHERE \"s2\"='banana' ORDER BY 1;", "3\n5\n");
+  e |= chk(db, "SELECT \"hits\",\"misses\" FROM \"clips_tables\" WHERE \"table\"='t7';", "1 2\n");
+
+  /* sql-query returns the rows' columns to CLIPS in one multifield, FALSE on a bind error */
+  if (Eval(ev, "(assert(t4(s1 9)(s2(sql-query \"SELECT s1,s2 FROM t2 WHERE s1<? ORDER BY 1\" 3))))", &v)
+   || Eval(ev, "(sql-query \"SELECT 1\" 5)", &v) == EE_NO_ERROR) {
+    fprintf(stderr, "sql-query fail\n");
+    e = 1;
+  }
+  e |= chk(db, "SELECT group_concat(\"value\",' ') FROM \"t4\",\"clips_multifield\"(\"t4\".ROWID,'s2') WHERE \"t4\".\"s1\"=9;", "1 apple 2 Apricot\n");
+  e |= chk(db, "SELECT \"uses\" FROM \"clips_statements\" WHERE \"sql\"='SELECT s1,s2 FROM t2 WHERE s1<? ORDER BY 1';", "1\n");
+
+  /* regexp-match and regexp-matchi (without case) test strings in CLIPS */
+  if (Eval(ev, "(and(regexp-match \"^a.*e$\" \"apple\")(regexp-matchi \"^A\" apple)(not(regexp-match \"^A\" apple)))", &v)
+   || v.lexemeValue != TrueSymbol(ev)) {
+    fprintf(stderr, "regexp-match fail\n");
+    e = 1;
+  }
+
+  /* TTL expires facts at s2 + 10, clips_expire(now) retracts them */
+  e |= chk(db, "CREATE VIRTUAL TABLE \"t8\" USING CLIPS(\"MAIN::t8\",TTL=s2:10);", "");
+  e |= chk(db, "CREATE VIRTUAL TABLE \"t8x\" USING CLIPS(\"MAIN::t2\",TTL=s2:10);", 0);
+  e |= chk(db, "INSERT INTO \"t8\" VALUES(1,100),(2,200.5),(3,50);", "");
+  e |= chk(db, "SELECT clips_expire(100);", "1\n");
+  e |= chk(db, "SELECT clips_expire(150);", "1\n");
+  e |= chk(db, "SELECT \"s1\" FROM \"t8\";", "2\n");
+  e |= chk(db, "SELECT clips_expire(1000);", "1\n");
+  e |= chk(db, "SELECT COUNT(*) FROM \"t8\";", "0\n");
+
+  /* over BUDGET the filters stream the facts */
+  e |= chk(db, "CREATE VIRTUAL TABLE \"t9\" USING CLIPS(\"MAIN::t2\",BUDGET=16);", "");
+  e |= chk(db, "SELECT \"s1\" FROM \"t9\" WHERE \"s2\"='banana' ORDER BY 1;", "3\n5\n");
+  e |= chk(db, "SELECT COUNT(*) FROM \"t9\" WHERE \"s2\"<>'banana';", "3\n");
+  e |= chk(db, "SELECT \"budget\",\"memory\">0 FROM \"clips_tables\" WHERE \"table\"='t9';", "16 1\n");
+
+  /* GROUP BY and DISTINCT of a FLOAT column are grouped in the cursor, -0.0 with 0.0 */
+  e |= chk(db, "CREATE VIRTUAL TABLE \"t10\" USING CLIPS(\"MAIN::t5\");", "");
+  e |= chk(db, "INSERT INTO \"t10\" VALUES(5,'v',1.5),(6,'u',-0.0),(7,'t',0.0);", "");
+  e |= chk(db, "SELECT group_concat(\"n\") FROM(SELECT COUNT(*) AS \"n\" FROM \"t10\" GROUP BY \"s3\" ORDER BY \"s3\");", "2,1,2,1\n");
+  e |= chk(db, "SELECT COUNT(*) FROM(SELECT DISTINCT \"s3\" FROM \"t10\");", "4\n");
+  e |= chk(db, "SELECT COUNT(*) FROM \"t10\" WHERE \"s2\" LIKE 'u%' GROUP BY \"s3\";", "1\n");
+
+  /* AUTOINDEX indexes s2 once its = filters visited 10 facts */
+  e |= chk(db, "CREATE VIRTUAL TABLE \"t11\" USING CLIPS(\"MAIN::t2\",AUTOINDEX=10);", "");
+  e |= chk(db, "SELECT \"s1\" FROM \"t11\" WHERE \"s2\"='banana' ORDER BY 1;", "3\n5\n");
+  e |= chk(db, "SELECT \"s1\" FROM \"t11\" WHERE \"s2\"='banana' ORDER BY 1;", "3\n5\n");
+  e |= chk(db, "INSERT INTO \"t11\" VALUES(6,'banana');", "");
+  e |= chk(db, "SELECT \"s1\" FROM \"t11\" WHERE \"s2\"='banana' ORDER BY 1;", "3\n5\n6\n");
+  e |= chk(db, "SELECT \"filters\",\"visited\",\"uses\",\"decision\" LIKE 'filter 2 built%' FROM \"clips_indexes\""
+   " WHERE \"table\"='t11' AND \"slot\"='s2';", "3 10 2 1\n");
+  e |= chk(db, "DELETE FROM \"t11\" WHERE \"s1\"=6;", "");
+
+  /* clips_timeout bounds the scans */
+  e |= chk(db, "SELECT clips_timeout(60000);", "0\n");
+  e |= chk(db, "SELECT COUNT(*) FROM \"t2\" WHERE \"s2\"<>'zzz';", "5\n");
+  e |= chk(db, "SELECT group_concat(\"s1\") FROM(SELECT \"s1\" FROM \"t2\" WHERE \"s2\"='banana' ORDER BY 1);", "3,5\n");
+  e |= chk(db, "SELECT clips_timeout(0);", "60000\n");
+
+  /* the HIDDEN fact column passes facts to clips_multifield and sql-query, which binds fact addresses alike */
+  e |= chk(db, "CREATE VIRTUAL TABLE \"t12\" USING CLIPS(\"MAIN::t4\",CACHE=COLUMNS);", "");
+  e |= chk(db, "SELECT group_concat(\"value\",' ') FROM \"t12\",\"clips_multifield\"(\"t12\".\"fact\",'s2');", "a 2 x y 3.5 b c 1 apple 2 Apricot\n");
+  if (Eval(ev, "(and(eq(nth$ 1(sql-query \"SELECT fact FROM t4 WHERE s1=2\"))(nth$ 1(find-fact((?f t4))(eq ?f:s1 2))))"
+   "(eq(implode$(sql-query \"SELECT value FROM clips_multifield(?,'s2')\"(nth$ 1(find-fact((?f t4))(eq ?f:s1 2)))))\"b c\"))", &v)
+   || v.lexemeValue != TrueSymbol(ev)) {
+    fprintf(stderr, "sql-query fact fail\n");
+    e = 1;
+  }
+
+  /* SYMBOLS=IDS reads and writes SYMBOL only slots as ids of clips_symbols */
+  e |= chk(db, "CREATE VIRTUAL TABLE \"t13\" USING CLIPS(\"MAIN::t13\",SYMBOLS=IDS);", "");
+  e |= chk(db, "INSERT INTO \"t13\" VALUES(1,CAST('red' AS BLOB)),(2,CAST('blue' AS BLOB)),(3,CAST('red' AS BLOB)),(4,NULL);", "");
+  e |= chk(db, "SELECT COUNT(DISTINCT \"s2\"),typeof(MAX(\"s2\")),COUNT(*)-COUNT(\"s2\") FROM \"t13\";", "2 integer 1\n");
+  e |= chk(db, "SELECT \"s1\" FROM \"t13\" WHERE \"s2\"=(SELECT \"id\" FROM \"clips_symbols\" WHERE \"symbol\"='red') ORDER BY 1;", "1\n3\n");
+  e |= chk(db, "UPDATE \"t13\" SET \"s2\"=(SELECT \"id\" FROM \"clips_symbols\" WHERE \"symbol\"='blue') WHERE \"s1\"=3;", "");
+  e |= chk(db, "SELECT \"symbol\",COUNT(*) FROM \"t13\",\"clips_symbols\" WHERE \"id\"=\"s2\" GROUP BY 1 ORDER BY 1;", "blue 2\nred 1\n");
+
+  /* clips_join hash joins templates on slots, nil joining nil */
+  e |= chk(db, "SELECT group_concat(\"key\") FROM(SELECT \"key\" FROM \"clips_join\"('t2','s1','t3','s1') ORDER BY 1);", "1,2,3\n");
+  e |= chk(db, "SELECT COUNT(*) FROM \"clips_join\"('t2','s1','t3','s1') AS \"j\",\"t2\",\"t3\""
+   " WHERE \"t2\".ROWID=\"j\".\"fact1\" AND \"t3\".ROWID=\"j\".\"fact2\" AND \"t2\".\"s1\"=\"t3\".\"s1\";", "3\n");
+  e |= chk(db, "SELECT group_concat(\"key\") FROM(SELECT \"key\" FROM \"clips_join\"('t2','s1','t3','s1','t5','s1') ORDER BY 1);", "1,3\n");
+  e |= chk(db, "SELECT \"key\",COUNT(*) FROM \"clips_join\"('t1','s3','t5','s2');", "NULL 1\n");
+
+  /* UPDATE modifies only the slots that change, and no fact when none does */
+  e |= chk(db, "CREATE VIRTUAL TABLE \"t14\" USING CLIPS(\"MAIN::t8\");", "");
+  e |= chk(db, "INSERT INTO \"t14\" VALUES(1,10),(2,20);", "");
+  e |= chk(db, "UPDATE \"t14\" SET \"s2\"=10 WHERE \"s1\"=1;", "");
+  e |= chk(db, "UPDATE \"t14\" SET \"s1\"=1,\"s2\"=11 WHERE \"s1\"=1;", "");
+  e |= chk(db, "UPDATE \"t14\" SET \"s2\"=\"s2\";", "");
+  e |= chk(db, "SELECT \"modifies\",\"unchanged\",\"slots_unchanged\" FROM \"clips_tables\" WHERE \"table\"='t14';", "1 3 4\n");
+  e |= chk(db, "SELECT \"s1\",\"s2\" FROM \"t14\" ORDER BY 1;", "1 11\n2 20\n");
+
+  /* clips_aggregate over a snapshot of a template's facts, count of a slot skipping nil */
+  e |= chk(db, "SELECT \"group\",\"facts\",\"value\" FROM \"clips_aggregate\"('t5','count');", "NULL 6 6\n");
+  e |= chk(db, "SELECT \"facts\",\"value\" FROM \"clips_aggregate\"('t5','count','s2');", "6 5\n");
+  e |= chk(db, "SELECT \"value\" FROM \"clips_aggregate\"('t5','sum','s3');", "7.5\n");
+  e |= chk(db, "SELECT \"value\" FROM \"clips_aggregate\"('t3','sum','s2','',1);", "6.5\n");
+  e |= chk(db, "SELECT \"value\" FROM \"clips_aggregate\"('t3','min','s2');", "1\n");
+  e |= chk(db, "SELECT \"value\" FROM \"clips_aggregate\"('t3','max','s2');", "3.5\n");
+  e |= chk(db, "SELECT round(\"value\",2) FROM \"clips_aggregate\"('t3','avg','s2');", "2.17\n");
+  e |= chk(db, "SELECT \"group\",\"value\" FROM \"clips_aggregate\"('t13','count','','s2');", "red 1\nblue 2\nNULL 1\n");
+  e |= chk(db, "SELECT \"value\" FROM \"clips_aggregate\"('t2','sum','s2');", 0);
+  e |= chk(db, "SELECT \"value\" FROM \"clips_aggregate\"('t4','count','s2');", 0);
+  e |= chk(db, "SELECT \"value\" FROM \"clips_aggregate\"('t3','sum');", 0);
+
+  /* clips_explain records the plans of the CLIPS tables and, running a read only sql, how the filters read the facts */
+  e |= chk(db, "SELECT \"plan\",\"filter\",\"filters\" FROM \"clips_explain\"('SELECT COUNT(*) FROM \"t14\"') WHERE \"filters\";",
+   "# maintained count 1\n");
+  e |= chk(db, "SELECT \"pushed\",\"filters\",\"rows\",substr(\"filter\",1,4) FROM \"clips_explain\"('SELECT \"s1\" FROM \"t14\" WHERE \"s1\"=1')"
+   " WHERE \"filters\";", "s1 = 1 1 Eval\n");
+  e |= chk(db, "SELECT COUNT(*)>0,COUNT(\"filters\") FROM \"clips_explain\"('DELETE FROM \"t14\" WHERE \"s1\"=2');", "1 0\n");
+  e |= chk(db, "SELECT COUNT(*) FROM \"t14\";", "2\n");
+  e |= chk(db, "SELECT * FROM \"clips_explain\"('SELECT * FROM \"nope\"');", 0);
+
+  /* clips_all_facts lists ordered facts too, with their fields as CLIPS text */
+  if (Eval(ev, "(assert(reading 42 3.5))", &v)) {
+    fprintf(stderr, "assert reading fail\n");
+    e = 1;
+  }
+  e |= chk(db, "SELECT \"arity\",\"fields\" FROM \"clips_all_facts\" WHERE \"relation\"='reading';", "2 42 3.5\n");
+  e |= chk(db, "SELECT \"relation\" FROM \"clips_all_facts\""
+   " WHERE \"fact\"=(SELECT \"fact\" FROM \"clips_all_facts\" WHERE \"relation\"='reading');", "reading\n");
+  e |= chk(db, "SELECT \"arity\",\"fields\" FROM \"clips_all_facts\" WHERE \"relation\"='t8' ORDER BY 2;",
+   "2 (s1 1) (s2 11)\n2 (s1 2) (s2 20)\n");
+  e |= chk(db, "SELECT \"fields\" FROM \"clips_all_facts\" WHERE \"relation\"='t4' AND \"fields\" LIKE '(s1 9)%';",
+   "(s1 9) (s2 1 \"apple\" 2 \"Apricot\")\n");
+  e |= chk(db, "SELECT COUNT(*) FROM \"clips_all_facts\" WHERE \"relation\"='nope';", "0\n");
+
+  /* REGEXP is left to the application's regexp() */
+  e |= chk(db, "SELECT COUNT(*) FROM \"t2\" WHERE \"s2\" REGEXP '^zzz';", "0\n");
+  if (sqlite3_create_function(db, "regexp", 2, SQLITE_UTF8, 0, rgx, 0, 0)) {
+    fprintf(stderr, "regexp fail\n");
+    e = 1;
+  }
+  e |= chk(db, "SELECT COUNT(*) FROM \"t2\" WHERE \"s2\" REGEXP '^zzz';", "5\n");
+
+  /* a second connection on the Environment shares the CLIPS functions, which stay until the last closes */
+  if (sqlite3_open(":memory:", &d2)
+   || sqlite3_clips_init(d2, ev)
+   || sqlite3_exec(d2, "CREATE VIRTUAL TABLE \"t2\" USING CLIPS(\"MAIN::t2\");", 0, 0, 0)) {
+    fprintf(stderr, "second connection fail\n");
+    return (-1);
+  }
+  e |= chk(d2, "SELECT COUNT(*) FROM \"t2\";", "5\n");
+  if (Eval(ev, "(and(=(nth$ 1(sql-query \"SELECT COUNT(*) FROM t2\"))5)(regexp-match \"^b\" banana))", &v)
+   || v.lexemeValue != TrueSymbol(ev)) {
+    fprintf(stderr, "second connection functions fail\n");
+    e = 1;
+  }
+  if (sqlite3_close(d2)) {
+    fprintf(stderr, "sqlite3_close fail\n");
+    return (-1);
+  }
+  if (Eval(ev, "(and(=(nth$ 1(sql-query \"SELECT COUNT(*) FROM t2\"))5)(regexp-match \"^b\" banana))", &v)
+   || v.lexemeValue != TrueSymbol(ev)) {
+    fprintf(stderr, "functions after close fail\n");
+    e = 1;
+  }
+
+  /* an expired clips_timeout stops the facts query of a filter with SQLITE_INTERRUPT */
+  e |= chk(db, "CREATE VIRTUAL TABLE \"t15\" USING CLIPS(\"MAIN::t15\");", "");
+  e |= chk(db, "INSERT INTO \"t15\" WITH RECURSIVE \"c\"(\"i\") AS(SELECT 1 UNION ALL SELECT \"i\"+1 FROM \"c\" WHERE \"i\"<200000)"
+   " SELECT \"i\" FROM \"c\";", "");
+  e |= chk(db, "SELECT clips_timeout(1);", "0\n");
+  if (sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM \"t15\" WHERE \"s1\"<>0;", -1, &st, 0)
+   || sqlite3_step(st) != SQLITE_INTERRUPT) {
+    fprintf(stderr, "clips_timeout fail\n");
+    e = 1;
+  }
+  sqlite3_finalize(st);
+  e |= chk(db, "SELECT clips_timeout(0);", "1\n");
+  e |= chk(db, "SELECT COUNT(*) FROM \"t15\" WHERE \"s1\"<>0;", "200000\n");
+  e |= chk(db, "DELETE FROM \"t15\";", "");
+
+  /* closing undefines the standing queries' rules and templates */
+  e |= chk(db, "SELECT clips_query_register('q3','(t3(s1 ?a))','?a');", "NULL\n");
   if (sqlite3_close(db)) {
     fprintf(stderr, "sqlite3_close fail\n");
     return (-1);
   }
+  if (FindDefrule(ev, "SQLiteCLIPS-query-q3") || FindDeftemplate(ev, "SQLiteCLIPS-query-q3")) {
+    fprintf(stderr, "standing query close fail\n");
+    e = 1;
+  }
   if (!DestroyEnvironment(ev)) {
     fprintf(stderr, "DestroyEnvironment fail\n");
     return (-1);
   }
-  return (0);
+  return (e);
 }